@@ -224,6 +224,9 @@ class Blob {
   const Dtype* cpu_diff() const;
   const Dtype* gpu_diff() const;
   Dtype* mutable_cpu_data();
+  /// @brief Like mutable_cpu_data, but leaves newly allocated memory
+  ///        uninitialized, for callers overwriting all of it.
+  Dtype* mutable_cpu_data_for_overwrite();
   Dtype* mutable_gpu_data();
   Dtype* mutable_cpu_diff();
   Dtype* mutable_gpu_diff();
@@ -121,12 +121,13 @@ class Caffe {
   };
 
   // Getters for boost rng, curand, and cublas handles
-  inline static RNG& rng_stream() {
-    if (!Get().random_generator_) {
-      Get().random_generator_.reset(new RNG());
-    }
-    return *(Get().random_generator_);
-  }
+  // The boost rng is the one set for the calling thread by
+  // set_thread_rng_stream, if any, or else the one shared by all threads.
+  static RNG& rng_stream();
+  // Makes the calling thread draw from rng, which it does not own, instead
+  // of the shared boost rng; NULL goes back to the shared one. Returns the
+  // previous rng of the thread, or NULL if it used the shared one.
+  static RNG* set_thread_rng_stream(RNG* rng);
 #ifndef CPU_ONLY
   inline static cublasHandle_t cublas_handle() { return Get().cublas_handle_; }
   inline static curandGenerator_t curand_generator() {
@@ -12,6 +12,7 @@
 #include "caffe/loss_layers.hpp"
 #include "caffe/neuron_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/mpi_templates.hpp"
 
 namespace caffe {
 
@@ -197,6 +198,9 @@ class FilterLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Filter"; }
+  // The number of selected items, and thus the top shapes, depend on the
+  // values of the selector.
+  virtual inline bool ReshapeEveryForward() const { return true; }
   virtual inline int MinBottomBlobs() const { return 2; }
   virtual inline int MinTopBlobs() const { return 1; }
 
@@ -294,6 +298,11 @@ class FlattenLayer : public Layer<Dtype> {
  * @brief Also known as a "fully-connected" layer, computes an inner product
  *        with a set of learned weights, and (optionally) adds biases.
  *
+ * With a positive inner_product_param.rank, the weights are factored as
+ * @f$ W = U V @f$, with @f$ U @f$ of shape num_output x rank in the first
+ * blob and @f$ V @f$ of shape rank x input size in the last blob (after the
+ * bias), and the inputs are first projected by @f$ V @f$.
+ *
  * TODO(dox): thorough documentation for Forward, Backward, and proto params.
  */
 template <typename Dtype>
@@ -309,6 +318,14 @@ class InnerProductLayer : public Layer<Dtype> {
   virtual inline const char* type() const { return "InnerProduct"; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  /// Except in model-parallel mode, which writes the top in its own passes.
+  virtual inline bool CanFuseActivation() const { return !model_parallel_; }
+
+  /// @brief In model-parallel mode, gathers the weight shards to the root.
+  virtual void ToProto(LayerParameter* param, bool write_diff = false);
+#ifdef USE_MPI
+  virtual inline bool UsesMPI() const { return model_parallel_; }
+#endif
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -320,11 +337,49 @@ class InnerProductLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  /// @brief Backward with the weights factored into rank_ dimensions.
+  void BackwardFactored_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  void BackwardFactored_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+#ifdef USE_MPI
+  /**
+   * @brief Model-parallel forward: each MPI process holds N_local_ rows of
+   *        the weights, computes its N_local_ outputs for the whole batch,
+   *        and the output slices are all-gathered into the (replicated) top.
+   */
+  void ForwardModelParallel_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void BackwardModelParallel_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+#endif
+
   int M_;
   int K_;
   int N_;
   bool bias_term_;
   Blob<Dtype> bias_multiplier_;
+
+  /// The rank of the factored weights, or 0 if they are not factored.
+  int rank_;
+  /// The index of the blob of the rank x K_ factor of the weights.
+  int factor_index_;
+  /// The inputs projected by that factor, M_ x rank_.
+  Blob<Dtype> projection_;
+
+  /// Whether the output dimension is sharded across the MPI processes.
+  bool model_parallel_;
+  /// Whether the bottom has to be all-gathered along the batch axis first.
+  bool gather_bottom_;
+  /// The number of outputs computed by this process (N_ / mpi_size).
+  int N_local_;
+  /// The all-gathered bottom, used when gather_bottom_ is set.
+  Blob<Dtype> gathered_bottom_;
+  /// This process' slice of the output, M_ x N_local_.
+  Blob<Dtype> local_top_;
+  /// The slices of all the processes, mpi_size x M_ x N_local_.
+  Blob<Dtype> gathered_top_;
 };
 
 /**
@@ -610,6 +665,10 @@ class SliceLayer : public Layer<Dtype> {
  * @brief Gather bottom blob from MPI processes and concatenate them in rank
  *        order as the output.
  *
+ * Forward posts an MPI_Igather and Backward an MPI_Iscatter per blob and
+ * return immediately, so that independent branches of the net can run while
+ * the data is in flight. Net waits for completion before the blobs are used.
+ *
  * TODO(dox): thorough documentation for Forward, Backward, and proto params.
  */
 template <typename Dtype>
@@ -617,6 +676,9 @@ class MPIGatherLayer : public Layer<Dtype> {
  public:
   explicit MPIGatherLayer(const LayerParameter& param)
       : Layer<Dtype>(param) {}
+#ifdef USE_MPI
+  virtual ~MPIGatherLayer() { WaitForCommunication(); }
+#endif
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
@@ -624,17 +686,33 @@ class MPIGatherLayer : public Layer<Dtype> {
 
   virtual inline const char* type() const { return "MPIGather"; }
 
+#ifdef USE_MPI
+  virtual inline bool IsAsynchronous() const { return true; }
+  virtual void WaitForCommunication();
+#endif
+
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+#ifdef USE_MPI
+  /// The outstanding requests, one per blob.
+  vector<MPI_Request> requests_;
+#endif
 };
 
 /**
  * @brief Batch normalization the input blob along the channel axis while
  *        averaging over the spatial axes.
  *
+ * The input may have any number of spatial axes after the channel axis. On
+ * the CPU, the statistics of each channel are gathered in a single pass over
+ * the input, and the normalization, scale and shift are applied in a second
+ * one; Backward likewise makes one pass to reduce the gradients and one to
+ * compute the bottom diff.
+ *
  * TODO(dox): thorough documentation for Forward, Backward, and proto params.
  */
 template <typename Dtype>
@@ -650,6 +728,13 @@ class BNLayer : public Layer<Dtype> {
   virtual inline const char* type() const { return "BN"; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  // Forward updates the moving averages when training.
+  virtual inline bool CanRecomputeForward() const {
+    return !moving_average_ || this->phase_ != TRAIN;
+  }
+#ifdef USE_MPI
+  virtual inline bool UsesMPI() const { return sync_stats_; }
+#endif
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -661,27 +746,47 @@ class BNLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
-  void AverageAllExceptChannel(const Dtype* input, Dtype* output);
-  void BroadcastChannel(const Dtype* input, Dtype* output);
+  /// Computes the mean and the (biased) variance of each channel of input.
+  void ComputeChannelStatistics(const Dtype* input, Dtype* mean,
+      Dtype* variance);
+#ifdef USE_MPI
+  /// Replaces the statistics of the local batch by those of the batches of
+  /// all the processes, in a single Allreduce.
+  void SyncChannelStatistics(Dtype* mean, Dtype* variance);
+  /// Sums the per-channel sums of the top diff and of the top diff times
+  /// x_hat over the processes, and returns the global number of values per
+  /// channel.
+  Dtype SyncDiffSums(Dtype* sum_diff, Dtype* sum_diff_x_norm);
+#endif
 
   bool moving_average_;
+  bool sync_stats_;
   Dtype bn_momentum_;
   Dtype bn_eps_;
 
   int num_;
   int channels_;
-  int height_;
-  int width_;
+  /// The product of the spatial axes, i.e. all the axes after the channels.
+  int spatial_dim_;
 
   Blob<Dtype> broadcast_buffer_;
   Blob<Dtype> spatial_statistic_;
   Blob<Dtype> batch_statistic_;
+  /// The per-channel sums of the top diff in the GPU backward pass.
+  Blob<Dtype> diff_statistic_;
 
+  /// The normalized inputs, only kept on the CPU when computing in place.
   Blob<Dtype> x_norm_;
   Blob<Dtype> x_std_;
 
   Blob<Dtype> spatial_sum_multiplier_;
   Blob<Dtype> batch_sum_multiplier_;
+  /// The per-channel sums exchanged between processes with sync_stats,
+  /// kept in double so that large batches sum without losing precision.
+  vector<double> sync_buffer_;
+  /// The global mean of the previous batch, about which the sums above are
+  /// taken.
+  vector<double> sync_pivot_;
 };
 
 }  // namespace caffe
@@ -13,6 +13,8 @@
 
 namespace caffe {
 
+template <typename Dtype> class NeuronLayer;
+
 /**
  * @brief An interface for the units of computation which can be composed into a
  *        Net.
@@ -32,7 +34,7 @@ class Layer {
    * layer.
    */
   explicit Layer(const LayerParameter& param)
-    : layer_param_(param) {
+    : layer_param_(param), fused_activation_(NULL) {
       // Set phase and copy blobs (if there are any).
       phase_ = param.phase();
       if (layer_param_.blobs_size() > 0) {
@@ -63,6 +65,7 @@ class Layer {
     CheckBlobCounts(bottom, top);
     LayerSetUp(bottom, top);
     Reshape(bottom, top);
+    RecordShapes(bottom, top);
     SetLossWeights(top);
   }
 
@@ -100,6 +103,16 @@ class Layer {
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) = 0;
 
+  /**
+   * @brief Returns true if Reshape must run before every Forward.
+   *
+   * By default Forward only calls Reshape when the bottom or top blobs have
+   * changed since the last Reshape: other blobs, other shapes, or other
+   * memory (e.g. after ShareData). Layers whose top shapes depend on the
+   * values of their bottom blobs should return true.
+   */
+  virtual inline bool ReshapeEveryForward() const { return false; }
+
   /**
    * @brief Given the bottom blobs, compute the top blobs and the loss.
    *
@@ -263,6 +276,53 @@ class Layer {
     return true;
   }
 
+  /**
+   * @brief Returns true if Forward may run again before Backward to
+   *        recompute the tops, as Net does when checkpointing.
+   *
+   * This method should be overridden to return false if Forward also updates
+   * state that outlives the pass, such as running averages.
+   */
+  virtual inline bool CanRecomputeForward() const { return true; }
+
+  /**
+   * @brief Returns true if Forward can apply a NeuronLayer to the top blob
+   *        as it writes it, see set_fused_activation.
+   */
+  virtual inline bool CanFuseActivation() const { return false; }
+  /**
+   * @brief Sets the NeuronLayer that Forward applies in place to the top
+   *        blob, or NULL for none.
+   *
+   * Net sets it when fuse_activations is on, and marks the NeuronLayer as
+   * fused so that its own Forward does nothing.
+   */
+  inline void set_fused_activation(NeuronLayer<Dtype>* activation) {
+    fused_activation_ = activation;
+  }
+
+#ifdef USE_MPI
+  /**
+   * @brief Returns true if Forward and Backward may return before the MPI
+   *        communication they posted has completed.
+   *
+   * Until WaitForCommunication() is called, the data of the bottom and top
+   * blobs (after Forward) or their diffs (after Backward) must not be used.
+   * Net waits lazily, right before another layer touches one of these blobs.
+   */
+  virtual inline bool IsAsynchronous() const { return false; }
+  /// @brief Block until the communication posted by the layer has completed.
+  virtual void WaitForCommunication() {}
+  /**
+   * @brief Returns true if Forward or Backward make MPI calls.
+   *
+   * When Net runs independent layers concurrently, such layers still run on
+   * the calling thread, one at a time and in the order of the net, so that
+   * every process issues the same collectives in the same order.
+   */
+  virtual inline bool UsesMPI() const { return IsAsynchronous(); }
+#endif
+
   /**
    * @brief Specifies whether the layer should compute gradients w.r.t. a
    *        parameter at a particular index given by param_id.
@@ -300,6 +360,15 @@ class Layer {
    *  the objective function. */
   vector<Dtype> loss_;
 
+  /** The bottom then top blobs at the last Reshape, with their shapes and
+   *  their data and diff memory, to detect when Reshape can be skipped. */
+  vector<const Blob<Dtype>*> reshaped_blobs_;
+  vector<vector<int> > reshaped_shapes_;
+  vector<const SyncedMemory*> reshaped_memory_;
+
+  /** The NeuronLayer applied to the top blob in Forward, if any. */
+  NeuronLayer<Dtype>* fused_activation_;
+
   /** @brief Using the CPU device, compute the layer output. */
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) = 0;
@@ -396,6 +465,39 @@ class Layer {
     }
   }
 
+  /** Records the bottom and top blobs the layer has been reshaped for. */
+  void RecordShapes(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+    reshaped_blobs_.clear();
+    reshaped_shapes_.clear();
+    reshaped_memory_.clear();
+    for (int i = 0; i < bottom.size() + top.size(); ++i) {
+      const Blob<Dtype>* blob =
+          i < bottom.size() ? bottom[i] : top[i - bottom.size()];
+      reshaped_blobs_.push_back(blob);
+      reshaped_shapes_.push_back(blob->shape());
+      reshaped_memory_.push_back(blob->data().get());
+      reshaped_memory_.push_back(blob->diff().get());
+    }
+  }
+
+  /** Returns true if the blobs differ from the ones recorded by RecordShapes.
+   */
+  bool ShapesChanged(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) const {
+    if (reshaped_blobs_.size() != bottom.size() + top.size()) { return true; }
+    for (int i = 0; i < reshaped_blobs_.size(); ++i) {
+      const Blob<Dtype>* blob =
+          i < bottom.size() ? bottom[i] : top[i - bottom.size()];
+      if (blob != reshaped_blobs_[i] || blob->shape() != reshaped_shapes_[i] ||
+          blob->data().get() != reshaped_memory_[2 * i] ||
+          blob->diff().get() != reshaped_memory_[2 * i + 1]) {
+        return true;
+      }
+    }
+    return false;
+  }
+
   DISABLE_COPY_AND_ASSIGN(Layer);
 };  // class Layer
 
@@ -406,7 +508,10 @@ template <typename Dtype>
 inline Dtype Layer<Dtype>::Forward(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   Dtype loss = 0;
-  Reshape(bottom, top);
+  if (ReshapeEveryForward() || ShapesChanged(bottom, top)) {
+    Reshape(bottom, top);
+    RecordShapes(bottom, top);
+  }
   switch (Caffe::mode()) {
   case Caffe::CPU:
     Forward_cpu(bottom, top);
@@ -88,6 +88,92 @@ class AccuracyLayer : public Layer<Dtype> {
   int ignore_label_;
 };
 
+/**
+ * @brief Accumulates the average precision (AP) of each label of a
+ *        multi-label classification task over many batches.
+ *
+ * The layer has no top: every Forward adds the scores of the batch to
+ * histograms of the scores of the positive and negative instances of each
+ * label, and ComputeAP() computes the AP of each label and their mean (mAP)
+ * from everything accumulated since ResetStatistics(). The Solver does both
+ * around each test, and logs the APs and the mAP.
+ */
+template <typename Dtype>
+class MultiLabelAPLayer : public Layer<Dtype> {
+ public:
+  /**
+   * @param param provides MultiLabelAPParameter multilabel_ap_param,
+   *     with MultiLabelAPLayer options:
+   *   - num_bins (\b optional, default 1000).
+   *     The resolution of the histograms of the scores.
+   *   - apply_sigmoid (\b optional, default true).
+   *     Whether the scores are logits rather than probabilities.
+   *   - ignore_label (\b optional).
+   *     The label value of the scores to leave out.
+   */
+  explicit MultiLabelAPLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "MultiLabelAP"; }
+  virtual inline int ExactNumBottomBlobs() const { return 2; }
+  virtual inline int ExactNumTopBlobs() const { return 0; }
+
+  /// @brief Forgets the scores accumulated so far.
+  void ResetStatistics();
+#ifdef USE_MPI
+  /**
+   * @brief Sums the accumulated statistics over the MPI processes, which
+   *        must all call it.
+   */
+  void ReduceStatistics();
+#endif
+  /**
+   * @brief Computes the AP of each label from the scores accumulated so far.
+   *
+   * @param ap receives the AP of each label, or -1 for the labels without any
+   *     positive instance.
+   * @return the mean of the APs of the labels with positive instances.
+   */
+  Dtype ComputeAP(vector<Dtype>* ap) const;
+
+ protected:
+  /**
+   * @param bottom input Blob vector (length 2)
+   *   -# @f$ (N \times K \times ...) @f$
+   *      the scores of the @f$ K @f$ labels (the product of all the axes
+   *      after the first) of each instance
+   *   -# @f$ (N \times K \times ...) @f$
+   *      the labels, 1 for the positive instances and 0 for the negative ones
+   */
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  /// @brief Not implemented -- MultiLabelAPLayer cannot be used as a loss.
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+    for (int i = 0; i < propagate_down.size(); ++i) {
+      if (propagate_down[i]) { NOT_IMPLEMENTED; }
+    }
+  }
+
+  int num_labels_;
+  int num_bins_;
+  bool apply_sigmoid_;
+
+  /// Whether to ignore instances with a certain label.
+  bool has_ignore_label_;
+  /// The label indicating that an instance should be ignored.
+  int ignore_label_;
+
+  /// The number of negative (0) and positive (1) instances of each label
+  /// whose score fell in each bin, with shape (2, num_labels_, num_bins_).
+  Blob<Dtype> histograms_;
+};
+
 /**
  * @brief An interface for Layer%s that take two Blob%s as input -- usually
  *        (1) predictions and (2) ground-truth labels -- and output a
@@ -571,6 +657,12 @@ class MultinomialLogisticLossLayer : public LossLayer<Dtype> {
  * as its gradient computation is more numerically stable.
  * At test time, this layer can be replaced simply by a SigmoidLayer.
  *
+ * The loss of the positive targets of each output may be weighted by the
+ * pos_weight of sigmoid_cross_entropy_loss_param, and the outputs whose
+ * target is the ignore_label of loss_param are left out of the loss. The
+ * loss, the sigmoid kept for Backward and the gradient are each computed in
+ * a single pass.
+ *
  * @param bottom input Blob vector (length 2)
  *   -# @f$ (N \times C \times H \times W) @f$
  *      the scores @f$ x \in [-\infty, +\infty]@f$,
@@ -592,7 +684,6 @@ class SigmoidCrossEntropyLossLayer : public LossLayer<Dtype> {
  public:
   explicit SigmoidCrossEntropyLossLayer(const LayerParameter& param)
       : LossLayer<Dtype>(param),
-          sigmoid_layer_(new SigmoidLayer<Dtype>(param)),
           sigmoid_output_(new Blob<Dtype>()) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -641,14 +732,14 @@ class SigmoidCrossEntropyLossLayer : public LossLayer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
-  /// The internal SigmoidLayer used to map predictions to probabilities.
-  shared_ptr<SigmoidLayer<Dtype> > sigmoid_layer_;
-  /// sigmoid_output stores the output of the SigmoidLayer.
+  /// sigmoid_output stores the sigmoid of the predictions.
   shared_ptr<Blob<Dtype> > sigmoid_output_;
-  /// bottom vector holder to call the underlying SigmoidLayer::Forward
-  vector<Blob<Dtype>*> sigmoid_bottom_vec_;
-  /// top vector holder to call the underlying SigmoidLayer::Forward
-  vector<Blob<Dtype>*> sigmoid_top_vec_;
+  /// The weight of the positive targets of each output of an instance.
+  Blob<Dtype> pos_weight_;
+  /// Whether to ignore the outputs with a certain target.
+  bool has_ignore_label_;
+  /// The target indicating that an output should be ignored.
+  int ignore_label_;
 };
 
 // Forward declare SoftmaxLayer for use in SoftmaxWithLossLayer.
@@ -11,9 +11,12 @@
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/weight_file.hpp"
 
 namespace caffe {
 
+class DagScheduler;
+
 /**
  * @brief Connects Layer%s together into a directed acyclic graph (DAG)
  *        specified by a NetParameter.
@@ -77,7 +80,9 @@ class Net {
    * @brief Reshape all layers from bottom to top.
    *
    * This is useful to propagate changes to layer sizes without running
-   * a forward pass, e.g. to compute output feature size.
+   * a forward pass, e.g. to compute output feature size. With memory_plan,
+   * checkpoint or share_diffs, the memory is planned again for the new
+   * sizes.
    */
   void Reshape();
 
@@ -103,6 +108,11 @@ class Net {
    *        additional memory) the pre-trained layers from another Net.
    */
   void ShareTrainedLayersWith(const Net* other);
+  /**
+   * @brief For an already initialized net, copies the data of the pre-trained
+   *        layers from another Net into the params of this one.
+   */
+  void CopyTrainedLayersFrom(const Net* other);
   // For an already initialized net, CopyTrainedLayersFrom() copies the already
   // trained layers from another net parameter instance.
   /**
@@ -113,6 +123,12 @@ class Net {
   void CopyTrainedLayersFrom(const string trained_filename);
   void CopyTrainedLayersFromBinaryProto(const string trained_filename);
   void CopyTrainedLayersFromHDF5(const string trained_filename);
+  /**
+   * @brief Copies the pre-trained layers from a raw weight container (see
+   *        WeightFile). In the TEST phase the params are not copied but backed
+   *        by the mapped file itself, which is kept alive by the net.
+   */
+  void CopyTrainedLayersFromWeightFile(const string trained_filename);
   /// @brief Writes the net to a proto.
   void ToProto(NetParameter* param, bool write_diff = false) const;
   /// @brief Writes the net to an HDF5 file.
@@ -120,7 +136,19 @@ class Net {
 
 #ifdef USE_MPI
   // Synchronize the parameters of each layer among all the MPI processors.
+  // Only the data of the params is synchronized, not their diffs.
   void SyncLayers();
+  /**
+   * @brief Broadcast the params of the serial layers from the root process.
+   *
+   * Serial layers only compute meaningful gradients on the root, so their
+   * params drift on the other processes during training. Call this before
+   * running the net (or a net sharing its params) data-parallel.
+   */
+  void SyncSerialLayers();
+  /// @brief Whether a blob is computed data-parallel, i.e. each process
+  ///        holds the values for its own part of the batch.
+  bool IsParallelBlob(const int blob_id) const;
 #endif
 
   /// @brief returns the network name.
@@ -222,6 +250,14 @@ class Net {
 
 #ifdef USE_MPI
   inline const set<string>& serial_layers() const { return serial_layers_; }
+  /// @brief returns whether every layer runs data-parallel (no gathers)
+  inline bool data_parallel() const { return data_parallel_; }
+  /// @brief returns the model-parallel layers, whose params are sharded
+  inline const set<string>& sharded_layers() const { return sharded_layers_; }
+  /// @brief returns whether each learnable param holds only a shard
+  inline const vector<bool>& learnable_params_sharded() const {
+    return learnable_params_sharded_;
+  }
 #endif
 
  protected:
@@ -244,12 +280,72 @@ class Net {
   void ForwardDebugInfo(const int layer_id);
   /// @brief Helper for displaying debug info in Backward.
   void BackwardDebugInfo(const int layer_id);
+  /// @brief Whether ForwardFromTo and BackwardFromTo use scheduler_.
+  bool UseScheduler() const;
+  /// @brief Runs the given layers on scheduler_, see dag_scheduler.
+  void RunScheduled(const vector<int>& layer_ids, const bool forward);
+  /// @brief Runs layer layer_ids[index]; a task of RunScheduled.
+  void RunScheduledLayer(const vector<int>* layer_ids, const bool forward,
+      const int index);
   /// @brief Helper for displaying debug info in Update.
   void UpdateDebugInfo(const int param_id);
+  /// @brief Gets the first and last layers using each blob.
+  void GetBlobLifetimes(vector<int>* first_uses, vector<int>* last_uses) const;
+  /// @brief Lets the intermediate blobs share memory_arena_, see memory_plan.
+  void PlanMemory();
+  /// @brief Lets the diffs of the blobs share diff_arena_, see share_diffs.
+  void ShareDiffs();
+  /// @brief Lets layers apply the activation that follows them, see
+  ///        fuse_activations.
+  void FuseActivations();
+  /// @brief Finds the blobs that can be views, see zero_copy_concat.
+  void PlanViews();
+  /// @brief Points the views planned by PlanViews into their root blobs.
+  void ApplyViews();
+  /**
+   * @brief Returns true if running a layer may reshape a blob away from the
+   *        views planned by PlanViews, as when the shapes of the net change
+   *        in Forward without a Reshape.
+   */
+  bool ViewsReshaped(const int layer_id) const;
+  /// @brief Gives each view memory of its own again, keeping its values,
+  ///        until the next Reshape plans the views again.
+  void DropViews();
+  /**
+   * @brief Keeps the views out of a memory plan: the views are pinned, and
+   *        each root blob is used over the lifetimes of its views as well.
+   */
+  void ExtendViewLifetimes(vector<int>* first_uses, vector<int>* last_uses,
+      vector<bool>* pinned) const;
+  /**
+   * @brief Marks the bottoms and tops of asynchronous layers, whose memory
+   *        MPI may still use after the layer has run.
+   */
+  void PinAsynchronousBlobs(vector<bool>* pinned) const;
+  /// @brief Splits the layers into checkpointed segments, see checkpoint.
+  void InitCheckpoints(const NetParameter& param);
+  /// @brief Lets the blobs inside the segments share memory, see checkpoint.
+  void PlanCheckpoints();
+  /// @brief Runs the forward pass of a segment again, up to layer end.
+  void RecomputeSegment(const int segment, const int end);
 
 #ifdef USE_MPI
   /// @brief Determine whether a layer should be in parallel or serial.
   void DetermineLayerParallelOrSerial(const NetParameter& param);
+  /**
+   * @brief Broadcast the data of the given blobs from the root process, packed
+   *        into a single buffer. If skip_if_equal, first compare checksums and
+   *        skip the broadcast when all the processes already agree.
+   */
+  void BroadcastBlobData(const vector<Blob<Dtype>*>& blobs,
+      bool skip_if_equal);
+  /// @brief Record the blobs of an asynchronous layer as in flight.
+  void MarkPendingBlobs(const int layer_id);
+  /// @brief Wait for the communication on the bottoms and tops of a layer.
+  void WaitForPendingBlobs(const int layer_id);
+  /// @brief Wait for all the communication still in flight.
+  void WaitForAllPendingBlobs();
+  void ClearPendingBlobs(const int layer_id);
 #endif
 
   /// @brief The network name
@@ -309,10 +405,64 @@ class Net {
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// The weight files backing the data of some params, see
+  /// CopyTrainedLayersFromWeightFile.
+  vector<shared_ptr<WeightFile> > mapped_weights_;
+  /// Runs independent layers concurrently, if dag_scheduler is set.
+  shared_ptr<DagScheduler> scheduler_;
+  /// The random stream of each layer when run by scheduler_.
+  vector<shared_ptr<Caffe::RNG> > layer_rngs_;
+  /// The loss of each layer in the last scheduled forward pass.
+  vector<Dtype> layer_losses_;
+  /// Whether the data of the intermediate blobs is planned, see memory_plan.
+  bool memory_plan_;
+  /// The blobs kept out of the memory plan, besides the inputs and outputs.
+  set<string> pinned_blobs_;
+  /// The memory shared by the planned blobs.
+  shared_ptr<SyncedMemory> memory_arena_;
+  /// Whether the diffs of the blobs are shared, see share_diffs.
+  bool share_diffs_;
+  /// The memory shared by the diffs.
+  shared_ptr<SyncedMemory> diff_arena_;
+  /// Whether Concat and Slice parts are views, see zero_copy_concat.
+  bool zero_copy_concat_;
+  /// The blob each blob is a view into and the offset of the view, or -1.
+  vector<int> view_roots_;
+  vector<int> view_offsets_;
+  /// The shape of each blob when the views were planned, or empty if there
+  /// are no views.
+  vector<vector<int> > view_shapes_;
+  /// The memory of the root blobs, kept for the blobs that stop being views
+  /// after a reshape and still point into it.
+  set<shared_ptr<SyncedMemory> > view_memories_;
+  /// The first layer of each checkpointed segment, and the segment of each
+  /// layer; empty unless checkpoint is set.
+  vector<int> segment_begins_;
+  vector<int> layer_segments_;
+  /// Whether the blobs inside the segments share memory, so that each
+  /// segment is recomputed before its backward pass.
+  bool checkpointing_;
+  /// Whether RecomputeSegment runs each layer again.
+  vector<bool> layer_recomputed_;
+  /// The random stream before each recomputed layer in the last forward pass.
+  vector<shared_ptr<Caffe::RNG> > recompute_rngs_;
+  /// The segment whose inside blobs hold the data of the last pass, or -1.
+  int resident_segment_;
+  /// The memory shared by the data and by the diffs of the segments.
+  shared_ptr<SyncedMemory> checkpoint_data_arena_;
+  shared_ptr<SyncedMemory> checkpoint_diff_arena_;
 
 #ifdef USE_MPI
   /// The layers in serialization.
   set<string> serial_layers_;
+  /// Whether the net runs fully data-parallel, see mpi_data_parallel.
+  bool data_parallel_;
+  /// The model-parallel layers, each process holding a shard of the params.
+  set<string> sharded_layers_;
+  vector<bool> learnable_params_sharded_;
+  /// For each blob, the asynchronous layer that still has communication in
+  /// flight on it, or -1.
+  vector<int> blob_pending_layer_;
 #endif
 
   DISABLE_COPY_AND_ASSIGN(Net);
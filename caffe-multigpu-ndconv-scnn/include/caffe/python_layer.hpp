@@ -26,6 +26,8 @@ class PythonLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top) {
     self_.attr("reshape")(bottom, top);
   }
+  // The Python reshape may depend on anything, so it always runs.
+  virtual inline bool ReshapeEveryForward() const { return true; }
 
   virtual inline const char* type() const { return "Python"; }
 
@@ -4,10 +4,40 @@
 #include <string>
 #include <vector>
 
+#include "caffe/internal_thread.hpp"
 #include "caffe/net.hpp"
 
 namespace caffe {
 
+/**
+ * @brief Writes a snapshot of the net and the solver state to binary proto
+ *        files on a background thread (SolverParameter.snapshot_async).
+ *
+ * The solver stages the snapshot into net_param() and state() and calls
+ * Start(). The staging protos are reused from one snapshot to the next, so
+ * Wait() must return before they are touched again.
+ */
+class SnapshotWriter : public InternalThread {
+ public:
+  SnapshotWriter() {}
+  virtual ~SnapshotWriter() { Wait(); }
+
+  NetParameter* net_param() { return &net_param_; }
+  SolverState* state() { return &state_; }
+  void Start(const string& model_filename, const string& state_filename);
+  /// @brief Returns once the snapshot in flight, if any, is on disk.
+  void Wait() { WaitForInternalThreadToExit(); }
+
+ protected:
+  virtual void InternalThreadEntry();
+
+  NetParameter net_param_;
+  SolverState state_;
+  string model_filename_, state_filename_;
+
+  DISABLE_COPY_AND_ASSIGN(SnapshotWriter);
+};
+
 /**
  * @brief An interface for classes that perform optimization on Net%s.
  *
@@ -49,10 +79,16 @@ class Solver {
   string SnapshotFilename(const string extension);
   string SnapshotToBinaryProto();
   string SnapshotToHDF5();
+  // Stages the snapshot and hands it to snapshot_writer_.
+  void SnapshotAsync();
   // The test routine
   void TestAll();
   void Test(const int test_net_id = 0);
+  // Copies the weights to the test nets and tests them on test_thread_.
+  void TestAllAsync();
   virtual void SnapshotSolverState(const string& model_filename) = 0;
+  virtual void SnapshotSolverStateToProto(const string& model_filename,
+      SolverState* state) = 0;
   virtual void RestoreSolverStateFromHDF5(const string& state_file) = 0;
   virtual void RestoreSolverStateFromBinaryProto(const string& state_file) = 0;
   void DisplayOutputBlobs(const int net_id);
@@ -62,6 +98,33 @@ class Solver {
   int current_step_;
   shared_ptr<Net<Dtype> > net_;
   vector<shared_ptr<Net<Dtype> > > test_nets_;
+  // The iteration whose weights the test nets are evaluating.
+  int test_iter_;
+  // Whether the test nets run on test_thread_ (test_async), in which case
+  // they hold a copy of the weights instead of sharing them.
+  bool test_async_;
+  shared_ptr<SnapshotWriter> snapshot_writer_;
+
+  /// @brief Runs the test nets in the background, see test_async.
+  class TestThread : public InternalThread {
+   public:
+    explicit TestThread(Solver* solver)
+        : solver_(solver), device_(0), rng_seed_(0) {}
+    virtual ~TestThread() { WaitForInternalThreadToExit(); }
+    // Starts testing on the CUDA device of the calling thread.
+    void Start();
+
+   protected:
+    virtual void InternalThreadEntry();
+
+    Solver* solver_;
+    int device_;
+    // Seeds the rng of the test, drawn on the training thread at Start().
+    unsigned int rng_seed_;
+  };
+  friend class TestThread;
+  // Declared last, so that it is joined before the nets are destroyed.
+  shared_ptr<TestThread> test_thread_;
 
   DISABLE_COPY_AND_ASSIGN(Solver);
 };
@@ -88,8 +151,23 @@ class SGDSolver : public Solver<Dtype> {
   virtual void Normalize(int param_id);
   virtual void Regularize(int param_id);
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  /**
+   * @brief Normalize and regularize the gradient, compute the update value
+   *        and apply it to a param in one pass on the CPU.
+   *
+   * Leaves the param and history in the same state as Normalize(),
+   * Regularize(), ComputeUpdateValue() and Blob::Update() in sequence.
+   */
+  virtual void ComputeFusedUpdate_cpu(int param_id, Dtype rate);
+  /// @brief Whether the solver implements ComputeFusedUpdate_cpu().
+  virtual inline bool HasFusedUpdate() const { return true; }
+  /// @brief The per-param scalars of Normalize() and Regularize().
+  void GetFusedUpdateScalars(int param_id, Dtype* normalization,
+      Dtype* local_decay, bool* l1);
   virtual void ClipGradients();
   virtual void SnapshotSolverState(const string& model_filename);
+  virtual void SnapshotSolverStateToProto(const string& model_filename,
+      SolverState* state);
   virtual void SnapshotSolverStateToBinaryProto(const string& model_filename);
   virtual void SnapshotSolverStateToHDF5(const string& model_filename);
   virtual void RestoreSolverStateFromHDF5(const string& state_file);
@@ -113,6 +191,7 @@ class NesterovSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeFusedUpdate_cpu(int param_id, Dtype rate);
 
   DISABLE_COPY_AND_ASSIGN(NesterovSolver);
 };
@@ -127,6 +206,7 @@ class AdaGradSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeFusedUpdate_cpu(int param_id, Dtype rate);
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with AdaGrad.";
@@ -146,6 +226,7 @@ class RMSPropSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual inline bool HasFusedUpdate() const { return false; }
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with RMSProp.";
@@ -169,6 +250,7 @@ class AdaDeltaSolver : public SGDSolver<Dtype> {
  protected:
   void AdaDeltaPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual inline bool HasFusedUpdate() const { return false; }
 
   DISABLE_COPY_AND_ASSIGN(AdaDeltaSolver);
 };
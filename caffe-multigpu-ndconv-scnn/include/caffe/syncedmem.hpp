@@ -4,6 +4,7 @@
 #include <cstdlib>
 
 #include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
@@ -21,14 +22,16 @@ namespace caffe {
 // are constantly accessing them the memory pages almost always stays in
 // the physical memory (assuming we have large enough memory installed), and
 // does not seem to create a memory bottleneck here.
+//
+// The memory comes from the caching HostAllocator, so that blobs reshaped
+// over and over (e.g. by data layers) reuse the freed blocks.
 
 inline void CaffeMallocHost(void** ptr, size_t size) {
-  *ptr = malloc(size);
-  CHECK(*ptr) << "host allocation of size " << size << " failed";
+  *ptr = HostAllocator::Get().Allocate(size);
 }
 
-inline void CaffeFreeHost(void* ptr) {
-  free(ptr);
+inline void CaffeFreeHost(void* ptr, size_t size) {
+  HostAllocator::Get().Free(ptr, size);
 }
 
 
@@ -51,13 +54,16 @@ class SyncedMemory {
   void set_cpu_data(void* data);
   const void* gpu_data();
   void* mutable_cpu_data();
+  /// Like mutable_cpu_data, but does not zero newly allocated memory, for
+  /// callers about to overwrite all of it.
+  void* mutable_cpu_data_for_overwrite();
   void* mutable_gpu_data();
   enum SyncedHead { UNINITIALIZED, HEAD_AT_CPU, HEAD_AT_GPU, SYNCED };
   SyncedHead head() { return head_; }
   size_t size() { return size_; }
 
  private:
-  void to_cpu();
+  void to_cpu(bool zero_fill = true);
   void to_gpu();
   void* cpu_ptr_;
   void* gpu_ptr_;
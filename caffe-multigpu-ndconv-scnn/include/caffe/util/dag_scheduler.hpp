@@ -0,0 +1,56 @@
+#ifndef CAFFE_UTIL_DAG_SCHEDULER_HPP_
+#define CAFFE_UTIL_DAG_SCHEDULER_HPP_
+
+#include <boost/function.hpp>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Runs the tasks of a dependency graph concurrently on a pool of
+ *        threads, each task once all of its dependencies have completed.
+ *
+ * Each thread keeps its own queue of ready tasks: it runs the tasks it made
+ * ready last-in first-out, and steals the oldest tasks of the other threads
+ * when its queue is empty. The thread calling Run() takes part in the work,
+ * and is the only one to run the tasks marked on_caller.
+ */
+class DagScheduler {
+ public:
+  struct Graph {
+    /// For each task, the tasks that depend on it.
+    vector<vector<int> > successors;
+    /// For each task, the number of tasks it depends on.
+    vector<int> num_dependencies;
+    /// For each task, whether it must run on the thread calling Run().
+    vector<bool> on_caller;
+
+    void Reset(int num_tasks);
+    void AddDependency(int task, int dependency);
+  };
+
+  /// @param num_threads the number of threads, including the calling one.
+  explicit DagScheduler(int num_threads);
+  ~DagScheduler();
+
+  /// Calls task(i) for every task i of graph, returning once all have run.
+  void Run(const Graph& graph, const boost::function<void(int)>& task);
+  int num_threads() const { return num_threads_; }
+
+ private:
+  class State;
+
+  void WorkerLoop(int thread_id);
+
+  const int num_threads_;
+  shared_ptr<State> state_;
+
+  DISABLE_COPY_AND_ASSIGN(DagScheduler);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DAG_SCHEDULER_HPP_
@@ -29,6 +29,10 @@ void classname<Dtype>::funcname##_##gpu(const vector<Blob<Dtype>*>& top, \
     const vector<bool>& propagate_down, \
     const vector<Blob<Dtype>*>& bottom) { NO_GPU; } \
 
+#define STUB_GPU_ACTIVATE(classname) \
+template <typename Dtype> \
+void classname<Dtype>::Activate_gpu(const int count, Dtype* data) { NO_GPU; } \
+
 #else  // Normal GPU + CPU Caffe.
 
 #include <cublas_v2.h>
@@ -0,0 +1,66 @@
+#ifndef CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+#define CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A thread-safe caching allocator for the host memory of
+ *        SyncedMemory, shared by the whole process.
+ *
+ * Sizes are rounded up to size classes, four per power of two, and freed
+ * blocks are kept per size class to serve later allocations, up to
+ * max_cached_bytes in total. Blocks are aligned to 64 bytes; with huge pages,
+ * blocks of 2MB and more are aligned to 2MB and advised to use transparent
+ * huge pages.
+ */
+class HostAllocator {
+ public:
+  struct Stats {
+    /// The number of calls to Allocate, and those served from the cache.
+    size_t num_allocations;
+    size_t num_cache_hits;
+    /// The bytes of the blocks allocated and not freed, and their maximum.
+    size_t bytes_in_use;
+    size_t peak_bytes_in_use;
+    /// The bytes of the freed blocks kept for later allocations.
+    size_t bytes_cached;
+  };
+
+  static HostAllocator& Get();
+
+  /// Returns a block of at least size bytes, not initialized.
+  void* Allocate(size_t size);
+  /// Frees a block returned by Allocate(size).
+  void Free(void* ptr, size_t size);
+  /// Returns the cached blocks to the system.
+  void ReleaseCached();
+
+  Stats stats() const;
+  void set_max_cached_bytes(size_t max_cached_bytes);
+  void set_use_huge_pages(bool use_huge_pages);
+
+  /// The size class of an allocation of size bytes.
+  static size_t SizeClass(size_t size);
+
+ private:
+  HostAllocator();
+
+  mutable boost::mutex mutex_;
+  std::map<size_t, vector<void*> > cache_;
+  Stats stats_;
+  size_t max_cached_bytes_;
+  bool use_huge_pages_;
+
+  DISABLE_COPY_AND_ASSIGN(HostAllocator);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HOST_ALLOCATOR_HPP_
@@ -85,6 +85,30 @@ void caffe_rng_bernoulli(const int n, const Dtype p, int* r);
 template <typename Dtype>
 void caffe_rng_bernoulli(const int n, const Dtype p, unsigned int* r);
 
+// One block of Philox4x32-10: the four words of out are a function of the
+// counter and the key only.
+void caffe_rng_philox_block(const unsigned int counter[4],
+    const unsigned int key[2], unsigned int out[4]);
+
+// The caffe_rng_philox_* functions draw from Philox4x32-10, a counter-based
+// generator keyed from caffe_rng(): they are reproducible under
+// Caffe::set_random_seed, and generate in parallel over the OpenMP threads
+// with the same results for any number of threads. Each float takes 24 random
+// bits and each double 53.
+template <typename Dtype>
+void caffe_rng_philox_uniform(const int n, const Dtype a, const Dtype b,
+                              Dtype* r);
+
+template <typename Dtype>
+void caffe_rng_philox_gaussian(const int n, const Dtype mu, const Dtype sigma,
+                               Dtype* r);
+
+// Sets bit i % 32 of r[i / 32] with probability p, for i in [0, n); the
+// (n + 31) / 32 words of r are overwritten, and the bits past n cleared.
+template <typename Dtype>
+void caffe_rng_philox_bernoulli_bits(const int n, const Dtype p,
+                                     unsigned int* r);
+
 template <typename Dtype>
 void caffe_exp(const int n, const Dtype* a, Dtype* y);
 
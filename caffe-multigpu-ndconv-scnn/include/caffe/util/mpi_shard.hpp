@@ -0,0 +1,35 @@
+#ifdef USE_MPI
+#ifndef MPI_SHARD_HPP_
+#define MPI_SHARD_HPP_
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Keep only the block of rows (along axis 0) owned by this MPI
+ *        process, i.e. rows [rank * rows / size, (rank + 1) * rows / size).
+ *
+ * Used to turn a full, unsharded parameter (as stored in a .caffemodel or a
+ * .solverstate) into the shard held by a model-parallel layer.
+ */
+template <typename Dtype>
+void ShardBlobRows(Blob<Dtype>* blob);
+
+/**
+ * @brief Gather the row blocks of a sharded blob from all the MPI processes
+ *        and serialize the full blob into proto on the root process.
+ *
+ * This is a collective call: every process must call it in the same order.
+ * The proto is left untouched on the other processes.
+ */
+template <typename Dtype>
+void GatherBlobRowsToProto(const Blob<Dtype>& blob, BlobProto* proto,
+                           bool write_diff = false);
+
+}  // namespace caffe
+
+#endif // MPI_SHARD_HPP_
+#endif // USE_MPI
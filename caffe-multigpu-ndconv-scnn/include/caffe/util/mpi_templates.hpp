@@ -67,5 +67,74 @@ inline int MPIScatter<double>(int count, const void* sendbuf, void* recvbuf,
       root, comm);
 }
 
+template <typename Dtype>
+inline int MPIAllgather(int count, const void* sendbuf, void* recvbuf,
+                        MPI_Comm comm = MPI_COMM_WORLD);
+template <>
+inline int MPIAllgather<float>(int count, const void* sendbuf, void* recvbuf,
+                               MPI_Comm comm) {
+  return MPI_Allgather(sendbuf, count, MPI_FLOAT, recvbuf, count, MPI_FLOAT,
+      comm);
+}
+template <>
+inline int MPIAllgather<double>(int count, const void* sendbuf, void* recvbuf,
+                                MPI_Comm comm) {
+  return MPI_Allgather(sendbuf, count, MPI_DOUBLE, recvbuf, count, MPI_DOUBLE,
+      comm);
+}
+
+template <typename Dtype>
+inline int MPIReduceScatterBlock(int recvcount, const void* sendbuf,
+                                 void* recvbuf, MPI_Op op,
+                                 MPI_Comm comm = MPI_COMM_WORLD);
+template <>
+inline int MPIReduceScatterBlock<float>(int recvcount, const void* sendbuf,
+                                        void* recvbuf, MPI_Op op,
+                                        MPI_Comm comm) {
+  return MPI_Reduce_scatter_block(sendbuf, recvbuf, recvcount, MPI_FLOAT, op,
+      comm);
+}
+template <>
+inline int MPIReduceScatterBlock<double>(int recvcount, const void* sendbuf,
+                                         void* recvbuf, MPI_Op op,
+                                         MPI_Comm comm) {
+  return MPI_Reduce_scatter_block(sendbuf, recvbuf, recvcount, MPI_DOUBLE, op,
+      comm);
+}
+
+template <typename Dtype>
+inline int MPIIgather(int count, const void* sendbuf, void* recvbuf,
+                      MPI_Request* request, int root = 0,
+                      MPI_Comm comm = MPI_COMM_WORLD);
+template <>
+inline int MPIIgather<float>(int count, const void* sendbuf, void* recvbuf,
+                             MPI_Request* request, int root, MPI_Comm comm) {
+  return MPI_Igather(sendbuf, count, MPI_FLOAT, recvbuf, count, MPI_FLOAT,
+      root, comm, request);
+}
+template <>
+inline int MPIIgather<double>(int count, const void* sendbuf, void* recvbuf,
+                              MPI_Request* request, int root, MPI_Comm comm) {
+  return MPI_Igather(sendbuf, count, MPI_DOUBLE, recvbuf, count, MPI_DOUBLE,
+      root, comm, request);
+}
+
+template <typename Dtype>
+inline int MPIIscatter(int count, const void* sendbuf, void* recvbuf,
+                       MPI_Request* request, int root = 0,
+                       MPI_Comm comm = MPI_COMM_WORLD);
+template <>
+inline int MPIIscatter<float>(int count, const void* sendbuf, void* recvbuf,
+                              MPI_Request* request, int root, MPI_Comm comm) {
+  return MPI_Iscatter(sendbuf, count, MPI_FLOAT, recvbuf, count, MPI_FLOAT,
+      root, comm, request);
+}
+template <>
+inline int MPIIscatter<double>(int count, const void* sendbuf, void* recvbuf,
+                               MPI_Request* request, int root, MPI_Comm comm) {
+  return MPI_Iscatter(sendbuf, count, MPI_DOUBLE, recvbuf, count, MPI_DOUBLE,
+      root, comm, request);
+}
+
 #endif // MPI_TEMPLATES_HPP_
 #endif // USE_MPI
\ No newline at end of file
@@ -0,0 +1,86 @@
+#ifndef CAFFE_UTIL_WEIGHT_FILE_HPP_
+#define CAFFE_UTIL_WEIGHT_FILE_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/// The file extension of the raw weight container.
+const char kWeightFileExtension[] = ".caffeweights";
+
+/// Whether filename names a raw weight container, by its extension.
+bool IsWeightFilename(const string& filename);
+
+/**
+ * @brief A raw, memory-mapped container of the learned params of a net, to
+ *        be loaded without parsing a .caffemodel.
+ *
+ * The file starts with a header and an index with one entry per param
+ * (layer name, index of the blob in the layer, data type, shape and offset),
+ * followed by the raw arrays of the params, each aligned to 64 bytes. Only
+ * the data of the params is stored.
+ *
+ * The file is mapped privately: the arrays can be used in place as the data
+ * of a Blob, and writing to them copies the touched pages instead of
+ * modifying the file. The mapping lives as long as the WeightFile.
+ */
+class WeightFile {
+ public:
+  struct Entry {
+    string layer_name;
+    int blob_id;
+    bool is_double;
+    vector<int> shape;
+    uint64_t offset;
+    uint64_t count;
+  };
+
+  /// Maps the container stored in filename, checking its header and index.
+  explicit WeightFile(const string& filename);
+  ~WeightFile();
+
+  const vector<Entry>& entries() const { return entries_; }
+  /// Whether an entry is stored with the data type Dtype.
+  template <typename Dtype>
+  static bool IsStoredAs(const Entry& entry);
+  /// The mapped array of an entry, which must be stored as Dtype.
+  template <typename Dtype>
+  Dtype* data(const Entry& entry) const;
+  /// Reshapes blob to the shape of an entry and copies its data in.
+  template <typename Dtype>
+  void CopyTo(const Entry& entry, Blob<Dtype>* blob) const;
+  /// Writes the params as the layers of a NetParameter, as in a .caffemodel.
+  void ToProto(NetParameter* param) const;
+
+  /// Writes the params of a NetParameter (e.g. a .caffemodel) to filename.
+  static void Write(const NetParameter& param, const string& filename);
+
+ protected:
+  string filename_;
+  char* map_;
+  size_t map_size_;
+  vector<Entry> entries_;
+
+  DISABLE_COPY_AND_ASSIGN(WeightFile);
+};
+
+template <>
+inline bool WeightFile::IsStoredAs<float>(const Entry& entry) {
+  return !entry.is_double;
+}
+
+template <>
+inline bool WeightFile::IsStoredAs<double>(const Entry& entry) {
+  return entry.is_double;
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WEIGHT_FILE_HPP_
@@ -217,6 +217,7 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
       : BaseConvolutionLayer<Dtype>(param) {}
 
   virtual inline const char* type() const { return "Convolution"; }
+  virtual inline bool CanFuseActivation() const { return true; }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -360,13 +361,13 @@ class Im2colLayer : public Layer<Dtype> {
   bool force_nd_im2col_;
 };
 
-// Forward declare PoolingLayer and SplitLayer for use in LRNLayer.
-template <typename Dtype> class PoolingLayer;
-template <typename Dtype> class SplitLayer;
-
 /**
  * @brief Normalize the input in a local region across or within feature maps.
  *
+ * Both regions are computed directly: across channels, the sum of squares
+ * slides along the channels of each image; within a channel, it is a box
+ * filter made of a sliding sum along the rows and one along the columns.
+ *
  * TODO(dox): thorough documentation for Forward, Backward, and proto params.
  */
 template <typename Dtype>
@@ -397,13 +398,17 @@ class LRNLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
   virtual void CrossChannelForward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
-  virtual void WithinChannelForward(const vector<Blob<Dtype>*>& bottom,
+  virtual void WithinChannelForward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void WithinChannelForward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void CrossChannelBackward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void CrossChannelBackward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
-  virtual void WithinChannelBackward(const vector<Blob<Dtype>*>& top,
+  virtual void WithinChannelBackward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  virtual void WithinChannelBackward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
   int size_;
@@ -416,27 +421,9 @@ class LRNLayer : public Layer<Dtype> {
   int height_;
   int width_;
 
-  // Fields used for normalization ACROSS_CHANNELS
-  // scale_ stores the intermediate summing results
+  // scale_ stores the intermediate summing results, raised to -beta to get
+  // the outputs
   Blob<Dtype> scale_;
-
-  // Fields used for normalization WITHIN_CHANNEL
-  shared_ptr<SplitLayer<Dtype> > split_layer_;
-  vector<Blob<Dtype>*> split_top_vec_;
-  shared_ptr<PowerLayer<Dtype> > square_layer_;
-  Blob<Dtype> square_input_;
-  Blob<Dtype> square_output_;
-  vector<Blob<Dtype>*> square_bottom_vec_;
-  vector<Blob<Dtype>*> square_top_vec_;
-  shared_ptr<PoolingLayer<Dtype> > pool_layer_;
-  Blob<Dtype> pool_output_;
-  vector<Blob<Dtype>*> pool_top_vec_;
-  shared_ptr<PowerLayer<Dtype> > power_layer_;
-  Blob<Dtype> power_output_;
-  vector<Blob<Dtype>*> power_top_vec_;
-  shared_ptr<EltwiseLayer<Dtype> > product_layer_;
-  Blob<Dtype> product_input_;
-  vector<Blob<Dtype>*> product_bottom_vec_;
 };
 
 
@@ -524,6 +511,16 @@ class CuDNNPoolingLayer : public PoolingLayer<Dtype> {
  *        by taking the max, average, etc. within regions
  *        so that the result vector of different sized
  *        images are of the same size.
+ *
+ * Level l splits each spatial axis (all the axes after the channels, so
+ * clips are pooled over time as well) into @f$ 2^l @f$ bins. The top is
+ * @f$ N \times C \sum_l 2^{l D} @f$ for D spatial axes, the levels in
+ * order, each laid out by channel then bin. All the levels are computed in a
+ * single pass over each channel, straight into the top.
+ *
+ * STOCHASTIC pooling, which only PoolingLayer implements (on GPU), instead
+ * splits a 4-D bottom into a PoolingLayer and a FlattenLayer per level and
+ * concatenates their outputs into the same top.
  */
 template <typename Dtype>
 class SPPLayer : public Layer<Dtype> {
@@ -537,52 +534,67 @@ class SPPLayer : public Layer<Dtype> {
 
   virtual inline const char* type() const { return "SPP"; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
-  virtual inline int MinTopBlobs() const { return 1; }
-  // MAX POOL layers can output an extra top blob for the mask;
-  // others can only output the pooled inputs.
-  virtual inline int MaxTopBlobs() const {
-    return (this->layer_param_.pooling_param().pool() ==
-            PoolingParameter_PoolMethod_MAX) ? 2 : 1;
-  }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
-  // calculates the kernel and stride dimensions for the pooling layer,
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  // calculates the kernel and padding of the pooling layer of a level,
   // returns a correctly configured LayerParameter for a PoolingLayer
   virtual LayerParameter GetPoolingParam(const int pyramid_level,
-      const int bottom_h, const int bottom_w, const SPPParameter spp_param);
+      const int bottom_h, const int bottom_w);
+  void ForwardSubLayers(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void BackwardSubLayers(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
   int pyramid_height_;
-  int bottom_h_, bottom_w_;
+  bool max_pool_;
   int channels_;
-  int kernel_h_, kernel_w_;
-  int pad_h_, pad_w_;
+  int num_spatial_axes_;
+  /// the number of elements in a channel, and along its last axis
+  int spatial_dim_;
+  int inner_dim_;
+  /// the first bin of each level in a channel, pyramid_height_ + 1 of them
+  Blob<int> level_offsets_;
+  /// the kernel size and padding of each level along each spatial axis,
+  /// pyramid_height_ x num_spatial_axes_ x 2
+  Blob<int> windows_;
+  /// the bin of each level (within the level) holding each position of a
+  /// channel, as the sum of a bin of its last axis and of the other axes
+  Blob<int> inner_bins_;
+  Blob<int> outer_bins_;
+  /// one over the size of the pooling window of each bin, for AVE
+  Blob<Dtype> bin_scales_;
+  /// the position of the max in its channel of each top element, for MAX
+  Blob<int> max_idx_;
 
-  /// the internal Split layer that feeds the pooling layers
+  /// the internal Split layer that feeds the pooling layers, for STOCHASTIC
   shared_ptr<SplitLayer<Dtype> > split_layer_;
   /// top vector holder used in call to the underlying SplitLayer::Forward
   vector<Blob<Dtype>*> split_top_vec_;
-  /// bottom vector holder used in call to the underlying PoolingLayer::Forward
-  vector<vector<Blob<Dtype>*>*> pooling_bottom_vecs_;
+  /// bottom vector holders used in call to the underlying PoolingLayer::Forward
+  vector<vector<Blob<Dtype>*> > pooling_bottom_vecs_;
   /// the internal Pooling layers of different kernel sizes
   vector<shared_ptr<PoolingLayer<Dtype> > > pooling_layers_;
   /// top vector holders used in call to the underlying PoolingLayer::Forward
-  vector<vector<Blob<Dtype>*>*> pooling_top_vecs_;
-  /// pooling_outputs stores the outputs of the PoolingLayers
-  vector<Blob<Dtype>*> pooling_outputs_;
+  vector<vector<Blob<Dtype>*> > pooling_top_vecs_;
   /// the internal Flatten layers that the Pooling layers feed into
-  vector<FlattenLayer<Dtype>*> flatten_layers_;
+  vector<shared_ptr<FlattenLayer<Dtype> > > flatten_layers_;
   /// top vector holders used in call to the underlying FlattenLayer::Forward
-  vector<vector<Blob<Dtype>*>*> flatten_top_vecs_;
-  /// flatten_outputs stores the outputs of the FlattenLayers
-  vector<Blob<Dtype>*> flatten_outputs_;
+  vector<vector<Blob<Dtype>*> > flatten_top_vecs_;
   /// bottom vector holder used in call to the underlying ConcatLayer::Forward
   vector<Blob<Dtype>*> concat_bottom_vec_;
-  /// the internal Concat layers that the Flatten layers feed into
+  /// the internal Concat layer that the Flatten layers feed into
   shared_ptr<ConcatLayer<Dtype> > concat_layer_;
+  /// the blobs between the internal layers
+  vector<shared_ptr<Blob<Dtype> > > internal_blobs_;
 };
 
 }  // namespace caffe
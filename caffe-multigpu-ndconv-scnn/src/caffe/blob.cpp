@@ -114,6 +114,12 @@ Dtype* Blob<Dtype>::mutable_cpu_data() {
   return static_cast<Dtype*>(data_->mutable_cpu_data());
 }
 
+template <typename Dtype>
+Dtype* Blob<Dtype>::mutable_cpu_data_for_overwrite() {
+  CHECK(data_);
+  return static_cast<Dtype*>(data_->mutable_cpu_data_for_overwrite());
+}
+
 template <typename Dtype>
 Dtype* Blob<Dtype>::mutable_gpu_data() {
   CHECK(data_);
@@ -501,15 +507,15 @@ void Blob<double>::ToProto(BlobProto* proto, bool write_diff) const {
   }
   proto->clear_double_data();
   proto->clear_double_diff();
-  const double* data_vec = cpu_data();
-  for (int i = 0; i < count_; ++i) {
-    proto->add_double_data(data_vec[i]);
-  }
+  // Resize then copy in bulk; a cleared proto keeps its capacity, so a proto
+  // reused across snapshots is not reallocated.
+  proto->mutable_double_data()->Resize(count_, 0);
+  caffe_copy(count_, cpu_data(),
+      proto->mutable_double_data()->mutable_data());
   if (write_diff) {
-    const double* diff_vec = cpu_diff();
-    for (int i = 0; i < count_; ++i) {
-      proto->add_double_diff(diff_vec[i]);
-    }
+    proto->mutable_double_diff()->Resize(count_, 0);
+    caffe_copy(count_, cpu_diff(),
+        proto->mutable_double_diff()->mutable_data());
   }
 }
 
@@ -521,15 +527,11 @@ void Blob<float>::ToProto(BlobProto* proto, bool write_diff) const {
   }
   proto->clear_data();
   proto->clear_diff();
-  const float* data_vec = cpu_data();
-  for (int i = 0; i < count_; ++i) {
-    proto->add_data(data_vec[i]);
-  }
+  proto->mutable_data()->Resize(count_, 0);
+  caffe_copy(count_, cpu_data(), proto->mutable_data()->mutable_data());
   if (write_diff) {
-    const float* diff_vec = cpu_diff();
-    for (int i = 0; i < count_; ++i) {
-      proto->add_diff(diff_vec[i]);
-    }
+    proto->mutable_diff()->Resize(count_, 0);
+    caffe_copy(count_, cpu_diff(), proto->mutable_diff()->mutable_data());
   }
 }
 
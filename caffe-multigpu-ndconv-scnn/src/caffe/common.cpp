@@ -1,3 +1,4 @@
+#include <boost/thread/tss.hpp>
 #include <glog/logging.h>
 #include <cstdio>
 #include <ctime>
@@ -45,6 +46,29 @@ void GlobalInit(int* pargc, char*** pargv) {
 #endif
 }
 
+// The boost rng each thread draws from instead of the shared one, if any.
+// The rngs are not owned, so nothing is done with them at thread exit.
+static void KeepThreadRNG(Caffe::RNG* rng) {}
+static boost::thread_specific_ptr<Caffe::RNG> thread_rng_stream(
+    &KeepThreadRNG);
+
+Caffe::RNG& Caffe::rng_stream() {
+  RNG* thread_rng = thread_rng_stream.get();
+  if (thread_rng) {
+    return *thread_rng;
+  }
+  if (!Get().random_generator_) {
+    Get().random_generator_.reset(new RNG());
+  }
+  return *(Get().random_generator_);
+}
+
+Caffe::RNG* Caffe::set_thread_rng_stream(RNG* rng) {
+  RNG* previous = thread_rng_stream.get();
+  thread_rng_stream.reset(rng);
+  return previous;
+}
+
 #ifdef CPU_ONLY  // CPU-only Caffe.
 
 Caffe::Caffe()
@@ -65,14 +65,14 @@ void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
   top[0]->ReshapeLike(prefetch_data_);
   // Copy the data
   caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
-             top[0]->mutable_cpu_data());
+             top[0]->mutable_cpu_data_for_overwrite());
   DLOG(INFO) << "Prefetch copied";
   if (this->output_labels_) {
     // Reshape to loaded labels.
     top[1]->ReshapeLike(prefetch_label_);
     // Copy the labels.
     caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
-               top[1]->mutable_cpu_data());
+               top[1]->mutable_cpu_data_for_overwrite());
   }
   // Start a new prefetch thread
   DLOG(INFO) << "CreatePrefetchThread";
@@ -1,9 +1,11 @@
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/common_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/mpi_templates.hpp"
 
 namespace caffe {
 
@@ -13,6 +15,11 @@ void BNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   moving_average_ = this->layer_param_.bn_param().moving_average();
   bn_momentum_ = this->layer_param_.bn_param().momentum();
   bn_eps_ = this->layer_param_.bn_param().eps();
+  sync_stats_ = false;
+#ifdef USE_MPI
+  sync_stats_ = this->layer_param_.bn_param().sync_stats() &&
+      Caffe::mpi_size() > 1;
+#endif
   // Initialize parameters
   if (this->blobs_.size() > 0) {
     LOG(INFO) << "Skipping parameter initialization";
@@ -24,7 +31,7 @@ void BNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     }
     vector<int> shape;
     shape.push_back(1);
-    shape.push_back(bottom[0]->channels());
+    shape.push_back(bottom[0]->shape(1));
     // slope
     this->blobs_[0].reset(new Blob<Dtype>(shape));
     shared_ptr<Filler<Dtype> > slope_filler(GetFiller<Dtype>(
@@ -52,234 +59,267 @@ void BNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void BNLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  num_ = bottom[0]->num();
-  channels_ = bottom[0]->channels();
-  height_ = bottom[0]->height();
-  width_ = bottom[0]->width();
+  CHECK_GE(bottom[0]->num_axes(), 2)
+      << "BN needs at least the num and channels axes.";
+  num_ = bottom[0]->shape(0);
+  channels_ = bottom[0]->shape(1);
+  spatial_dim_ = bottom[0]->count(2);
+  CHECK_EQ(this->blobs_[0]->count(), channels_)
+      << "The number of channels does not match the BN parameters.";
 
   top[0]->ReshapeLike(*(bottom[0]));
 
+  // The full-size blobs below are only allocated when used: the CPU
+  // computation needs x_norm_ when computing in place, and nothing else.
   broadcast_buffer_.ReshapeLike(*(bottom[0]));
   spatial_statistic_.Reshape(num_, channels_, 1, 1);
   batch_statistic_.Reshape(1, channels_, 1, 1);
+  diff_statistic_.Reshape(1, channels_, 1, 1);
 
   x_norm_.ReshapeLike(*(bottom[0]));
   x_std_.ReshapeLike(batch_statistic_);
 
-  spatial_sum_multiplier_.Reshape(1, 1, height_, width_);
+  spatial_sum_multiplier_.Reshape(vector<int>(1, spatial_dim_));
+  batch_sum_multiplier_.Reshape(vector<int>(1, num_));
+  if (sync_stats_) {
+    sync_buffer_.resize(2 * channels_ + 1);
+    sync_pivot_.resize(channels_, 0.);
+  }
   caffe_set(spatial_sum_multiplier_.count(), Dtype(1),
       spatial_sum_multiplier_.mutable_cpu_data());
-  batch_sum_multiplier_.Reshape(num_, 1, 1, 1);
   caffe_set(batch_sum_multiplier_.count(), Dtype(1),
       batch_sum_multiplier_.mutable_cpu_data());
 }
 
+// The CPU passes below are spread over the OpenMP threads (when built with
+// USE_OPENMP) for inputs larger than kBNGrain elements.
+static const int kBNGrain = 1 << 15;
+
+template <typename Dtype>
+void BNLayer<Dtype>::ComputeChannelStatistics(const Dtype* input,
+    Dtype* mean, Dtype* variance) {
+  const int count = num_ * channels_ * spatial_dim_;
+  const int size = num_ * spatial_dim_;
+#ifdef _OPENMP
+  #pragma omp parallel for if (count > kBNGrain) schedule(static)
+#endif
+  for (int c = 0; c < channels_; ++c) {
+    // Both moments are taken about the first value of the channel, which
+    // avoids the cancellation of the sum of squares when the mean is large
+    // compared to the deviation.
+    const Dtype pivot = input[c * spatial_dim_];
+    double sum = 0;
+    double sum_squares = 0;
+    for (int n = 0; n < num_; ++n) {
+      const Dtype* x = input + (n * channels_ + c) * spatial_dim_;
+      Dtype row_sum = 0;
+      Dtype row_sum_squares = 0;
+      for (int i = 0; i < spatial_dim_; ++i) {
+        const Dtype deviation = x[i] - pivot;
+        row_sum += deviation;
+        row_sum_squares += deviation * deviation;
+      }
+      sum += row_sum;
+      sum_squares += row_sum_squares;
+    }
+    const double shift = sum / size;
+    mean[c] = pivot + shift;
+    variance[c] = std::max(sum_squares / size - shift * shift, 0.);
+  }
+}
+
+#ifdef USE_MPI
+template <typename Dtype>
+void BNLayer<Dtype>::SyncChannelStatistics(Dtype* mean, Dtype* variance) {
+  // Every process sends the count, the sum and the sum of squares of its
+  // values about the same pivot, in one message. The pivot is the global
+  // mean of the previous batch, which is the same on all the processes and
+  // close to the current mean, so the sums of squares are not dominated by
+  // the offset of the data.
+  const double size = num_ * spatial_dim_;
+  double* sums = &sync_buffer_[0];
+  double* squares = sums + channels_;
+  for (int c = 0; c < channels_; ++c) {
+    const double shift = mean[c] - sync_pivot_[c];
+    sums[c] = size * shift;
+    squares[c] = size * (variance[c] + shift * shift);
+  }
+  sums[2 * channels_] = size;
+  MPIAllreduce<double>(sync_buffer_.size(), MPI_IN_PLACE, sums, MPI_SUM);
+  const double total_size = sums[2 * channels_];
+  for (int c = 0; c < channels_; ++c) {
+    const double shift = sums[c] / total_size;
+    sync_pivot_[c] += shift;
+    mean[c] = sync_pivot_[c];
+    variance[c] = std::max(squares[c] / total_size - shift * shift, 0.);
+  }
+}
+
+template <typename Dtype>
+Dtype BNLayer<Dtype>::SyncDiffSums(Dtype* sum_diff, Dtype* sum_diff_x_norm) {
+  double* sums = &sync_buffer_[0];
+  for (int c = 0; c < channels_; ++c) {
+    sums[c] = sum_diff[c];
+    sums[channels_ + c] = sum_diff_x_norm[c];
+  }
+  sums[2 * channels_] = num_ * spatial_dim_;
+  MPIAllreduce<double>(sync_buffer_.size(), MPI_IN_PLACE, sums, MPI_SUM);
+  for (int c = 0; c < channels_; ++c) {
+    sum_diff[c] = sums[c];
+    sum_diff_x_norm[c] = sums[channels_ + c];
+  }
+  return sums[2 * channels_];
+}
+#endif
+
 template <typename Dtype>
 void BNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const vector<Blob<Dtype>*>& top) {
-  const Dtype* const_bottom_data = bottom[0]->cpu_data();
-  const Dtype* const_top_data = top[0]->cpu_data();
-  Dtype* top_data = top[0]->mutable_cpu_data();
-
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data_for_overwrite();
   const Dtype* scale_data = this->blobs_[0]->cpu_data();
   const Dtype* shift_data = this->blobs_[1]->cpu_data();
+  Dtype* mean_data = batch_statistic_.mutable_cpu_data();
+  Dtype* std_data = x_std_.mutable_cpu_data();
 
-  // Mean normalization
   if (this->phase_ == TEST && moving_average_) {
-    // Use the moving average mean
-    caffe_copy(batch_statistic_.count(), this->blobs_[2]->cpu_data(),
-        batch_statistic_.mutable_cpu_data());
-  } else if (this->phase_ == TRAIN) {
-    // Compute the mean by averaging over spatial and batch dimensions.
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1) / (height_ * width_), const_bottom_data,
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_,
-        Dtype(1) / num_, spatial_statistic_.cpu_data(),
-        batch_sum_multiplier_.cpu_data(), Dtype(0),
-        batch_statistic_.mutable_cpu_data());
-    // Add to the moving average
-    if (moving_average_) {
-      caffe_cpu_axpby(batch_statistic_.count(),
-          Dtype(1) - bn_momentum_, batch_statistic_.cpu_data(),
-          bn_momentum_, this->blobs_[2]->mutable_cpu_data());
+    // Use the moving averages
+    caffe_copy(channels_, this->blobs_[2]->cpu_data(), mean_data);
+    caffe_copy(channels_, this->blobs_[3]->cpu_data(), std_data);
+  } else {
+    ComputeChannelStatistics(bottom_data, mean_data, std_data);
+#ifdef USE_MPI
+    if (sync_stats_) {
+      SyncChannelStatistics(mean_data, std_data);
     }
-  }
-  // Broadcast the mean vector
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(-1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  // Subtract
-  caffe_add(broadcast_buffer_.count(), const_bottom_data,
-      broadcast_buffer_.cpu_data(), top_data);
-
-  // Variance normalization
-  if (this->phase_ == TEST && moving_average_) {
-    // Use the moving average mean
-    caffe_copy(batch_statistic_.count(), this->blobs_[3]->cpu_data(),
-        batch_statistic_.mutable_cpu_data());
-  } else if (this->phase_ == TRAIN) {
-    caffe_powx(broadcast_buffer_.count(), const_top_data, Dtype(2),
-        broadcast_buffer_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1) / (height_ * width_), broadcast_buffer_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1) / num_,
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(0), batch_statistic_.mutable_cpu_data());
-    // Add to the moving average
-    if (moving_average_) {
-      caffe_cpu_axpby(batch_statistic_.count(),
-          Dtype(1) - bn_momentum_, batch_statistic_.cpu_data(),
+#endif
+    // Add to the moving averages
+    if (moving_average_ && this->phase_ == TRAIN) {
+      caffe_cpu_axpby(channels_, Dtype(1) - bn_momentum_, mean_data,
+          bn_momentum_, this->blobs_[2]->mutable_cpu_data());
+      caffe_cpu_axpby(channels_, Dtype(1) - bn_momentum_, std_data,
           bn_momentum_, this->blobs_[3]->mutable_cpu_data());
     }
   }
-  // Add eps
-  caffe_add_scalar(batch_statistic_.count(), bn_eps_,
-      batch_statistic_.mutable_cpu_data());
   // Standard deviation
-  caffe_powx(batch_statistic_.count(), batch_statistic_.cpu_data(),
-      Dtype(0.5), batch_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  // Divide by the std
-  caffe_div(broadcast_buffer_.count(), const_top_data,
-      broadcast_buffer_.cpu_data(), top_data);
-
-  // Save the normalized inputs and std for backprop
-  caffe_copy(broadcast_buffer_.count(), const_top_data,
-      x_norm_.mutable_cpu_data());
-  caffe_copy(batch_statistic_.count(), batch_statistic_.cpu_data(),
-      x_std_.mutable_cpu_data());
-
-  // Scale
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), scale_data,
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  caffe_mul(broadcast_buffer_.count(), const_top_data,
-      broadcast_buffer_.cpu_data(), top_data);
+  for (int c = 0; c < channels_; ++c) {
+    std_data[c] = sqrt(std_data[c] + bn_eps_);
+  }
 
-  // Shift
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), shift_data,
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  caffe_add(broadcast_buffer_.count(), const_top_data,
-      broadcast_buffer_.cpu_data(), top_data);
+  // Normalize, scale and shift in one pass. When computing in place, the
+  // normalized inputs are saved for backprop since the inputs are lost.
+  Dtype* x_norm_data =
+      bottom[0] == top[0] ? x_norm_.mutable_cpu_data_for_overwrite() : NULL;
+  const int rows = num_ * channels_;
+#ifdef _OPENMP
+  #pragma omp parallel for if (rows * spatial_dim_ > kBNGrain) \
+      schedule(static)
+#endif
+  for (int row = 0; row < rows; ++row) {
+    const int c = row % channels_;
+    const int offset = row * spatial_dim_;
+    const Dtype inv_std = Dtype(1) / std_data[c];
+    const Dtype scale = scale_data[c];
+    const Dtype shift = shift_data[c];
+    const Dtype mean = mean_data[c];
+    const Dtype* x = bottom_data + offset;
+    Dtype* y = top_data + offset;
+    if (x_norm_data) {
+      Dtype* x_norm = x_norm_data + offset;
+      for (int i = 0; i < spatial_dim_; ++i) {
+        x_norm[i] = (x[i] - mean) * inv_std;
+        y[i] = x_norm[i] * scale + shift;
+      }
+    } else {
+      const Dtype a = scale * inv_std;
+      const Dtype b = shift - mean * a;
+      for (int i = 0; i < spatial_dim_; ++i) {
+        y[i] = x[i] * a + b;
+      }
+    }
+  }
 }
 
 template <typename Dtype>
 void BNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  const Dtype* const_bottom_diff = bottom[0]->cpu_diff();
-  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  const Dtype* const_top_diff = top[0]->cpu_diff();
-
-  Dtype* scale_diff = this->blobs_[0]->mutable_cpu_diff();
-  Dtype* shift_diff = this->blobs_[1]->mutable_cpu_diff();
+  const Dtype* top_diff = top[0]->cpu_diff();
+  const bool in_place = bottom[0] == top[0];
+  // The normalized inputs are recomputed from the bottom unless saved.
+  const Dtype* x_data = in_place ? x_norm_.cpu_data() : bottom[0]->cpu_data();
   const Dtype* scale_data = this->blobs_[0]->cpu_data();
+  const Dtype* mean_data = batch_statistic_.cpu_data();
+  const Dtype* std_data = x_std_.cpu_data();
+  Dtype size = num_ * spatial_dim_;
+  const int count = num_ * channels_ * spatial_dim_;
 
-  // gradient w.r.t. slope
-  caffe_mul(broadcast_buffer_.count(), x_norm_.cpu_data(), const_top_diff,
-      broadcast_buffer_.mutable_cpu_data());
-  caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-      Dtype(1), broadcast_buffer_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), Dtype(0),
-      spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-      spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-      Dtype(1), scale_diff);
-
-  // gradient w.r.t. bias
-  caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-      Dtype(1), const_top_diff, spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-      spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-      Dtype(1), shift_diff);
-
-  // gradient w.r.t. normalized inputs
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), scale_data,
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1), spatial_statistic_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), Dtype(0),
-      broadcast_buffer_.mutable_cpu_data());
-  caffe_mul(broadcast_buffer_.count(), const_top_diff,
-      broadcast_buffer_.cpu_data(), broadcast_buffer_.mutable_cpu_data());
-
-  // sum of x_hat * (dl / dx_hat)
-  caffe_mul(broadcast_buffer_.count(), x_norm_.cpu_data(),
-      broadcast_buffer_.cpu_data(), bottom_diff);
-  caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-      Dtype(1), const_bottom_diff, spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-      spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-      Dtype(0), batch_statistic_.mutable_cpu_data());
-
-  // x_hat times the sum
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), bottom_diff);
-  caffe_mul(broadcast_buffer_.count(), x_norm_.cpu_data(),
-      const_bottom_diff, bottom_diff);
-
-  // Subtract the average of x_hat times the sum
-  caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-      Dtype(1), broadcast_buffer_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), Dtype(0),
-      spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-      spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-      Dtype(0), batch_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(1), bottom_diff);
-  caffe_cpu_axpby(broadcast_buffer_.count(), Dtype(1),
-      broadcast_buffer_.cpu_data(), Dtype(-1) / (num_ * height_ * width_),
-      bottom_diff);
+  // Reduce the sums of the top diff and of the top diff times x_hat, which
+  // are the gradients w.r.t. the shift and the slope.
+  vector<Dtype> sum_diff(channels_);
+  vector<Dtype> sum_diff_x_norm(channels_);
+#ifdef _OPENMP
+  #pragma omp parallel for if (count > kBNGrain) schedule(static)
+#endif
+  for (int c = 0; c < channels_; ++c) {
+    const Dtype mean = in_place ? Dtype(0) : mean_data[c];
+    const Dtype inv_std = in_place ? Dtype(1) : Dtype(1) / std_data[c];
+    Dtype diff_sum = 0;
+    Dtype diff_x_norm_sum = 0;
+    for (int n = 0; n < num_; ++n) {
+      const int offset = (n * channels_ + c) * spatial_dim_;
+      const Dtype* x = x_data + offset;
+      const Dtype* dy = top_diff + offset;
+      for (int i = 0; i < spatial_dim_; ++i) {
+        diff_sum += dy[i];
+        diff_x_norm_sum += dy[i] * (x[i] - mean);
+      }
+    }
+    sum_diff[c] = diff_sum;
+    sum_diff_x_norm[c] = diff_x_norm_sum * inv_std;
+  }
+  if (this->param_propagate_down_[0]) {
+    caffe_axpy(channels_, Dtype(1), &sum_diff_x_norm[0],
+        this->blobs_[0]->mutable_cpu_diff());
+  }
+  if (this->param_propagate_down_[1]) {
+    caffe_axpy(channels_, Dtype(1), &sum_diff[0],
+        this->blobs_[1]->mutable_cpu_diff());
+  }
+  if (!propagate_down[0]) { return; }
+#ifdef USE_MPI
+  // The slope and shift gradients above stay local since the solver sums
+  // them over the processes, but the bottom diff depends on the global sums.
+  if (sync_stats_) {
+    size = SyncDiffSums(&sum_diff[0], &sum_diff_x_norm[0]);
+  }
+#endif
 
-  // Divide by the std
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), x_std_.cpu_data(),
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  caffe_div(broadcast_buffer_.count(), const_bottom_diff,
-      broadcast_buffer_.cpu_data(), bottom_diff);
+  // With dl / dx_hat = slope * dy, the gradient w.r.t. the inputs is
+  //   (dl / dx_hat - mean(dl / dx_hat) - x_hat * mean(dl / dx_hat * x_hat))
+  //   / std
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  const int rows = num_ * channels_;
+#ifdef _OPENMP
+  #pragma omp parallel for if (count > kBNGrain) schedule(static)
+#endif
+  for (int row = 0; row < rows; ++row) {
+    const int c = row % channels_;
+    const int offset = row * spatial_dim_;
+    const Dtype mean = in_place ? Dtype(0) : mean_data[c];
+    const Dtype inv_std = Dtype(1) / std_data[c];
+    const Dtype x_scale = in_place ? Dtype(1) : inv_std;
+    const Dtype a = scale_data[c] * inv_std;
+    const Dtype b = -a * sum_diff[c] / size;
+    const Dtype d = -a * sum_diff_x_norm[c] / size;
+    const Dtype* x = x_data + offset;
+    const Dtype* dy = top_diff + offset;
+    Dtype* dx = bottom_diff + offset;
+    for (int i = 0; i < spatial_dim_; ++i) {
+      dx[i] = a * dy[i] + b + d * (x[i] - mean) * x_scale;
+    }
+  }
 }
 
-
 #ifdef CPU_ONLY
 STUB_GPU(BNLayer);
 #endif
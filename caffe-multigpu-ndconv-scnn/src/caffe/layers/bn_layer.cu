@@ -23,18 +23,45 @@ void BNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     // Use the moving average mean
     caffe_copy(batch_statistic_.count(), this->blobs_[2]->gpu_data(),
         batch_statistic_.mutable_gpu_data());
-  } else if (this->phase_ == TRAIN) {
+  } else {
     // Compute the mean by averaging over spatial and batch dimensions.
-    caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1) / (height_ * width_), const_bottom_data,
+    caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, spatial_dim_,
+        Dtype(1) / spatial_dim_, const_bottom_data,
         spatial_sum_multiplier_.gpu_data(), Dtype(0),
         spatial_statistic_.mutable_gpu_data());
     caffe_gpu_gemv<Dtype>(CblasTrans, num_, channels_,
         Dtype(1) / num_, spatial_statistic_.gpu_data(),
         batch_sum_multiplier_.gpu_data(), Dtype(0),
         batch_statistic_.mutable_gpu_data());
+#ifdef USE_MPI
+    if (sync_stats_) {
+      // Compute the local variance into x_std_, and only move the per-channel
+      // statistics through the host to merge them over the processes.
+      caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
+          Dtype(1), batch_sum_multiplier_.gpu_data(),
+          batch_statistic_.gpu_data(), Dtype(0),
+          spatial_statistic_.mutable_gpu_data());
+      caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
+          spatial_dim_, 1, Dtype(-1),
+          spatial_statistic_.gpu_data(), spatial_sum_multiplier_.gpu_data(),
+          Dtype(0), broadcast_buffer_.mutable_gpu_data());
+      caffe_gpu_add(broadcast_buffer_.count(), const_bottom_data,
+          broadcast_buffer_.gpu_data(), broadcast_buffer_.mutable_gpu_data());
+      caffe_gpu_powx(broadcast_buffer_.count(), broadcast_buffer_.gpu_data(),
+          Dtype(2), broadcast_buffer_.mutable_gpu_data());
+      caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, spatial_dim_,
+          Dtype(1) / spatial_dim_, broadcast_buffer_.gpu_data(),
+          spatial_sum_multiplier_.gpu_data(), Dtype(0),
+          spatial_statistic_.mutable_gpu_data());
+      caffe_gpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1) / num_,
+          spatial_statistic_.gpu_data(), batch_sum_multiplier_.gpu_data(),
+          Dtype(0), x_std_.mutable_gpu_data());
+      SyncChannelStatistics(batch_statistic_.mutable_cpu_data(),
+          x_std_.mutable_cpu_data());
+    }
+#endif
     // Add to the moving average
-    if (moving_average_) {
+    if (moving_average_ && this->phase_ == TRAIN) {
       caffe_gpu_axpby(batch_statistic_.count(),
           Dtype(1) - bn_momentum_, batch_statistic_.gpu_data(),
           bn_momentum_, this->blobs_[2]->mutable_gpu_data());
@@ -45,7 +72,7 @@ void BNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       Dtype(1), batch_sum_multiplier_.gpu_data(), batch_statistic_.gpu_data(),
       Dtype(0), spatial_statistic_.mutable_gpu_data());
   caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(-1),
+      spatial_dim_, 1, Dtype(-1),
       spatial_statistic_.gpu_data(), spatial_sum_multiplier_.gpu_data(),
       Dtype(0), broadcast_buffer_.mutable_gpu_data());
   // Subtract
@@ -57,22 +84,26 @@ void BNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     // Use the moving average mean
     caffe_copy(batch_statistic_.count(), this->blobs_[3]->gpu_data(),
         batch_statistic_.mutable_gpu_data());
-  } else if (this->phase_ == TRAIN) {
+  } else if (sync_stats_) {
+    // The global variance was merged with the mean.
+    caffe_copy(batch_statistic_.count(), x_std_.gpu_data(),
+        batch_statistic_.mutable_gpu_data());
+  } else {
     caffe_gpu_powx(broadcast_buffer_.count(), const_top_data, Dtype(2),
         broadcast_buffer_.mutable_gpu_data());
-    caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1) / (height_ * width_), broadcast_buffer_.gpu_data(),
+    caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, spatial_dim_,
+        Dtype(1) / spatial_dim_, broadcast_buffer_.gpu_data(),
         spatial_sum_multiplier_.gpu_data(), Dtype(0),
         spatial_statistic_.mutable_gpu_data());
     caffe_gpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1) / num_,
         spatial_statistic_.gpu_data(), batch_sum_multiplier_.gpu_data(),
         Dtype(0), batch_statistic_.mutable_gpu_data());
-    // Add to the moving average
-    if (moving_average_) {
-      caffe_gpu_axpby(batch_statistic_.count(),
-          Dtype(1) - bn_momentum_, batch_statistic_.gpu_data(),
-          bn_momentum_, this->blobs_[3]->mutable_gpu_data());
-    }
+  }
+  // Add to the moving average
+  if (moving_average_ && this->phase_ == TRAIN) {
+    caffe_gpu_axpby(batch_statistic_.count(),
+        Dtype(1) - bn_momentum_, batch_statistic_.gpu_data(),
+        bn_momentum_, this->blobs_[3]->mutable_gpu_data());
   }
   // Add eps
   caffe_gpu_add_scalar(batch_statistic_.count(), bn_eps_,
@@ -84,7 +115,7 @@ void BNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       Dtype(1), batch_sum_multiplier_.gpu_data(), batch_statistic_.gpu_data(),
       Dtype(0), spatial_statistic_.mutable_gpu_data());
   caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
+      spatial_dim_, 1, Dtype(1),
       spatial_statistic_.gpu_data(), spatial_sum_multiplier_.gpu_data(),
       Dtype(0), broadcast_buffer_.mutable_gpu_data());
   // Divide by the std
@@ -102,7 +133,7 @@ void BNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       Dtype(1), batch_sum_multiplier_.gpu_data(), scale_data,
       Dtype(0), spatial_statistic_.mutable_gpu_data());
   caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
+      spatial_dim_, 1, Dtype(1),
       spatial_statistic_.gpu_data(), spatial_sum_multiplier_.gpu_data(),
       Dtype(0), broadcast_buffer_.mutable_gpu_data());
   caffe_gpu_mul(broadcast_buffer_.count(), const_top_data,
@@ -113,7 +144,7 @@ void BNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       Dtype(1), batch_sum_multiplier_.gpu_data(), shift_data,
       Dtype(0), spatial_statistic_.mutable_gpu_data());
   caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
+      spatial_dim_, 1, Dtype(1),
       spatial_statistic_.gpu_data(), spatial_sum_multiplier_.gpu_data(),
       Dtype(0), broadcast_buffer_.mutable_gpu_data());
   caffe_gpu_add(broadcast_buffer_.count(), const_top_data,
@@ -134,7 +165,7 @@ void BNLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   // gradient w.r.t. slope
   caffe_gpu_mul(broadcast_buffer_.count(), x_norm_.gpu_data(), const_top_diff,
       broadcast_buffer_.mutable_gpu_data());
-  caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
+  caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, spatial_dim_,
       Dtype(1), broadcast_buffer_.gpu_data(),
       spatial_sum_multiplier_.gpu_data(), Dtype(0),
       spatial_statistic_.mutable_gpu_data());
@@ -143,7 +174,7 @@ void BNLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       Dtype(1), scale_diff);
 
   // gradient w.r.t. bias
-  caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
+  caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, spatial_dim_,
       Dtype(1), const_top_diff, spatial_sum_multiplier_.gpu_data(),
       Dtype(0), spatial_statistic_.mutable_gpu_data());
   caffe_gpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
@@ -155,7 +186,7 @@ void BNLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       Dtype(1), batch_sum_multiplier_.gpu_data(), scale_data,
       Dtype(0), spatial_statistic_.mutable_gpu_data());
   caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1), spatial_statistic_.gpu_data(),
+      spatial_dim_, 1, Dtype(1), spatial_statistic_.gpu_data(),
       spatial_sum_multiplier_.gpu_data(), Dtype(0),
       broadcast_buffer_.mutable_gpu_data());
   caffe_gpu_mul(broadcast_buffer_.count(), const_top_diff,
@@ -164,49 +195,58 @@ void BNLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   // sum of x_hat * (dl / dx_hat)
   caffe_gpu_mul(broadcast_buffer_.count(), x_norm_.gpu_data(),
       broadcast_buffer_.gpu_data(), bottom_diff);
-  caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
+  caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, spatial_dim_,
       Dtype(1), const_bottom_diff, spatial_sum_multiplier_.gpu_data(),
       Dtype(0), spatial_statistic_.mutable_gpu_data());
   caffe_gpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
       spatial_statistic_.gpu_data(), batch_sum_multiplier_.gpu_data(),
       Dtype(0), batch_statistic_.mutable_gpu_data());
 
+  // sum of dl / dx_hat
+  caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, spatial_dim_,
+      Dtype(1), broadcast_buffer_.gpu_data(),
+      spatial_sum_multiplier_.gpu_data(), Dtype(0),
+      spatial_statistic_.mutable_gpu_data());
+  caffe_gpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
+      spatial_statistic_.gpu_data(), batch_sum_multiplier_.gpu_data(),
+      Dtype(0), diff_statistic_.mutable_gpu_data());
+  Dtype size = num_ * spatial_dim_;
+#ifdef USE_MPI
+  if (sync_stats_) {
+    // Only the two per-channel sums go through the host.
+    size = SyncDiffSums(diff_statistic_.mutable_cpu_data(),
+        batch_statistic_.mutable_cpu_data());
+  }
+#endif
+
   // x_hat times the sum
   caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
       Dtype(1), batch_sum_multiplier_.gpu_data(), batch_statistic_.gpu_data(),
       Dtype(0), spatial_statistic_.mutable_gpu_data());
   caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
+      spatial_dim_, 1, Dtype(1),
       spatial_statistic_.gpu_data(), spatial_sum_multiplier_.gpu_data(),
       Dtype(0), bottom_diff);
   caffe_gpu_mul(broadcast_buffer_.count(), x_norm_.gpu_data(),
       const_bottom_diff, bottom_diff);
 
-  // Subtract the average of x_hat times the sum
-  caffe_gpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-      Dtype(1), broadcast_buffer_.gpu_data(),
-      spatial_sum_multiplier_.gpu_data(), Dtype(0),
-      spatial_statistic_.mutable_gpu_data());
-  caffe_gpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-      spatial_statistic_.gpu_data(), batch_sum_multiplier_.gpu_data(),
-      Dtype(0), batch_statistic_.mutable_gpu_data());
+  // Subtract the average of x_hat times the sum, and of dl / dx_hat
   caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.gpu_data(), batch_statistic_.gpu_data(),
+      Dtype(1), batch_sum_multiplier_.gpu_data(), diff_statistic_.gpu_data(),
       Dtype(0), spatial_statistic_.mutable_gpu_data());
   caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
+      spatial_dim_, 1, Dtype(1),
       spatial_statistic_.gpu_data(), spatial_sum_multiplier_.gpu_data(),
       Dtype(1), bottom_diff);
   caffe_gpu_axpby(broadcast_buffer_.count(), Dtype(1),
-      broadcast_buffer_.gpu_data(), Dtype(-1) / (num_ * height_ * width_),
-      bottom_diff);
+      broadcast_buffer_.gpu_data(), Dtype(-1) / size, bottom_diff);
 
   // Divide by the std
   caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
       Dtype(1), batch_sum_multiplier_.gpu_data(), x_std_.gpu_data(),
       Dtype(0), spatial_statistic_.mutable_gpu_data());
   caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
+      spatial_dim_, 1, Dtype(1),
       spatial_statistic_.gpu_data(), spatial_sum_multiplier_.gpu_data(),
       Dtype(0), broadcast_buffer_.mutable_gpu_data());
   caffe_gpu_div(broadcast_buffer_.count(), const_bottom_diff,
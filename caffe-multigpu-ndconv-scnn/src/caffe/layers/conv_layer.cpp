@@ -30,7 +30,8 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* weight = this->blobs_[0]->cpu_data();
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
-    Dtype* top_data = top[i]->mutable_cpu_data();
+    // Every output is written by the GEMM with beta = 0.
+    Dtype* top_data = top[i]->mutable_cpu_data_for_overwrite();
     for (int n = 0; n < this->num_; ++n) {
       this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
           top_data + n * this->top_dim_);
@@ -38,6 +39,11 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
         const Dtype* bias = this->blobs_[1]->cpu_data();
         this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
       }
+      // Activate each image while its outputs are still in cache.
+      if (this->fused_activation_) {
+        this->fused_activation_->Activate_cpu(this->top_dim_,
+            top_data + n * this->top_dim_);
+      }
     }
   }
   printf("conv forward: %.6lf\n", top[0]->asum_data() / top[0]->count());
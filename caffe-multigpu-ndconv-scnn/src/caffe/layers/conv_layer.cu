@@ -23,6 +23,9 @@ void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
         this->forward_gpu_bias(top_data + n * this->top_dim_, bias);
       }
     }
+    if (this->fused_activation_) {
+      this->fused_activation_->Activate_gpu(top[i]->count(), top_data);
+    }
   }
 }
 
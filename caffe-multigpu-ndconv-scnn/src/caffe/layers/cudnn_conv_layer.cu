@@ -90,6 +90,9 @@ void CuDNNConvolutionLayer<Dtype>::Forward_gpu(
     // stream, by launching an empty kernel into the default (null) stream.
     // NOLINT_NEXT_LINE(whitespace/operators)
     sync_conv_groups<<<1, 1>>>();
+    if (this->fused_activation_) {
+      this->fused_activation_->Activate_gpu(top[i]->count(), top_data);
+    }
   }
 }
 
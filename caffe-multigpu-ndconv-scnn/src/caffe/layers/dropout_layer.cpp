@@ -1,5 +1,6 @@
 // TODO (sergeyk): effect should not be dependent on phase. wasted memcpy.
 
+#include <algorithm>
 #include <vector>
 
 #include "caffe/common.hpp"
@@ -26,8 +27,33 @@ void DropoutLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   NeuronLayer<Dtype>::Reshape(bottom, top);
   // Set up the cache for random number generation
-  rand_vec_.Reshape(bottom[0]->num(), bottom[0]->channels(),
-      bottom[0]->height(), bottom[0]->width());
+  rand_vec_.Reshape(bottom[0]->shape());
+  mask_bits_.Reshape(vector<int>(1, (bottom[0]->count() + 31) / 32));
+}
+
+// The mask is applied over the OpenMP threads above this many inputs.
+static const int kDropoutGrain = 1 << 15;
+
+// Computes out = in * scale for the inputs whose bit is set in the mask, and
+// out = 0 for the others.
+template <typename Dtype>
+static void ApplyMaskBits(const int count, const Dtype* in,
+    const unsigned int* mask, const Dtype scale, Dtype* out) {
+  const int num_words = (count + 31) / 32;
+#ifdef _OPENMP
+  #pragma omp parallel for if (count > kDropoutGrain) schedule(static)
+#endif
+  for (int word = 0; word < num_words; ++word) {
+    const unsigned int bits = mask[word];
+    const int offset = word * 32;
+    const int size = std::min(32, count - offset);
+    // Multiply by the bit rather than branch on it: the mask is random, so
+    // the branch would be mispredicted half of the time.
+    for (int i = 0; i < size; ++i) {
+      out[offset + i] =
+          in[offset + i] * (scale * static_cast<Dtype>((bits >> i) & 1));
+    }
+  }
 }
 
 template <typename Dtype>
@@ -35,14 +61,12 @@ void DropoutLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  unsigned int* mask = rand_vec_.mutable_cpu_data();
   const int count = bottom[0]->count();
   if (this->phase_ == TRAIN) {
     // Create random numbers
-    caffe_rng_bernoulli(count, 1. - threshold_, mask);
-    for (int i = 0; i < count; ++i) {
-      top_data[i] = bottom_data[i] * mask[i] * scale_;
-    }
+    unsigned int* mask = mask_bits_.mutable_cpu_data();
+    caffe_rng_philox_bernoulli_bits(count, 1. - threshold_, mask);
+    ApplyMaskBits(count, bottom_data, mask, scale_, top_data);
   } else {
     caffe_copy(bottom[0]->count(), bottom_data, top_data);
   }
@@ -56,11 +80,8 @@ void DropoutLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     if (this->phase_ == TRAIN) {
-      const unsigned int* mask = rand_vec_.cpu_data();
-      const int count = bottom[0]->count();
-      for (int i = 0; i < count; ++i) {
-        bottom_diff[i] = top_diff[i] * mask[i] * scale_;
-      }
+      ApplyMaskBits(bottom[0]->count(), top_diff, mask_bits_.cpu_data(),
+          scale_, bottom_diff);
     } else {
       caffe_copy(top[0]->count(), top_diff, bottom_diff);
     }
@@ -5,6 +5,8 @@
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/mpi_shard.hpp"
+#include "caffe/util/mpi_templates.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -21,24 +23,56 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // length K_ vector. For example, if bottom[0]'s shape is (N, C, H, W),
   // and axis == 1, N inner products with dimension CHW are performed.
   K_ = bottom[0]->count(axis);
+  rank_ = this->layer_param_.inner_product_param().rank();
+  factor_index_ = bias_term_ ? 2 : 1;
+  model_parallel_ = false;
+  gather_bottom_ = false;
+  N_local_ = N_;
+#ifdef USE_MPI
+  model_parallel_ = this->layer_param_.inner_product_param().model_parallel();
+  if (model_parallel_) {
+    CHECK_EQ(N_ % Caffe::mpi_size(), 0)
+        << "num_output (" << N_ << ") should be divisible by the number of "
+        << "MPI processes (" << Caffe::mpi_size() << ") in model-parallel mode";
+    N_local_ = N_ / Caffe::mpi_size();
+    gather_bottom_ = this->layer_param_.inner_product_param().gather_bottom();
+    CHECK(!gather_bottom_ || axis > 0)
+        << "Cannot gather the bottom along the batch axis when axis == 0";
+    CHECK_EQ(rank_, 0) << "Factored weights cannot be model-parallel.";
+  }
+#endif
   // Check if we need to set up the weights
   if (this->blobs_.size() > 0) {
     LOG(INFO) << "Skipping parameter initialization";
+#ifdef USE_MPI
+    if (model_parallel_ && this->blobs_[0]->shape(0) == N_) {
+      for (int i = 0; i < this->blobs_.size(); ++i) {
+        ShardBlobRows(this->blobs_[i].get());
+      }
+    }
+#endif
   } else {
     if (bias_term_) {
-      this->blobs_.resize(2);
+      this->blobs_.resize(rank_ ? 3 : 2);
     } else {
-      this->blobs_.resize(1);
+      this->blobs_.resize(rank_ ? 2 : 1);
     }
     // Intialize the weight
     vector<int> weight_shape(2);
     weight_shape[0] = N_;
-    weight_shape[1] = K_;
+    weight_shape[1] = rank_ ? rank_ : K_;
     this->blobs_[0].reset(new Blob<Dtype>(weight_shape));
     // fill the weights
     shared_ptr<Filler<Dtype> > weight_filler(GetFiller<Dtype>(
         this->layer_param_.inner_product_param().weight_filler()));
     weight_filler->Fill(this->blobs_[0].get());
+    if (rank_) {
+      vector<int> factor_shape(2);
+      factor_shape[0] = rank_;
+      factor_shape[1] = K_;
+      this->blobs_[factor_index_].reset(new Blob<Dtype>(factor_shape));
+      weight_filler->Fill(this->blobs_[factor_index_].get());
+    }
     // If necessary, intiialize and fill the bias term
     if (bias_term_) {
       vector<int> bias_shape(1, N_);
@@ -47,6 +81,17 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
           this->layer_param_.inner_product_param().bias_filler()));
       bias_filler->Fill(this->blobs_[1].get());
     }
+#ifdef USE_MPI
+    // Fill the full weights on the root so that the shards are the same as
+    // the rows of a serially initialized layer, then keep our own rows.
+    if (model_parallel_) {
+      for (int i = 0; i < this->blobs_.size(); ++i) {
+        MPIBcast<Dtype>(this->blobs_[i]->count(),
+            this->blobs_[i]->mutable_cpu_data());
+        ShardBlobRows(this->blobs_[i].get());
+      }
+    }
+#endif
   }  // parameter initialization
   this->param_propagate_down_.resize(this->blobs_.size(), true);
 }
@@ -68,7 +113,33 @@ void InnerProductLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   vector<int> top_shape = bottom[0]->shape();
   top_shape.resize(axis + 1);
   top_shape[axis] = N_;
+#ifdef USE_MPI
+  if (model_parallel_) {
+    if (gather_bottom_) {
+      vector<int> gathered_shape = bottom[0]->shape();
+      gathered_shape[0] *= Caffe::mpi_size();
+      gathered_bottom_.Reshape(gathered_shape);
+      M_ *= Caffe::mpi_size();
+      top_shape[0] *= Caffe::mpi_size();
+    }
+    vector<int> local_shape(2);
+    local_shape[0] = M_;
+    local_shape[1] = N_local_;
+    local_top_.Reshape(local_shape);
+    vector<int> gathered_top_shape(3);
+    gathered_top_shape[0] = Caffe::mpi_size();
+    gathered_top_shape[1] = M_;
+    gathered_top_shape[2] = N_local_;
+    gathered_top_.Reshape(gathered_top_shape);
+  }
+#endif
   top[0]->Reshape(top_shape);
+  if (rank_) {
+    vector<int> projection_shape(2);
+    projection_shape[0] = M_;
+    projection_shape[1] = rank_;
+    projection_.Reshape(projection_shape);
+  }
   // Set up the bias multiplier
   if (bias_term_) {
     vector<int> bias_shape(1, M_);
@@ -80,16 +151,35 @@ void InnerProductLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
+#ifdef USE_MPI
+  if (model_parallel_) {
+    ForwardModelParallel_cpu(bottom, top);
+    return;
+  }
+#endif
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const Dtype* weight = this->blobs_[0]->cpu_data();
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
-      bottom_data, weight, (Dtype)0., top_data);
+  if (rank_) {
+    // Project the inputs to rank_ dimensions, then expand them to N_.
+    Dtype* projection_data = projection_.mutable_cpu_data();
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, rank_, K_, (Dtype)1.,
+        bottom_data, this->blobs_[factor_index_]->cpu_data(), (Dtype)0.,
+        projection_data);
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, rank_, (Dtype)1.,
+        projection_data, weight, (Dtype)0., top_data);
+  } else {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
+        bottom_data, weight, (Dtype)0., top_data);
+  }
   if (bias_term_) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1, (Dtype)1.,
         bias_multiplier_.cpu_data(),
         this->blobs_[1]->cpu_data(), (Dtype)1., top_data);
   }
+  if (this->fused_activation_) {
+    this->fused_activation_->Activate_cpu(top[0]->count(), top_data);
+  }
   printf("ip forward: %.6lf\n", top[0]->asum_data() / top[0]->count());
 }
 
@@ -97,6 +187,16 @@ template <typename Dtype>
 void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
+#ifdef USE_MPI
+  if (model_parallel_) {
+    BackwardModelParallel_cpu(top, propagate_down, bottom);
+    return;
+  }
+#endif
+  if (rank_) {
+    BackwardFactored_cpu(top, propagate_down, bottom);
+    return;
+  }
   if (this->param_propagate_down_[0]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     const Dtype* bottom_data = bottom[0]->cpu_data();
@@ -121,6 +221,148 @@ void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   printf("ip backward: %.6lf\n", this->blobs_[0]->asum_diff() / this->blobs_[0]->count());
 }
 
+template <typename Dtype>
+void InnerProductLayer<Dtype>::BackwardFactored_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  const Dtype* top_diff = top[0]->cpu_diff();
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Blob<Dtype>* factor = this->blobs_[factor_index_].get();
+  if (this->param_propagate_down_[0]) {
+    // Gradient with respect to the first factor
+    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, N_, rank_, M_, (Dtype)1.,
+        top_diff, projection_.cpu_data(), (Dtype)1.,
+        this->blobs_[0]->mutable_cpu_diff());
+  }
+  if (bias_term_ && this->param_propagate_down_[1]) {
+    // Gradient with respect to bias
+    caffe_cpu_gemv<Dtype>(CblasTrans, M_, N_, (Dtype)1., top_diff,
+        bias_multiplier_.cpu_data(), (Dtype)1.,
+        this->blobs_[1]->mutable_cpu_diff());
+  }
+  if (!this->param_propagate_down_[factor_index_] && !propagate_down[0]) {
+    return;
+  }
+  // Gradient with respect to the projected inputs
+  Dtype* projection_diff = projection_.mutable_cpu_diff();
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, rank_, N_, (Dtype)1.,
+      top_diff, this->blobs_[0]->cpu_data(), (Dtype)0., projection_diff);
+  if (this->param_propagate_down_[factor_index_]) {
+    // Gradient with respect to the second factor
+    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, rank_, K_, M_, (Dtype)1.,
+        projection_diff, bottom_data, (Dtype)1., factor->mutable_cpu_diff());
+  }
+  if (propagate_down[0]) {
+    // Gradient with respect to bottom data
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, K_, rank_, (Dtype)1.,
+        projection_diff, factor->cpu_data(), (Dtype)0.,
+        bottom[0]->mutable_cpu_diff());
+  }
+}
+
+template <typename Dtype>
+void InnerProductLayer<Dtype>::ToProto(LayerParameter* param,
+    bool write_diff) {
+  if (!model_parallel_) {
+    Layer<Dtype>::ToProto(param, write_diff);
+    return;
+  }
+#ifdef USE_MPI
+  param->Clear();
+  param->CopyFrom(this->layer_param_);
+  param->clear_blobs();
+  for (int i = 0; i < this->blobs_.size(); ++i) {
+    BlobProto* blob_proto = param->add_blobs();
+    GatherBlobRowsToProto(*this->blobs_[i], blob_proto, write_diff);
+  }
+#endif
+}
+
+#ifdef USE_MPI
+template <typename Dtype>
+void InnerProductLayer<Dtype>::ForwardModelParallel_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const Dtype* bottom_data = NULL;
+  if (gather_bottom_) {
+    MPIAllgather<Dtype>(bottom[0]->count(), bottom[0]->cpu_data(),
+        gathered_bottom_.mutable_cpu_data());
+    bottom_data = gathered_bottom_.cpu_data();
+  } else {
+    // A replicated bottom may still differ across processes (e.g. after a
+    // dropout), so use the root's copy to keep every shard consistent.
+    MPIBcast<Dtype>(bottom[0]->count(), bottom[0]->mutable_cpu_data());
+    bottom_data = bottom[0]->cpu_data();
+  }
+  Dtype* local_data = local_top_.mutable_cpu_data();
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_local_, K_, (Dtype)1.,
+      bottom_data, this->blobs_[0]->cpu_data(), (Dtype)0., local_data);
+  if (bias_term_) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_local_, 1,
+        (Dtype)1., bias_multiplier_.cpu_data(),
+        this->blobs_[1]->cpu_data(), (Dtype)1., local_data);
+  }
+  MPIAllgather<Dtype>(local_top_.count(), local_top_.cpu_data(),
+      gathered_top_.mutable_cpu_data());
+  // gathered_top_ is mpi_size x M_ x N_local_; interleave it into M_ x N_.
+  const Dtype* gathered_data = gathered_top_.cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  for (int p = 0; p < Caffe::mpi_size(); ++p) {
+    for (int m = 0; m < M_; ++m) {
+      caffe_copy(N_local_, gathered_data + (p * M_ + m) * N_local_,
+          top_data + m * N_ + p * N_local_);
+    }
+  }
+}
+
+template <typename Dtype>
+void InnerProductLayer<Dtype>::BackwardModelParallel_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  // The layers above are serial, so only the root holds the true gradient.
+  MPIBcast<Dtype>(top[0]->count(), top[0]->mutable_cpu_diff());
+  // Pick the columns of the top diff that belong to our shard.
+  const Dtype* top_diff = top[0]->cpu_diff();
+  Dtype* local_diff = local_top_.mutable_cpu_diff();
+  const int offset = Caffe::mpi_rank() * N_local_;
+  for (int m = 0; m < M_; ++m) {
+    caffe_copy(N_local_, top_diff + m * N_ + offset,
+        local_diff + m * N_local_);
+  }
+  const Dtype* bottom_data = gather_bottom_ ? gathered_bottom_.cpu_data() :
+      bottom[0]->cpu_data();
+  if (this->param_propagate_down_[0]) {
+    // Gradient with respect to our rows of the weight
+    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, N_local_, K_, M_,
+        (Dtype)1., local_diff, bottom_data, (Dtype)1.,
+        this->blobs_[0]->mutable_cpu_diff());
+  }
+  if (bias_term_ && this->param_propagate_down_[1]) {
+    // Gradient with respect to our part of the bias
+    caffe_cpu_gemv<Dtype>(CblasTrans, M_, N_local_, (Dtype)1., local_diff,
+        bias_multiplier_.cpu_data(), (Dtype)1.,
+        this->blobs_[1]->mutable_cpu_diff());
+  }
+  if (propagate_down[0]) {
+    // Every shard contributes a partial gradient with respect to the bottom;
+    // sum them and hand each process the rows of its own bottom.
+    if (gather_bottom_) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, K_, N_local_,
+          (Dtype)1., local_diff, this->blobs_[0]->cpu_data(), (Dtype)0.,
+          gathered_bottom_.mutable_cpu_diff());
+      MPIReduceScatterBlock<Dtype>(bottom[0]->count(),
+          gathered_bottom_.cpu_diff(), bottom[0]->mutable_cpu_diff(),
+          MPI_SUM);
+    } else {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, K_, N_local_,
+          (Dtype)1., local_diff, this->blobs_[0]->cpu_data(), (Dtype)0.,
+          bottom[0]->mutable_cpu_diff());
+      MPIAllreduce<Dtype>(bottom[0]->count(), MPI_IN_PLACE,
+          bottom[0]->mutable_cpu_diff(), MPI_SUM);
+    }
+  }
+}
+#endif
+
 #ifdef CPU_ONLY
 STUB_GPU(InnerProductLayer);
 #endif
@@ -12,22 +12,48 @@ namespace caffe {
 template <typename Dtype>
 void InnerProductLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
+  if (model_parallel_) {
+    // The shards are exchanged through host memory.
+    Forward_cpu(bottom, top);
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->gpu_data();
   Dtype* top_data = top[0]->mutable_gpu_data();
   const Dtype* weight = this->blobs_[0]->gpu_data();
-  caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
-      bottom_data, weight, (Dtype)0., top_data);
+  if (rank_) {
+    // Project the inputs to rank_ dimensions, then expand them to N_.
+    Dtype* projection_data = projection_.mutable_gpu_data();
+    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, rank_, K_, (Dtype)1.,
+        bottom_data, this->blobs_[factor_index_]->gpu_data(), (Dtype)0.,
+        projection_data);
+    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, rank_, (Dtype)1.,
+        projection_data, weight, (Dtype)0., top_data);
+  } else {
+    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
+        bottom_data, weight, (Dtype)0., top_data);
+  }
   if (bias_term_) {
     caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1, (Dtype)1.,
         bias_multiplier_.gpu_data(),
         this->blobs_[1]->gpu_data(), (Dtype)1., top_data);
   }
+  if (this->fused_activation_) {
+    this->fused_activation_->Activate_gpu(top[0]->count(), top_data);
+  }
 }
 
 template <typename Dtype>
 void InnerProductLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
+  if (model_parallel_) {
+    Backward_cpu(top, propagate_down, bottom);
+    return;
+  }
+  if (rank_) {
+    BackwardFactored_gpu(top, propagate_down, bottom);
+    return;
+  }
   if (this->param_propagate_down_[0]) {
     const Dtype* top_diff = top[0]->gpu_diff();
     const Dtype* bottom_data = bottom[0]->gpu_data();
@@ -51,6 +77,45 @@ void InnerProductLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   }
 }
 
+template <typename Dtype>
+void InnerProductLayer<Dtype>::BackwardFactored_gpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  const Dtype* top_diff = top[0]->gpu_diff();
+  const Dtype* bottom_data = bottom[0]->gpu_data();
+  Blob<Dtype>* factor = this->blobs_[factor_index_].get();
+  if (this->param_propagate_down_[0]) {
+    // Gradient with respect to the first factor
+    caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, N_, rank_, M_, (Dtype)1.,
+        top_diff, projection_.gpu_data(), (Dtype)1.,
+        this->blobs_[0]->mutable_gpu_diff());
+  }
+  if (bias_term_ && this->param_propagate_down_[1]) {
+    // Gradient with respect to bias
+    caffe_gpu_gemv<Dtype>(CblasTrans, M_, N_, (Dtype)1., top_diff,
+        bias_multiplier_.gpu_data(), (Dtype)1.,
+        this->blobs_[1]->mutable_gpu_diff());
+  }
+  if (!this->param_propagate_down_[factor_index_] && !propagate_down[0]) {
+    return;
+  }
+  // Gradient with respect to the projected inputs
+  Dtype* projection_diff = projection_.mutable_gpu_diff();
+  caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, rank_, N_, (Dtype)1.,
+      top_diff, this->blobs_[0]->gpu_data(), (Dtype)0., projection_diff);
+  if (this->param_propagate_down_[factor_index_]) {
+    // Gradient with respect to the second factor
+    caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, rank_, K_, M_, (Dtype)1.,
+        projection_diff, bottom_data, (Dtype)1., factor->mutable_gpu_diff());
+  }
+  if (propagate_down[0]) {
+    // Gradient with respect to bottom data
+    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, K_, rank_, (Dtype)1.,
+        projection_diff, factor->gpu_data(), (Dtype)0.,
+        bottom[0]->mutable_gpu_diff());
+  }
+}
+
 INSTANTIATE_LAYER_GPU_FUNCS(InnerProductLayer);
 
 }  // namespace caffe
@@ -1,3 +1,4 @@
+#include <cmath>
 #include <vector>
 
 #include "caffe/layer.hpp"
@@ -6,6 +7,85 @@
 
 namespace caffe {
 
+// The CPU passes are spread over the OpenMP threads (when built with
+// USE_OPENMP) for inputs larger than kLRNGrain elements: over the images
+// across channels, and over the planes within a channel. Within a thread the
+// element-wise loops, the column pass of LRNBoxSum included, are simd (as
+// checked with -fopt-info-vec). The running sums of its row pass stay scalar,
+// and so does LRNScaleRow, whose sqrt and pow need -ffast-math to vectorize.
+static const int kLRNGrain = 1 << 15;
+
+// Computes out = in * scale^-beta, without pow for the usual beta of 0.75.
+template <typename Dtype>
+static void LRNScaleRow(const int count, const Dtype* in, const Dtype* scale,
+    const Dtype beta, Dtype* out) {
+  if (beta == Dtype(0.75)) {
+    for (int i = 0; i < count; ++i) {
+      out[i] = in[i] / std::sqrt(scale[i] * std::sqrt(scale[i]));
+    }
+  } else {
+    for (int i = 0; i < count; ++i) {
+      out[i] = in[i] * std::pow(scale[i], -beta);
+    }
+  }
+}
+
+// Sums each value of a height x width plane over the window of
+// 2 * pre_pad + 1 values on each side centered on it, with zeros outside the
+// plane: a sliding sum along each row into rows, then one along the columns
+// into out, which adds and subtracts whole rows. The row pass is a running
+// sum, so each value depends on the one before it.
+template <typename Dtype>
+static void LRNBoxSum(const Dtype* in, const int height, const int width,
+    const int pre_pad, Dtype* rows, Dtype* out) {
+  for (int h = 0; h < height; ++h) {
+    const Dtype* in_row = in + h * width;
+    Dtype* row = rows + h * width;
+    Dtype sum = 0;
+    for (int w = 0; w < pre_pad && w < width; ++w) {
+      sum += in_row[w];
+    }
+    for (int w = 0; w < width; ++w) {
+      if (w + pre_pad < width) {
+        sum += in_row[w + pre_pad];
+      }
+      if (w - pre_pad - 1 >= 0) {
+        sum -= in_row[w - pre_pad - 1];
+      }
+      row[w] = sum;
+    }
+  }
+  for (int h = 0; h < height; ++h) {
+    Dtype* out_row = out + h * width;
+    if (h == 0) {
+      caffe_set(width, Dtype(0), out_row);
+      for (int r = 0; r < pre_pad && r < height; ++r) {
+        caffe_axpy(width, Dtype(1), rows + r * width, out_row);
+      }
+    } else {
+      caffe_copy(width, out_row - width, out_row);
+    }
+    if (h + pre_pad < height) {
+      const Dtype* head = rows + (h + pre_pad) * width;
+#ifdef _OPENMP
+      #pragma omp simd
+#endif
+      for (int w = 0; w < width; ++w) {
+        out_row[w] += head[w];
+      }
+    }
+    if (h - pre_pad - 1 >= 0) {
+      const Dtype* tail = rows + (h - pre_pad - 1) * width;
+#ifdef _OPENMP
+      #pragma omp simd
+#endif
+      for (int w = 0; w < width; ++w) {
+        out_row[w] -= tail[w];
+      }
+    }
+  }
+}
+
 template <typename Dtype>
 void LRNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -15,55 +95,6 @@ void LRNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   alpha_ = this->layer_param_.lrn_param().alpha();
   beta_ = this->layer_param_.lrn_param().beta();
   k_ = this->layer_param_.lrn_param().k();
-  if (this->layer_param_.lrn_param().norm_region() ==
-      LRNParameter_NormRegion_WITHIN_CHANNEL) {
-    // Set up split_layer_ to use inputs in the numerator and denominator.
-    split_top_vec_.clear();
-    split_top_vec_.push_back(&product_input_);
-    split_top_vec_.push_back(&square_input_);
-    LayerParameter split_param;
-    split_layer_.reset(new SplitLayer<Dtype>(split_param));
-    split_layer_->SetUp(bottom, split_top_vec_);
-    // Set up square_layer_ to square the inputs.
-    square_bottom_vec_.clear();
-    square_top_vec_.clear();
-    square_bottom_vec_.push_back(&square_input_);
-    square_top_vec_.push_back(&square_output_);
-    LayerParameter square_param;
-    square_param.mutable_power_param()->set_power(Dtype(2));
-    square_layer_.reset(new PowerLayer<Dtype>(square_param));
-    square_layer_->SetUp(square_bottom_vec_, square_top_vec_);
-    // Set up pool_layer_ to sum over square neighborhoods of the input.
-    pool_top_vec_.clear();
-    pool_top_vec_.push_back(&pool_output_);
-    LayerParameter pool_param;
-    pool_param.mutable_pooling_param()->set_pool(
-        PoolingParameter_PoolMethod_AVE);
-    pool_param.mutable_pooling_param()->set_pad(pre_pad_);
-    pool_param.mutable_pooling_param()->set_kernel_size(size_);
-    pool_layer_.reset(new PoolingLayer<Dtype>(pool_param));
-    pool_layer_->SetUp(square_top_vec_, pool_top_vec_);
-    // Set up power_layer_ to compute (1 + alpha_/N^2 s)^-beta_, where s is
-    // the sum of a squared neighborhood (the output of pool_layer_).
-    power_top_vec_.clear();
-    power_top_vec_.push_back(&power_output_);
-    LayerParameter power_param;
-    power_param.mutable_power_param()->set_power(-beta_);
-    power_param.mutable_power_param()->set_scale(alpha_);
-    power_param.mutable_power_param()->set_shift(Dtype(1));
-    power_layer_.reset(new PowerLayer<Dtype>(power_param));
-    power_layer_->SetUp(pool_top_vec_, power_top_vec_);
-    // Set up a product_layer_ to compute outputs by multiplying inputs by the
-    // inverse demoninator computed by the power layer.
-    product_bottom_vec_.clear();
-    product_bottom_vec_.push_back(&product_input_);
-    product_bottom_vec_.push_back(&power_output_);
-    LayerParameter product_param;
-    EltwiseParameter* eltwise_param = product_param.mutable_eltwise_param();
-    eltwise_param->set_operation(EltwiseParameter_EltwiseOp_PROD);
-    product_layer_.reset(new EltwiseLayer<Dtype>(product_param));
-    product_layer_->SetUp(product_bottom_vec_, top);
-  }
 }
 
 template <typename Dtype>
@@ -75,19 +106,8 @@ void LRNLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   channels_ = bottom[0]->channels();
   height_ = bottom[0]->height();
   width_ = bottom[0]->width();
-  switch (this->layer_param_.lrn_param().norm_region()) {
-  case LRNParameter_NormRegion_ACROSS_CHANNELS:
-    top[0]->Reshape(num_, channels_, height_, width_);
-    scale_.Reshape(num_, channels_, height_, width_);
-    break;
-  case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    split_layer_->Reshape(bottom, split_top_vec_);
-    square_layer_->Reshape(square_bottom_vec_, square_top_vec_);
-    pool_layer_->Reshape(square_top_vec_, pool_top_vec_);
-    power_layer_->Reshape(pool_top_vec_, power_top_vec_);
-    product_layer_->Reshape(product_bottom_vec_, top);
-    break;
-  }
+  top[0]->Reshape(num_, channels_, height_, width_);
+  scale_.Reshape(num_, channels_, height_, width_);
 }
 
 template <typename Dtype>
@@ -98,7 +118,7 @@ void LRNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     CrossChannelForward_cpu(bottom, top);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelForward(bottom, top);
+    WithinChannelForward_cpu(bottom, top);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
@@ -111,55 +131,93 @@ void LRNLayer<Dtype>::CrossChannelForward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   Dtype* scale_data = scale_.mutable_cpu_data();
-  // start with the constant value
-  for (int i = 0; i < scale_.count(); ++i) {
-    scale_data[i] = k_;
-  }
-  Blob<Dtype> padded_square(1, channels_ + size_ - 1, height_, width_);
-  Dtype* padded_square_data = padded_square.mutable_cpu_data();
-  caffe_set(padded_square.count(), Dtype(0), padded_square_data);
-  Dtype alpha_over_size = alpha_ / size_;
-  // go through the images
+  const int spatial_dim = height_ * width_;
+  const Dtype alpha_over_size = alpha_ / size_;
+#ifdef _OPENMP
+  #pragma omp parallel for if (bottom[0]->count() > kLRNGrain) schedule(static)
+#endif
   for (int n = 0; n < num_; ++n) {
-    // compute the padded square
-    caffe_sqr(channels_ * height_ * width_,
-        bottom_data + bottom[0]->offset(n),
-        padded_square_data + padded_square.offset(0, pre_pad_));
-    // Create the first channel scale
-    for (int c = 0; c < size_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c),
-          scale_data + scale_.offset(n, 0));
+    const Dtype* image = bottom_data + bottom[0]->offset(n);
+    // The sum of squares over the window of channel c, which each step
+    // slides by adding the channel entering it and subtracting the one
+    // leaving it.
+    vector<Dtype> sum(spatial_dim, Dtype(0));
+    for (int c = 0; c < pre_pad_ && c < channels_; ++c) {
+      const Dtype* head = image + c * spatial_dim;
+#ifdef _OPENMP
+      #pragma omp simd
+#endif
+      for (int i = 0; i < spatial_dim; ++i) {
+        sum[i] += head[i] * head[i];
+      }
     }
-    for (int c = 1; c < channels_; ++c) {
-      // copy previous scale
-      caffe_copy<Dtype>(height_ * width_,
-          scale_data + scale_.offset(n, c - 1),
-          scale_data + scale_.offset(n, c));
-      // add head
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c + size_ - 1),
-          scale_data + scale_.offset(n, c));
-      // subtract tail
-      caffe_axpy<Dtype>(height_ * width_, -alpha_over_size,
-          padded_square_data + padded_square.offset(0, c - 1),
-          scale_data + scale_.offset(n, c));
+    for (int c = 0; c < channels_; ++c) {
+      if (c + pre_pad_ < channels_) {
+        const Dtype* head = image + (c + pre_pad_) * spatial_dim;
+#ifdef _OPENMP
+        #pragma omp simd
+#endif
+        for (int i = 0; i < spatial_dim; ++i) {
+          sum[i] += head[i] * head[i];
+        }
+      }
+      if (c - pre_pad_ - 1 >= 0) {
+        const Dtype* tail = image + (c - pre_pad_ - 1) * spatial_dim;
+#ifdef _OPENMP
+        #pragma omp simd
+#endif
+        for (int i = 0; i < spatial_dim; ++i) {
+          sum[i] -= tail[i] * tail[i];
+        }
+      }
+      const int offset = scale_.offset(n, c);
+      Dtype* channel_scale = scale_data + offset;
+#ifdef _OPENMP
+      #pragma omp simd
+#endif
+      for (int i = 0; i < spatial_dim; ++i) {
+        channel_scale[i] = k_ + alpha_over_size * sum[i];
+      }
+      LRNScaleRow(spatial_dim, bottom_data + offset, channel_scale, beta_,
+          top_data + offset);
     }
   }
-
-  // In the end, compute output
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
-  caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
 }
 
 template <typename Dtype>
-void LRNLayer<Dtype>::WithinChannelForward(
+void LRNLayer<Dtype>::WithinChannelForward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  split_layer_->Forward(bottom, split_top_vec_);
-  square_layer_->Forward(square_bottom_vec_, square_top_vec_);
-  pool_layer_->Forward(square_top_vec_, pool_top_vec_);
-  power_layer_->Forward(pool_top_vec_, power_top_vec_);
-  product_layer_->Forward(product_bottom_vec_, top);
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  Dtype* scale_data = scale_.mutable_cpu_data();
+  const int spatial_dim = height_ * width_;
+  // The window is averaged over its size_ * size_ values, padding included.
+  const Dtype alpha_over_size = alpha_ / (size_ * size_);
+  const int num_planes = num_ * channels_;
+#ifdef _OPENMP
+  #pragma omp parallel for if (bottom[0]->count() > kLRNGrain) schedule(static)
+#endif
+  for (int plane = 0; plane < num_planes; ++plane) {
+    const Dtype* plane_bottom = bottom_data + plane * spatial_dim;
+    Dtype* plane_scale = scale_data + plane * spatial_dim;
+    vector<Dtype> squares(spatial_dim);
+    vector<Dtype> rows(spatial_dim);
+#ifdef _OPENMP
+    #pragma omp simd
+#endif
+    for (int i = 0; i < spatial_dim; ++i) {
+      squares[i] = plane_bottom[i] * plane_bottom[i];
+    }
+    LRNBoxSum(&squares[0], height_, width_, pre_pad_, &rows[0], plane_scale);
+#ifdef _OPENMP
+    #pragma omp simd
+#endif
+    for (int i = 0; i < spatial_dim; ++i) {
+      plane_scale[i] = 1 + alpha_over_size * plane_scale[i];
+    }
+    LRNScaleRow(spatial_dim, plane_bottom, plane_scale, beta_,
+        top_data + plane * spatial_dim);
+  }
 }
 
 template <typename Dtype>
@@ -170,7 +228,7 @@ void LRNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     CrossChannelBackward_cpu(top, propagate_down, bottom);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelBackward(top, propagate_down, bottom);
+    WithinChannelBackward_cpu(top, propagate_down, bottom);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
@@ -186,71 +244,110 @@ void LRNLayer<Dtype>::CrossChannelBackward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   const Dtype* scale_data = scale_.cpu_data();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  Blob<Dtype> padded_ratio(1, channels_ + size_ - 1, height_, width_);
-  Blob<Dtype> accum_ratio(1, 1, height_, width_);
-  Dtype* padded_ratio_data = padded_ratio.mutable_cpu_data();
-  Dtype* accum_ratio_data = accum_ratio.mutable_cpu_data();
-  // We hack a little bit by using the diff() to store an additional result
-  Dtype* accum_ratio_times_bottom = accum_ratio.mutable_cpu_diff();
-  caffe_set(padded_ratio.count(), Dtype(0), padded_ratio_data);
-  Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
-
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, bottom_diff);
-  caffe_mul<Dtype>(scale_.count(), top_diff, bottom_diff, bottom_diff);
-
-  // go through individual data
-  int inverse_pre_pad = size_ - (size_ + 1) / 2;
+  const int spatial_dim = height_ * width_;
+  const Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
+#ifdef _OPENMP
+  #pragma omp parallel for if (bottom[0]->count() > kLRNGrain) schedule(static)
+#endif
   for (int n = 0; n < num_; ++n) {
-    int block_offset = scale_.offset(n);
-    // first, compute diff_i * y_i / s_i
-    caffe_mul<Dtype>(channels_ * height_ * width_,
-        top_diff + block_offset, top_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    caffe_div<Dtype>(channels_ * height_ * width_,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad),
-        scale_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    // Now, compute the accumulated ratios and the bottom diff
-    caffe_set(accum_ratio.count(), Dtype(0), accum_ratio_data);
-    for (int c = 0; c < size_ - 1; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
-    }
-    for (int c = 0; c < channels_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c + size_ - 1),
-          accum_ratio_data);
-      // compute bottom diff
-      caffe_mul<Dtype>(height_ * width_,
-          bottom_data + top[0]->offset(n, c),
-          accum_ratio_data, accum_ratio_times_bottom);
-      caffe_axpy<Dtype>(height_ * width_, -cache_ratio_value,
-          accum_ratio_times_bottom, bottom_diff + top[0]->offset(n, c));
-      caffe_axpy<Dtype>(height_ * width_, -1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+    const int image_offset = scale_.offset(n);
+    // The ratios diff_i * y_i / s_i of the channels in the window of channel
+    // head - pre_pad_, in a ring of size_ rows indexed by channel, and their
+    // sum. The channel entering the window takes the row of the one leaving.
+    vector<Dtype> ring(size_ * spatial_dim, Dtype(0));
+    vector<Dtype> accum_ratio(spatial_dim, Dtype(0));
+    for (int head = 0; head < channels_ + pre_pad_; ++head) {
+      Dtype* slot = &ring[(head % size_) * spatial_dim];
+      if (head < channels_) {
+        const int offset = image_offset + head * spatial_dim;
+#ifdef _OPENMP
+        #pragma omp simd
+#endif
+        for (int i = 0; i < spatial_dim; ++i) {
+          const Dtype ratio = top_diff[offset + i] * top_data[offset + i] /
+              scale_data[offset + i];
+          accum_ratio[i] += ratio - slot[i];
+          slot[i] = ratio;
+        }
+      } else {
+#ifdef _OPENMP
+        #pragma omp simd
+#endif
+        for (int i = 0; i < spatial_dim; ++i) {
+          accum_ratio[i] -= slot[i];
+          slot[i] = 0;
+        }
+      }
+      const int c = head - pre_pad_;
+      if (c < 0) {
+        continue;
+      }
+      const int offset = image_offset + c * spatial_dim;
+      LRNScaleRow(spatial_dim, top_diff + offset, scale_data + offset, beta_,
+          bottom_diff + offset);
+#ifdef _OPENMP
+      #pragma omp simd
+#endif
+      for (int i = 0; i < spatial_dim; ++i) {
+        bottom_diff[offset + i] -=
+            cache_ratio_value * bottom_data[offset + i] * accum_ratio[i];
+      }
     }
   }
 }
 
 template <typename Dtype>
-void LRNLayer<Dtype>::WithinChannelBackward(
+void LRNLayer<Dtype>::WithinChannelBackward_cpu(
     const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
-  if (propagate_down[0]) {
-    vector<bool> product_propagate_down(2, true);
-    product_layer_->Backward(top, product_propagate_down, product_bottom_vec_);
-    power_layer_->Backward(power_top_vec_, propagate_down, pool_top_vec_);
-    pool_layer_->Backward(pool_top_vec_, propagate_down, square_top_vec_);
-    square_layer_->Backward(square_top_vec_, propagate_down,
-                            square_bottom_vec_);
-    split_layer_->Backward(split_top_vec_, propagate_down, bottom);
+  if (!propagate_down[0]) {
+    return;
+  }
+  const Dtype* top_diff = top[0]->cpu_diff();
+  const Dtype* top_data = top[0]->cpu_data();
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  const Dtype* scale_data = scale_.cpu_data();
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  const int spatial_dim = height_ * width_;
+  const Dtype cache_ratio_value = 2. * alpha_ * beta_ / (size_ * size_);
+  const int num_planes = num_ * channels_;
+#ifdef _OPENMP
+  #pragma omp parallel for if (bottom[0]->count() > kLRNGrain) schedule(static)
+#endif
+  for (int plane = 0; plane < num_planes; ++plane) {
+    const int offset = plane * spatial_dim;
+    // The window is symmetric, so each input gets the ratios
+    // diff_i * y_i / s_i summed over its own window.
+    vector<Dtype> ratio(spatial_dim);
+    vector<Dtype> rows(spatial_dim);
+    vector<Dtype> accum_ratio(spatial_dim);
+#ifdef _OPENMP
+    #pragma omp simd
+#endif
+    for (int i = 0; i < spatial_dim; ++i) {
+      ratio[i] = top_diff[offset + i] * top_data[offset + i] /
+          scale_data[offset + i];
+    }
+    LRNBoxSum(&ratio[0], height_, width_, pre_pad_, &rows[0],
+        &accum_ratio[0]);
+    LRNScaleRow(spatial_dim, top_diff + offset, scale_data + offset, beta_,
+        bottom_diff + offset);
+#ifdef _OPENMP
+    #pragma omp simd
+#endif
+    for (int i = 0; i < spatial_dim; ++i) {
+      bottom_diff[offset + i] -=
+          cache_ratio_value * bottom_data[offset + i] * accum_ratio[i];
+    }
   }
 }
 
 #ifdef CPU_ONLY
 STUB_GPU(LRNLayer);
 STUB_GPU_FORWARD(LRNLayer, CrossChannelForward);
+STUB_GPU_FORWARD(LRNLayer, WithinChannelForward);
 STUB_GPU_BACKWARD(LRNLayer, CrossChannelBackward);
+STUB_GPU_BACKWARD(LRNLayer, WithinChannelBackward);
 #endif
 
 INSTANTIATE_CLASS(LRNLayer);
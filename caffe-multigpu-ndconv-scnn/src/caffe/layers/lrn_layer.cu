@@ -61,7 +61,7 @@ void LRNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     CrossChannelForward_gpu(bottom, top);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelForward(bottom, top);
+    WithinChannelForward_gpu(bottom, top);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
@@ -103,6 +103,53 @@ template void LRNLayer<float>::CrossChannelForward_gpu(
 template void LRNLayer<double>::CrossChannelForward_gpu(
     const vector<Blob<double>*>& bottom, const vector<Blob<double>*>& top);
 
+// Sums the squares of the size x size window centered on each value of its
+// plane, with zeros outside the plane.
+template <typename Dtype>
+__global__ void LRNWithinChannelFillScale(const int nthreads,
+    const Dtype* const in, const int height, const int width, const int size,
+    const Dtype alpha_over_size, Dtype* const scale) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int w = index % width;
+    const int h = (index / width) % height;
+    const Dtype* const plane = in + (index - h * width - w);
+    const int pre_pad = (size - 1) / 2;
+    const int hstart = max(h - pre_pad, 0);
+    const int wstart = max(w - pre_pad, 0);
+    const int hend = min(h + pre_pad + 1, height);
+    const int wend = min(w + pre_pad + 1, width);
+    Dtype accum_scale = 0;
+    for (int hh = hstart; hh < hend; ++hh) {
+      for (int ww = wstart; ww < wend; ++ww) {
+        accum_scale += plane[hh * width + ww] * plane[hh * width + ww];
+      }
+    }
+    scale[index] = 1 + alpha_over_size * accum_scale;
+  }
+}
+
+template <typename Dtype>
+void LRNLayer<Dtype>::WithinChannelForward_gpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const Dtype* bottom_data = bottom[0]->gpu_data();
+  Dtype* top_data = top[0]->mutable_gpu_data();
+  Dtype* scale_data = scale_.mutable_gpu_data();
+  const int n_threads = bottom[0]->count();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  LRNWithinChannelFillScale<<<CAFFE_GET_BLOCKS(n_threads),
+      CAFFE_CUDA_NUM_THREADS>>>(n_threads, bottom_data, height_, width_,
+      size_, alpha_ / (size_ * size_), scale_data);
+  CUDA_POST_KERNEL_CHECK;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  LRNComputeOutput<<<CAFFE_GET_BLOCKS(n_threads), CAFFE_CUDA_NUM_THREADS>>>(
+      n_threads, bottom_data, scale_data, -beta_, top_data);
+  CUDA_POST_KERNEL_CHECK;
+}
+template void LRNLayer<float>::WithinChannelForward_gpu(
+    const vector<Blob<float>*>& bottom, const vector<Blob<float>*>& top);
+template void LRNLayer<double>::WithinChannelForward_gpu(
+    const vector<Blob<double>*>& bottom, const vector<Blob<double>*>& top);
+
 
 template <typename Dtype>
 void LRNLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
@@ -112,7 +159,7 @@ void LRNLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     CrossChannelBackward_gpu(top, propagate_down, bottom);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
-    WithinChannelBackward(top, propagate_down, bottom);
+    WithinChannelBackward_gpu(top, propagate_down, bottom);
     break;
   default:
     LOG(FATAL) << "Unknown normalization region.";
@@ -196,6 +243,62 @@ template void LRNLayer<double>::CrossChannelBackward_gpu(
     const vector<Blob<double>*>& top, const vector<bool>& propagate_down,
     const vector<Blob<double>*>& bottom);
 
+// Takes the ratios diff_i * y_i / s_i precomputed in ratio, and sums them
+// over the window of each input, which is symmetric.
+template <typename Dtype>
+__global__ void LRNWithinChannelComputeDiff(const int nthreads,
+    const Dtype* const bottom_data, const Dtype* const scale,
+    const Dtype* const top_diff, const Dtype* const ratio, const int height,
+    const int width, const int size, const Dtype negative_beta,
+    const Dtype cache_ratio, Dtype* const bottom_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int w = index % width;
+    const int h = (index / width) % height;
+    const Dtype* const plane_ratio = ratio + (index - h * width - w);
+    const int pre_pad = (size - 1) / 2;
+    const int hstart = max(h - pre_pad, 0);
+    const int wstart = max(w - pre_pad, 0);
+    const int hend = min(h + pre_pad + 1, height);
+    const int wend = min(w + pre_pad + 1, width);
+    Dtype accum_ratio = 0;
+    for (int hh = hstart; hh < hend; ++hh) {
+      for (int ww = wstart; ww < wend; ++ww) {
+        accum_ratio += plane_ratio[hh * width + ww];
+      }
+    }
+    bottom_diff[index] = top_diff[index] * pow(scale[index], negative_beta)
+        - cache_ratio * bottom_data[index] * accum_ratio;
+  }
+}
+
+template <typename Dtype>
+void LRNLayer<Dtype>::WithinChannelBackward_gpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) {
+    return;
+  }
+  const int n_threads = bottom[0]->count();
+  // The diff of scale_ holds the ratios.
+  Dtype* ratio = scale_.mutable_gpu_diff();
+  caffe_gpu_mul<Dtype>(n_threads, top[0]->gpu_diff(), top[0]->gpu_data(),
+      ratio);
+  caffe_gpu_div<Dtype>(n_threads, ratio, scale_.gpu_data(), ratio);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  LRNWithinChannelComputeDiff<<<CAFFE_GET_BLOCKS(n_threads),
+      CAFFE_CUDA_NUM_THREADS>>>(n_threads, bottom[0]->gpu_data(),
+      scale_.gpu_data(), top[0]->gpu_diff(), ratio, height_, width_, size_,
+      -beta_, Dtype(2. * alpha_ * beta_ / (size_ * size_)),
+      bottom[0]->mutable_gpu_diff());
+  CUDA_POST_KERNEL_CHECK;
+}
+template void LRNLayer<float>::WithinChannelBackward_gpu(
+    const vector<Blob<float>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<float>*>& bottom);
+template void LRNLayer<double>::WithinChannelBackward_gpu(
+    const vector<Blob<double>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<double>*>& bottom);
+
 
 
 INSTANTIATE_LAYER_GPU_FUNCS(LRNLayer);
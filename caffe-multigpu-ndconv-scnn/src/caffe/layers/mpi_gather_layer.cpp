@@ -28,21 +28,32 @@ void MPIGatherLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void MPIGatherLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
+  WaitForCommunication();
+  requests_.resize(bottom.size());
   for (int i = 0; i < bottom.size(); ++i) {
-    MPIGather<Dtype>(bottom[i]->count(), bottom[i]->cpu_data(),
-        top[i]->mutable_cpu_data());
+    MPIIgather<Dtype>(bottom[i]->count(), bottom[i]->cpu_data(),
+        top[i]->mutable_cpu_data(), &requests_[i]);
   }
 }
 
 template <typename Dtype>
 void MPIGatherLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  WaitForCommunication();
+  requests_.resize(bottom.size());
   for (int i = 0; i < bottom.size(); ++i) {
-    MPIScatter<Dtype>(bottom[i]->count(), top[i]->cpu_diff(),
-        bottom[i]->mutable_cpu_diff());
+    MPIIscatter<Dtype>(bottom[i]->count(), top[i]->cpu_diff(),
+        bottom[i]->mutable_cpu_diff(), &requests_[i]);
   }
 }
 
+template <typename Dtype>
+void MPIGatherLayer<Dtype>::WaitForCommunication() {
+  if (requests_.empty()) return;
+  MPI_Waitall(requests_.size(), &requests_[0], MPI_STATUSES_IGNORE);
+  requests_.clear();
+}
+
 INSTANTIATE_CLASS(MPIGatherLayer);
 REGISTER_LAYER_CLASS(MPIGather);
 
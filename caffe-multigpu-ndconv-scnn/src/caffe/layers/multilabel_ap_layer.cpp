@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/loss_layers.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/mpi_templates.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void MultiLabelAPLayer<Dtype>::LayerSetUp(
+  const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const MultiLabelAPParameter& param = this->layer_param_.multilabel_ap_param();
+  num_bins_ = param.num_bins();
+  CHECK_GT(num_bins_, 0) << "num_bins must be positive.";
+  apply_sigmoid_ = param.apply_sigmoid();
+  has_ignore_label_ = param.has_ignore_label();
+  if (has_ignore_label_) {
+    ignore_label_ = param.ignore_label();
+  }
+  num_labels_ = 0;
+}
+
+template <typename Dtype>
+void MultiLabelAPLayer<Dtype>::Reshape(
+  const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  CHECK_EQ(bottom[0]->count(), bottom[1]->count())
+      << "There must be one label per score.";
+  const int num_labels = bottom[0]->count(1);
+  if (num_labels != num_labels_) {
+    num_labels_ = num_labels;
+    vector<int> histograms_shape(3);
+    histograms_shape[0] = 2;
+    histograms_shape[1] = num_labels_;
+    histograms_shape[2] = num_bins_;
+    histograms_.Reshape(histograms_shape);
+    ResetStatistics();
+  }
+}
+
+template <typename Dtype>
+void MultiLabelAPLayer<Dtype>::ResetStatistics() {
+  caffe_set(histograms_.count(), Dtype(0), histograms_.mutable_cpu_data());
+}
+
+#ifdef USE_MPI
+template <typename Dtype>
+void MultiLabelAPLayer<Dtype>::ReduceStatistics() {
+  MPIAllreduce<Dtype>(histograms_.count(), MPI_IN_PLACE,
+      histograms_.mutable_cpu_data(), MPI_SUM);
+}
+#endif
+
+template <typename Dtype>
+void MultiLabelAPLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  const Dtype* score = bottom[0]->cpu_data();
+  const Dtype* label = bottom[1]->cpu_data();
+  Dtype* negatives = histograms_.mutable_cpu_data();
+  Dtype* positives = negatives + num_labels_ * num_bins_;
+  const int num = bottom[0]->shape(0);
+  for (int i = 0; i < num; ++i) {
+    for (int j = 0; j < num_labels_; ++j) {
+      const int index = i * num_labels_ + j;
+      const int label_value = static_cast<int>(label[index]);
+      if (has_ignore_label_ && label_value == ignore_label_) {
+        continue;
+      }
+      DCHECK(label_value == 0 || label_value == 1);
+      Dtype probability = score[index];
+      if (apply_sigmoid_) {
+        probability = 1. / (1. + exp(-probability));
+      }
+      const int bin = std::min(std::max(
+          static_cast<int>(probability * num_bins_), 0), num_bins_ - 1);
+      Dtype* histogram = label_value ? positives : negatives;
+      histogram[j * num_bins_ + bin] += 1;
+    }
+  }
+}
+
+template <typename Dtype>
+Dtype MultiLabelAPLayer<Dtype>::ComputeAP(vector<Dtype>* ap) const {
+  const Dtype* negatives = histograms_.cpu_data();
+  const Dtype* positives = negatives + num_labels_ * num_bins_;
+  ap->assign(num_labels_, Dtype(-1));
+  Dtype ap_sum = 0;
+  int num_valid_labels = 0;
+  for (int j = 0; j < num_labels_; ++j) {
+    const Dtype* label_positives = positives + j * num_bins_;
+    const Dtype* label_negatives = negatives + j * num_bins_;
+    // Walk down the scores, each bin adding its recall times the precision
+    // of all the instances scoring at least as high.
+    double num_positives = 0;
+    for (int b = 0; b < num_bins_; ++b) {
+      num_positives += label_positives[b];
+    }
+    if (num_positives == 0) { continue; }
+    double true_positives = 0;
+    double false_positives = 0;
+    double precision_sum = 0;
+    for (int b = num_bins_ - 1; b >= 0; --b) {
+      if (label_positives[b] == 0) {
+        false_positives += label_negatives[b];
+        continue;
+      }
+      true_positives += label_positives[b];
+      false_positives += label_negatives[b];
+      precision_sum += label_positives[b] * true_positives /
+          (true_positives + false_positives);
+    }
+    (*ap)[j] = precision_sum / num_positives;
+    ap_sum += (*ap)[j];
+    ++num_valid_labels;
+  }
+  return num_valid_labels ? ap_sum / num_valid_labels : Dtype(0);
+}
+
+INSTANTIATE_CLASS(MultiLabelAPLayer);
+REGISTER_LAYER_CLASS(MultiLabelAP);
+
+}  // namespace caffe
@@ -30,15 +30,30 @@ void PowerLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     return;
   }
   const Dtype* bottom_data = bottom[0]->cpu_data();
-  caffe_copy(count, bottom_data, top_data);
-  if (scale_ != Dtype(1)) {
-    caffe_scal(count, scale_, top_data);
-  }
-  if (shift_ != Dtype(0)) {
-    caffe_add_scalar(count, shift_, top_data);
-  }
-  if (power_ != Dtype(1)) {
-    caffe_powx(count, top_data, power_, top_data);
+  const Dtype power = power_, scale = scale_, shift = shift_;
+  // A single pass over the data, with the common powers kept free of pow.
+  if (power == Dtype(1)) {
+#ifdef _OPENMP
+    #pragma omp parallel for simd if (count > kNeuronGrain) schedule(static)
+#endif
+    for (int i = 0; i < count; ++i) {
+      top_data[i] = shift + scale * bottom_data[i];
+    }
+  } else if (power == Dtype(2)) {
+#ifdef _OPENMP
+    #pragma omp parallel for simd if (count > kNeuronGrain) schedule(static)
+#endif
+    for (int i = 0; i < count; ++i) {
+      const Dtype x = shift + scale * bottom_data[i];
+      top_data[i] = x * x;
+    }
+  } else {
+#ifdef _OPENMP
+    #pragma omp parallel for if (count > kNeuronGrain) schedule(static)
+#endif
+    for (int i = 0; i < count; ++i) {
+      top_data[i] = pow(shift + scale * bottom_data[i], power);
+    }
   }
 }
 
@@ -46,50 +61,60 @@ template <typename Dtype>
 void PowerLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
-  if (propagate_down[0]) {
-    Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-    const int count = bottom[0]->count();
-    const Dtype* top_diff = top[0]->cpu_diff();
-    if (diff_scale_ == Dtype(0) || power_ == Dtype(1)) {
-      caffe_set(count, diff_scale_, bottom_diff);
-    } else {
-      const Dtype* bottom_data = bottom[0]->cpu_data();
-      // Compute dy/dx = scale * power * (shift + scale * x)^(power - 1)
-      //               = diff_scale * y / (shift + scale * x)
-      if (power_ == Dtype(2)) {
-        // Special case for y = (shift + scale * x)^2
-        //     -> dy/dx = 2 * scale * (shift + scale * x)
-        //              = diff_scale * shift + diff_scale * scale * x
-        caffe_cpu_axpby(count, diff_scale_ * scale_, bottom_data,
-            Dtype(0), bottom_diff);
-        if (shift_ != Dtype(0)) {
-          caffe_add_scalar(count, diff_scale_ * shift_, bottom_diff);
-        }
-      } else if (shift_ == Dtype(0)) {
-        // Special case for y = (scale * x)^power
-        //     -> dy/dx = scale * power * (scale * x)^(power - 1)
-        //              = scale * power * (scale * x)^power * (scale * x)^(-1)
-        //              = power * y / x
-        const Dtype* top_data = top[0]->cpu_data();
-        caffe_div(count, top_data, bottom_data, bottom_diff);
-        caffe_scal(count, power_, bottom_diff);
-      } else {
-        caffe_copy(count, bottom_data, bottom_diff);
-        if (scale_ != Dtype(1)) {
-          caffe_scal(count, scale_, bottom_diff);
-        }
-        if (shift_ != Dtype(0)) {
-          caffe_add_scalar(count, shift_, bottom_diff);
-        }
-        const Dtype* top_data = top[0]->cpu_data();
-        caffe_div<Dtype>(count, top_data, bottom_diff, bottom_diff);
-        if (diff_scale_ != Dtype(1)) {
-          caffe_scal(count, diff_scale_, bottom_diff);
-        }
-      }
+  if (!propagate_down[0]) {
+    return;
+  }
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  const int count = bottom[0]->count();
+  const Dtype* top_diff = top[0]->cpu_diff();
+  if (diff_scale_ == Dtype(0)) {
+    caffe_set(count, Dtype(0), bottom_diff);
+    return;
+  }
+  const Dtype diff_scale = diff_scale_, power = power_, scale = scale_,
+      shift = shift_;
+  if (power == Dtype(1)) {
+#ifdef _OPENMP
+    #pragma omp parallel for simd if (count > kNeuronGrain) schedule(static)
+#endif
+    for (int i = 0; i < count; ++i) {
+      bottom_diff[i] = diff_scale * top_diff[i];
     }
-    if (diff_scale_ != Dtype(0)) {
-      caffe_mul(count, top_diff, bottom_diff, bottom_diff);
+    return;
+  }
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  const Dtype* top_data = top[0]->cpu_data();
+  // Compute dy/dx = scale * power * (shift + scale * x)^(power - 1)
+  //               = diff_scale * y / (shift + scale * x)
+  if (power == Dtype(2)) {
+    // Special case for y = (shift + scale * x)^2
+    //     -> dy/dx = 2 * scale * (shift + scale * x)
+    //              = diff_scale * shift + diff_scale * scale * x
+#ifdef _OPENMP
+    #pragma omp parallel for simd if (count > kNeuronGrain) schedule(static)
+#endif
+    for (int i = 0; i < count; ++i) {
+      bottom_diff[i] = top_diff[i] *
+          (diff_scale * scale * bottom_data[i] + diff_scale * shift);
+    }
+  } else if (shift == Dtype(0)) {
+    // Special case for y = (scale * x)^power
+    //     -> dy/dx = scale * power * (scale * x)^(power - 1)
+    //              = scale * power * (scale * x)^power * (scale * x)^(-1)
+    //              = power * y / x
+#ifdef _OPENMP
+    #pragma omp parallel for simd if (count > kNeuronGrain) schedule(static)
+#endif
+    for (int i = 0; i < count; ++i) {
+      bottom_diff[i] = top_diff[i] * (power * top_data[i] / bottom_data[i]);
+    }
+  } else {
+#ifdef _OPENMP
+    #pragma omp parallel for simd if (count > kNeuronGrain) schedule(static)
+#endif
+    for (int i = 0; i < count; ++i) {
+      bottom_diff[i] = top_diff[i] * (diff_scale * top_data[i] /
+          (shift + scale * bottom_data[i]));
     }
   }
 }
@@ -80,10 +80,23 @@ void PReLULayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   // if channel_shared, channel index in the following computation becomes
   // always zero.
   const int div_factor = channel_shared_ ? channels : 1;
-  for (int i = 0; i < count; ++i) {
-    int c = (i / dim) % channels / div_factor;
-    top_data[i] = std::max(bottom_data[i], Dtype(0))
-        + slope_data[c] * std::min(bottom_data[i], Dtype(0));
+  // Each (num, channel) plane has a single slope, so the inner loop is free
+  // of the index arithmetic.
+  const int num_planes = bottom[0]->count(0, 2);
+#ifdef _OPENMP
+  #pragma omp parallel for if (count > kNeuronGrain) schedule(static)
+#endif
+  for (int plane = 0; plane < num_planes; ++plane) {
+    const Dtype slope = slope_data[plane % channels / div_factor];
+    const Dtype* plane_bottom = bottom_data + plane * dim;
+    Dtype* plane_top = top_data + plane * dim;
+#ifdef _OPENMP
+    #pragma omp simd
+#endif
+    for (int i = 0; i < dim; ++i) {
+      const Dtype x = plane_bottom[i];
+      plane_top[i] = std::max(x, Dtype(0)) + slope * std::min(x, Dtype(0));
+    }
   }
 }
 
@@ -97,39 +110,63 @@ void PReLULayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   const int count = bottom[0]->count();
   const int dim = bottom[0]->count(2);
   const int channels = bottom[0]->channels();
+  const int num = bottom[0]->shape(0);
 
   // For in-place computation
   if (top[0] == bottom[0]) {
     bottom_data = bottom_memory_.cpu_data();
   }
 
-  // if channel_shared, channel index in the following computation becomes
-  // always zero.
-  const int div_factor = channel_shared_ ? channels : 1;
-
   // Propagte to param
   // Since to write bottom diff will affect top diff if top and bottom blobs
   // are identical (in-place computaion), we first compute param backward to
   // keep top_diff unchanged.
   if (this->param_propagate_down_[0]) {
+    // Each channel is summed by a single thread into backward_buff_, then the
+    // sums are added to the slope diffs.
+    Dtype* channel_diff = backward_buff_.mutable_cpu_data();
+#ifdef _OPENMP
+    #pragma omp parallel for if (count > kNeuronGrain) schedule(static)
+#endif
+    for (int c = 0; c < channels; ++c) {
+      Dtype sum = 0;
+      for (int n = 0; n < num; ++n) {
+        const int offset = (n * channels + c) * dim;
+#ifdef _OPENMP
+        #pragma omp simd reduction(+:sum)
+#endif
+        for (int i = 0; i < dim; ++i) {
+          const Dtype x = bottom_data[offset + i];
+          sum += top_diff[offset + i] * std::min(x, Dtype(0));
+        }
+      }
+      channel_diff[c] = sum;
+    }
     Dtype* slope_diff = this->blobs_[0]->mutable_cpu_diff();
-    for (int i = 0; i < count; ++i) {
-      int c = (i / dim) % channels / div_factor;
-      slope_diff[c] += top_diff[i] * bottom_data[i] * (bottom_data[i] <= 0);
+    for (int c = 0; c < channels; ++c) {
+      slope_diff[channel_shared_ ? 0 : c] += channel_diff[c];
     }
   }
   // Propagate to bottom
   if (propagate_down[0]) {
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-    for (int i = 0; i < count; ++i) {
-      int c = (i / dim) % channels / div_factor;
-      bottom_diff[i] = top_diff[i] * ((bottom_data[i] > 0)
-          + slope_data[c] * (bottom_data[i] <= 0));
+    const int div_factor = channel_shared_ ? channels : 1;
+    const int num_planes = bottom[0]->count(0, 2);
+#ifdef _OPENMP
+    #pragma omp parallel for if (count > kNeuronGrain) schedule(static)
+#endif
+    for (int plane = 0; plane < num_planes; ++plane) {
+      const Dtype slope = slope_data[plane % channels / div_factor];
+      const int offset = plane * dim;
+      for (int i = 0; i < dim; ++i) {
+        const Dtype x = bottom_data[offset + i];
+        bottom_diff[offset + i] = top_diff[offset + i] * ((x > 0)
+            + slope * (x <= 0));
+      }
     }
   }
 }
 
-
 #ifdef CPU_ONLY
 STUB_GPU(PReLULayer);
 #endif
@@ -6,17 +6,35 @@
 
 namespace caffe {
 
+// Computes out = max(in, 0) + negative_slope * min(in, 0); in may be out.
+template <typename Dtype>
+static void ReLUForward(const int count, const Dtype* in, Dtype* out,
+    const Dtype negative_slope) {
+#ifdef _OPENMP
+  #pragma omp parallel for simd if (count > kNeuronGrain) schedule(static)
+#endif
+  for (int i = 0; i < count; ++i) {
+    // A local copy, as max and min of in[i] itself do not vectorize.
+    const Dtype x = in[i];
+    out[i] = std::max(x, Dtype(0)) + negative_slope * std::min(x, Dtype(0));
+  }
+}
+
 template <typename Dtype>
 void ReLULayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* top_data = top[0]->mutable_cpu_data();
-  const int count = bottom[0]->count();
-  Dtype negative_slope = this->layer_param_.relu_param().negative_slope();
-  for (int i = 0; i < count; ++i) {
-    top_data[i] = std::max(bottom_data[i], Dtype(0))
-        + negative_slope * std::min(bottom_data[i], Dtype(0));
+  if (this->fused_) {
+    return;
   }
+  ReLUForward(bottom[0]->count(), bottom[0]->cpu_data(),
+      top[0]->mutable_cpu_data(),
+      Dtype(this->layer_param_.relu_param().negative_slope()));
+}
+
+template <typename Dtype>
+void ReLULayer<Dtype>::Activate_cpu(const int count, Dtype* data) {
+  ReLUForward(count, data, data,
+      Dtype(this->layer_param_.relu_param().negative_slope()));
 }
 
 template <typename Dtype>
@@ -29,6 +47,9 @@ void ReLULayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int count = bottom[0]->count();
     Dtype negative_slope = this->layer_param_.relu_param().negative_slope();
+#ifdef _OPENMP
+    #pragma omp parallel for if (count > kNeuronGrain) schedule(static)
+#endif
     for (int i = 0; i < count; ++i) {
       bottom_diff[i] = top_diff[i] * ((bottom_data[i] > 0)
           + negative_slope * (bottom_data[i] <= 0));
@@ -39,6 +60,7 @@ void ReLULayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
 
 #ifdef CPU_ONLY
 STUB_GPU(ReLULayer);
+STUB_GPU_ACTIVATE(ReLULayer);
 #endif
 
 INSTANTIATE_CLASS(ReLULayer);
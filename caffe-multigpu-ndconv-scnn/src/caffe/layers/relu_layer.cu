@@ -17,6 +17,9 @@ __global__ void ReLUForward(const int n, const Dtype* in, Dtype* out,
 template <typename Dtype>
 void ReLULayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
+  if (this->fused_) {
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->gpu_data();
   Dtype* top_data = top[0]->mutable_gpu_data();
   const int count = bottom[0]->count();
@@ -59,7 +62,18 @@ void ReLULayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
 }
 
 
+template <typename Dtype>
+void ReLULayer<Dtype>::Activate_gpu(const int count, Dtype* data) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  ReLUForward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
+      count, data, data,
+      Dtype(this->layer_param_.relu_param().negative_slope()));
+  CUDA_POST_KERNEL_CHECK;
+}
+
 INSTANTIATE_LAYER_GPU_FUNCS(ReLULayer);
+template void ReLULayer<float>::Activate_gpu(const int count, float* data);
+template void ReLULayer<double>::Activate_gpu(const int count, double* data);
 
 
 }  // namespace caffe
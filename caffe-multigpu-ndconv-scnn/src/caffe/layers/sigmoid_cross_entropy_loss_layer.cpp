@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <cfloat>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layer.hpp"
@@ -12,11 +13,11 @@ template <typename Dtype>
 void SigmoidCrossEntropyLossLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   LossLayer<Dtype>::LayerSetUp(bottom, top);
-  sigmoid_bottom_vec_.clear();
-  sigmoid_bottom_vec_.push_back(bottom[0]);
-  sigmoid_top_vec_.clear();
-  sigmoid_top_vec_.push_back(sigmoid_output_.get());
-  sigmoid_layer_->SetUp(sigmoid_bottom_vec_, sigmoid_top_vec_);
+  has_ignore_label_ =
+    this->layer_param_.loss_param().has_ignore_label();
+  if (has_ignore_label_) {
+    ignore_label_ = this->layer_param_.loss_param().ignore_label();
+  }
 }
 
 template <typename Dtype>
@@ -25,25 +26,52 @@ void SigmoidCrossEntropyLossLayer<Dtype>::Reshape(
   LossLayer<Dtype>::Reshape(bottom, top);
   CHECK_EQ(bottom[0]->count(), bottom[1]->count()) <<
       "SIGMOID_CROSS_ENTROPY_LOSS layer inputs must have the same count.";
-  sigmoid_layer_->Reshape(sigmoid_bottom_vec_, sigmoid_top_vec_);
+  sigmoid_output_->ReshapeLike(*bottom[0]);
+  // Expand the positive weights to one per output of an instance.
+  const SigmoidCrossEntropyLossParameter& param =
+      this->layer_param_.sigmoid_cross_entropy_loss_param();
+  const int dim = bottom[0]->count(1);
+  pos_weight_.Reshape(vector<int>(1, dim));
+  Dtype* pos_weight = pos_weight_.mutable_cpu_data();
+  if (param.pos_weight_size() <= 1) {
+    caffe_set(dim, Dtype(param.pos_weight_size() ? param.pos_weight(0) : 1),
+        pos_weight);
+  } else {
+    CHECK_EQ(param.pos_weight_size(), dim)
+        << "pos_weight must be given once, or once per output of an instance.";
+    for (int i = 0; i < dim; ++i) {
+      pos_weight[i] = param.pos_weight(i);
+    }
+  }
 }
 
 template <typename Dtype>
 void SigmoidCrossEntropyLossLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  // The forward pass computes the sigmoid outputs.
-  sigmoid_bottom_vec_[0] = bottom[0];
-  sigmoid_layer_->Forward(sigmoid_bottom_vec_, sigmoid_top_vec_);
-  // Compute the loss (negative log likelihood)
-  const int count = bottom[0]->count();
-  const int num = bottom[0]->num();
-  // Stable version of loss computation from input data
+  const int num = bottom[0]->shape(0);
+  const int dim = bottom[0]->count(1);
   const Dtype* input_data = bottom[0]->cpu_data();
   const Dtype* target = bottom[1]->cpu_data();
+  const Dtype* pos_weight = pos_weight_.cpu_data();
+  Dtype* sigmoid_output_data =
+      sigmoid_output_->mutable_cpu_data_for_overwrite();
   Dtype loss = 0;
-  for (int i = 0; i < count; ++i) {
-    loss -= input_data[i] * (target[i] - (input_data[i] >= 0)) -
-        log(1 + exp(input_data[i] - 2 * input_data[i] * (input_data[i] >= 0)));
+  for (int n = 0; n < num; ++n) {
+    const Dtype* x = input_data + n * dim;
+    const Dtype* y = target + n * dim;
+    Dtype* p = sigmoid_output_data + n * dim;
+    // The sigmoid and the loss share one exp per element in a single pass.
+    // With e = exp(-|x|), -log(sigmoid(x)) = max(-x, 0) + log(1 + e), and
+    // -log(1 - sigmoid(x)) = max(x, 0) + log(1 + e).
+    for (int i = 0; i < dim; ++i) {
+      const Dtype e = exp(-std::abs(x[i]));
+      const Dtype log_term = log(1 + e);
+      const Dtype inv = 1 / (1 + e);
+      p[i] = x[i] >= 0 ? inv : e * inv;
+      const Dtype valid = !has_ignore_label_ || y[i] != ignore_label_;
+      loss += valid * (pos_weight[i] * y[i] * (std::max(-x[i], Dtype(0)) +
+          log_term) + (1 - y[i]) * (std::max(x[i], Dtype(0)) + log_term));
+    }
   }
   top[0]->mutable_cpu_data()[0] = loss / num;
 }
@@ -57,16 +85,27 @@ void SigmoidCrossEntropyLossLayer<Dtype>::Backward_cpu(
                << " Layer cannot backpropagate to label inputs.";
   }
   if (propagate_down[0]) {
-    // First, compute the diff
-    const int count = bottom[0]->count();
-    const int num = bottom[0]->num();
+    const int num = bottom[0]->shape(0);
+    const int dim = bottom[0]->count(1);
     const Dtype* sigmoid_output_data = sigmoid_output_->cpu_data();
     const Dtype* target = bottom[1]->cpu_data();
+    const Dtype* pos_weight = pos_weight_.cpu_data();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-    caffe_sub(count, sigmoid_output_data, target, bottom_diff);
     // Scale down gradient
-    const Dtype loss_weight = top[0]->cpu_diff()[0];
-    caffe_scal(count, loss_weight / num, bottom_diff);
+    const Dtype scale = top[0]->cpu_diff()[0] / num;
+    for (int n = 0; n < num; ++n) {
+      const Dtype* p = sigmoid_output_data + n * dim;
+      const Dtype* y = target + n * dim;
+      Dtype* diff = bottom_diff + n * dim;
+      // The gradient is p - y when the positive weight w is 1, and
+      // p * (w * y + 1 - y) - w * y in general.
+      for (int i = 0; i < dim; ++i) {
+        const Dtype weighted_target = pos_weight[i] * y[i];
+        const Dtype valid = !has_ignore_label_ || y[i] != ignore_label_;
+        diff[i] = scale * valid *
+            (p[i] * (weighted_target + 1 - y[i]) - weighted_target);
+      }
+    }
   }
 }
 
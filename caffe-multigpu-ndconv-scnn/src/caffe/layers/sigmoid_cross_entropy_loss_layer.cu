@@ -8,6 +8,20 @@
 
 namespace caffe {
 
+template <typename Dtype>
+__global__ void SigmoidCrossEntropyLossBackwardGPU(const int nthreads,
+    const Dtype* sigmoid_output, const Dtype* target, const Dtype* pos_weight,
+    const int dim, const bool has_ignore_label, const Dtype ignore_label,
+    const Dtype scale, Dtype* bottom_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const Dtype y = target[index];
+    const Dtype weighted_target = pos_weight[index % dim] * y;
+    const Dtype valid = !has_ignore_label || y != ignore_label;
+    bottom_diff[index] = scale * valid *
+        (sigmoid_output[index] * (weighted_target + 1 - y) - weighted_target);
+  }
+}
+
 template <typename Dtype>
 void SigmoidCrossEntropyLossLayer<Dtype>::Backward_gpu(
     const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
@@ -17,17 +31,19 @@ void SigmoidCrossEntropyLossLayer<Dtype>::Backward_gpu(
                << " Layer cannot backpropagate to label inputs.";
   }
   if (propagate_down[0]) {
-    // First, compute the diff
     const int count = bottom[0]->count();
-    const int num = bottom[0]->num();
+    const int num = bottom[0]->shape(0);
     const Dtype* sigmoid_output_data = sigmoid_output_->gpu_data();
     const Dtype* target = bottom[1]->gpu_data();
     Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
-    caffe_copy(count, sigmoid_output_data, bottom_diff);
-    caffe_gpu_axpy(count, Dtype(-1), target, bottom_diff);
     // Scale down gradient
-    const Dtype loss_weight = top[0]->cpu_diff()[0];
-    caffe_gpu_scal(count, loss_weight / num, bottom_diff);
+    const Dtype scale = top[0]->cpu_diff()[0] / num;
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    SigmoidCrossEntropyLossBackwardGPU<Dtype><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS>>>(count, sigmoid_output_data, target,
+        pos_weight_.gpu_data(), pos_weight_.count(), has_ignore_label_,
+        Dtype(ignore_label_), scale, bottom_diff);
+    CUDA_POST_KERNEL_CHECK;
   }
 }
 
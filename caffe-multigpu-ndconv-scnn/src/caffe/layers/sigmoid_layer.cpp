@@ -12,15 +12,30 @@ inline Dtype sigmoid(Dtype x) {
   return 1. / (1. + exp(-x));
 }
 
+// Computes out = sigmoid(in); in may be out.
+template <typename Dtype>
+static void SigmoidForward(const int count, const Dtype* in, Dtype* out) {
+#ifdef _OPENMP
+  #pragma omp parallel for if (count > kNeuronGrain) schedule(static)
+#endif
+  for (int i = 0; i < count; ++i) {
+    out[i] = sigmoid(in[i]);
+  }
+}
+
 template <typename Dtype>
 void SigmoidLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* top_data = top[0]->mutable_cpu_data();
-  const int count = bottom[0]->count();
-  for (int i = 0; i < count; ++i) {
-    top_data[i] = sigmoid(bottom_data[i]);
+  if (this->fused_) {
+    return;
   }
+  SigmoidForward(bottom[0]->count(), bottom[0]->cpu_data(),
+      top[0]->mutable_cpu_data());
+}
+
+template <typename Dtype>
+void SigmoidLayer<Dtype>::Activate_cpu(const int count, Dtype* data) {
+  SigmoidForward(count, data, data);
 }
 
 template <typename Dtype>
@@ -32,6 +47,9 @@ void SigmoidLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int count = bottom[0]->count();
+#ifdef _OPENMP
+    #pragma omp parallel for simd if (count > kNeuronGrain) schedule(static)
+#endif
     for (int i = 0; i < count; ++i) {
       const Dtype sigmoid_x = top_data[i];
       bottom_diff[i] = top_diff[i] * sigmoid_x * (1. - sigmoid_x);
@@ -41,6 +59,7 @@ void SigmoidLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
 
 #ifdef CPU_ONLY
 STUB_GPU(SigmoidLayer);
+STUB_GPU_ACTIVATE(SigmoidLayer);
 #endif
 
 INSTANTIATE_CLASS(SigmoidLayer);
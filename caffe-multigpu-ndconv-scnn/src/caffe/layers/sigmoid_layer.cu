@@ -17,6 +17,9 @@ __global__ void SigmoidForward(const int n, const Dtype* in, Dtype* out) {
 template <typename Dtype>
 void SigmoidLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
+  if (this->fused_) {
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->gpu_data();
   Dtype* top_data = top[0]->mutable_gpu_data();
   const int count = bottom[0]->count();
@@ -56,7 +59,17 @@ void SigmoidLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   }
 }
 
+template <typename Dtype>
+void SigmoidLayer<Dtype>::Activate_gpu(const int count, Dtype* data) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  SigmoidForward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
+      count, data, data);
+  CUDA_POST_KERNEL_CHECK;
+}
+
 INSTANTIATE_LAYER_GPU_FUNCS(SigmoidLayer);
+template void SigmoidLayer<float>::Activate_gpu(const int count, float* data);
+template void SigmoidLayer<double>::Activate_gpu(const int count, double* data);
 
 
 }  // namespace caffe
@@ -4,7 +4,6 @@
 
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
-#include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
@@ -13,117 +12,90 @@ namespace caffe {
 using std::min;
 using std::max;
 
+// Inputs smaller than this pool their channels on a single thread.
+static const int kSPPGrain = 1 << 15;
+
 template <typename Dtype>
 LayerParameter SPPLayer<Dtype>::GetPoolingParam(const int pyramid_level,
-      const int bottom_h, const int bottom_w, const SPPParameter spp_param) {
+      const int bottom_h, const int bottom_w) {
   LayerParameter pooling_param;
-  int num_bins = pow(2, pyramid_level);
-
-  // find padding and kernel size so that the pooling is
-  // performed across the entire image
-  int kernel_h = ceil(bottom_h / static_cast<double>(num_bins));
-  // remainder_h is the min number of pixels that need to be padded before
-  // entire image height is pooled over with the chosen kernel dimension
-  int remainder_h = kernel_h * num_bins - bottom_h;
-  // pooling layer pads (2 * pad_h) pixels on the top and bottom of the
-  // image.
-  int pad_h = (remainder_h + 1) / 2;
-
-  // similar logic for width
-  int kernel_w = ceil(bottom_w / static_cast<double>(num_bins));
-  int remainder_w = kernel_w * num_bins - bottom_w;
-  int pad_w = (remainder_w + 1) / 2;
-
-  pooling_param.mutable_pooling_param()->set_pad_h(pad_h);
-  pooling_param.mutable_pooling_param()->set_pad_w(pad_w);
-  pooling_param.mutable_pooling_param()->set_kernel_h(kernel_h);
-  pooling_param.mutable_pooling_param()->set_kernel_w(kernel_w);
-  pooling_param.mutable_pooling_param()->set_stride_h(kernel_h);
-  pooling_param.mutable_pooling_param()->set_stride_w(kernel_w);
+  pooling_param.set_phase(this->phase_);
+  PoolingParameter* pool_param = pooling_param.mutable_pooling_param();
+  pool_param->set_pool(PoolingParameter_PoolMethod_STOCHASTIC);
+  // The windows of the single-pass levels: kernel and stride
+  // ceil(size / 2^l), padded so that the 2^l windows cover the image.
+  const int num_bins = 1 << pyramid_level;
+  const int kernel_h = (bottom_h + num_bins - 1) / num_bins;
+  const int kernel_w = (bottom_w + num_bins - 1) / num_bins;
+  pool_param->set_pad_h((kernel_h * num_bins - bottom_h + 1) / 2);
+  pool_param->set_pad_w((kernel_w * num_bins - bottom_w + 1) / 2);
+  pool_param->set_kernel_h(kernel_h);
+  pool_param->set_kernel_w(kernel_w);
+  pool_param->set_stride_h(kernel_h);
+  pool_param->set_stride_w(kernel_w);
+  return pooling_param;
+}
 
+template <typename Dtype>
+void SPPLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const SPPParameter& spp_param = this->layer_param_.spp_param();
+  pyramid_height_ = spp_param.pyramid_height();
+  CHECK_GT(pyramid_height_, 0) << "pyramid_height must be positive.";
   switch (spp_param.pool()) {
   case SPPParameter_PoolMethod_MAX:
-    pooling_param.mutable_pooling_param()->set_pool(
-        PoolingParameter_PoolMethod_MAX);
+    max_pool_ = true;
     break;
   case SPPParameter_PoolMethod_AVE:
-    pooling_param.mutable_pooling_param()->set_pool(
-        PoolingParameter_PoolMethod_AVE);
+    max_pool_ = false;
     break;
   case SPPParameter_PoolMethod_STOCHASTIC:
-    pooling_param.mutable_pooling_param()->set_pool(
-        PoolingParameter_PoolMethod_STOCHASTIC);
+    max_pool_ = false;
     break;
   default:
     LOG(FATAL) << "Unknown pooling method.";
   }
-
-  return pooling_param;
-}
-
-template <typename Dtype>
-void SPPLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top) {
-  SPPParameter spp_param = this->layer_param_.spp_param();
-
-  bottom_h_ = bottom[0]->height();
-  bottom_w_ = bottom[0]->width();
-  CHECK_GT(bottom_h_, 0) << "Input dimensions cannot be zero.";
-  CHECK_GT(bottom_w_, 0) << "Input dimensions cannot be zero.";
-
-  pyramid_height_ = spp_param.pyramid_height();
+  if (spp_param.pool() != SPPParameter_PoolMethod_STOCHASTIC) {
+    return;
+  }
+  CHECK_EQ(4, bottom[0]->num_axes()) << "STOCHASTIC input must have 4 axes, "
+      << "corresponding to (num, channels, height, width)";
+  internal_blobs_.clear();
   split_top_vec_.clear();
-  pooling_bottom_vecs_.clear();
+  pooling_bottom_vecs_.assign(pyramid_height_, vector<Blob<Dtype>*>());
   pooling_layers_.clear();
-  pooling_top_vecs_.clear();
-  pooling_outputs_.clear();
+  pooling_top_vecs_.assign(pyramid_height_, vector<Blob<Dtype>*>());
   flatten_layers_.clear();
-  flatten_top_vecs_.clear();
-  flatten_outputs_.clear();
+  flatten_top_vecs_.assign(pyramid_height_, vector<Blob<Dtype>*>());
   concat_bottom_vec_.clear();
-
-  // split layer output holders setup
-  for (int i = 0; i < pyramid_height_; i++) {
-    split_top_vec_.push_back(new Blob<Dtype>());
+  for (int i = 0; i < pyramid_height_ * 3; ++i) {
+    internal_blobs_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
   }
-
   // split layer setup
+  for (int i = 0; i < pyramid_height_; ++i) {
+    split_top_vec_.push_back(internal_blobs_[i].get());
+  }
   LayerParameter split_param;
   split_layer_.reset(new SplitLayer<Dtype>(split_param));
   split_layer_->SetUp(bottom, split_top_vec_);
-
-  for (int i = 0; i < pyramid_height_; i++) {
-    // pooling layer input holders setup
-    pooling_bottom_vecs_.push_back(new vector<Blob<Dtype>*>);
-    pooling_bottom_vecs_[i]->push_back(split_top_vec_[i]);
-
-    // pooling layer output holders setup
-    pooling_outputs_.push_back(new Blob<Dtype>());
-    pooling_top_vecs_.push_back(new vector<Blob<Dtype>*>);
-    pooling_top_vecs_[i]->push_back(pooling_outputs_[i]);
-
+  LayerParameter flatten_param;
+  for (int i = 0; i < pyramid_height_; ++i) {
     // pooling layer setup
-    LayerParameter pooling_param = GetPoolingParam(
-        i, bottom_h_, bottom_w_, spp_param);
-
-    pooling_layers_.push_back(shared_ptr<PoolingLayer<Dtype> > (
-        new PoolingLayer<Dtype>(pooling_param)));
-    pooling_layers_[i]->SetUp(*pooling_bottom_vecs_[i], *pooling_top_vecs_[i]);
-
-    // flatten layer output holders setup
-    flatten_outputs_.push_back(new Blob<Dtype>());
-    flatten_top_vecs_.push_back(new vector<Blob<Dtype>*>);
-    flatten_top_vecs_[i]->push_back(flatten_outputs_[i]);
-
+    pooling_bottom_vecs_[i].push_back(split_top_vec_[i]);
+    pooling_top_vecs_[i].push_back(
+        internal_blobs_[pyramid_height_ + i].get());
+    pooling_layers_.push_back(shared_ptr<PoolingLayer<Dtype> >(
+        new PoolingLayer<Dtype>(GetPoolingParam(i, bottom[0]->height(),
+        bottom[0]->width()))));
+    pooling_layers_[i]->SetUp(pooling_bottom_vecs_[i], pooling_top_vecs_[i]);
     // flatten layer setup
-    LayerParameter flatten_param;
-    flatten_layers_.push_back(new FlattenLayer<Dtype>(flatten_param));
-    flatten_layers_[i]->SetUp(*pooling_top_vecs_[i], *flatten_top_vecs_[i]);
-
-    // concat layer input holders setup
-    concat_bottom_vec_.push_back(flatten_outputs_[i]);
+    flatten_top_vecs_[i].push_back(
+        internal_blobs_[2 * pyramid_height_ + i].get());
+    flatten_layers_.push_back(shared_ptr<FlattenLayer<Dtype> >(
+        new FlattenLayer<Dtype>(flatten_param)));
+    flatten_layers_[i]->SetUp(pooling_top_vecs_[i], flatten_top_vecs_[i]);
+    concat_bottom_vec_.push_back(flatten_top_vecs_[i][0]);
   }
-
   // concat layer setup
   LayerParameter concat_param;
   concat_layer_.reset(new ConcatLayer<Dtype>(concat_param));
@@ -133,59 +105,270 @@ void SPPLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void SPPLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  CHECK_EQ(4, bottom[0]->num_axes()) << "Input must have 4 axes, "
-      << "corresponding to (num, channels, height, width)";
-  channels_ = bottom[0]->channels();
-  bottom_h_ = bottom[0]->height();
-  bottom_w_ = bottom[0]->width();
-  SPPParameter spp_param = this->layer_param_.spp_param();
-  split_layer_->Reshape(bottom, split_top_vec_);
-  for (int i = 0; i < pyramid_height_; i++) {
-    LayerParameter pooling_param = GetPoolingParam(
-        i, bottom_h_, bottom_w_, spp_param);
-
-    pooling_layers_[i].reset(
-        new PoolingLayer<Dtype>(pooling_param));
-    pooling_layers_[i]->SetUp(
-        *pooling_bottom_vecs_[i], *pooling_top_vecs_[i]);
-    pooling_layers_[i]->Reshape(
-        *pooling_bottom_vecs_[i], *pooling_top_vecs_[i]);
-    flatten_layers_[i]->Reshape(
-        *pooling_top_vecs_[i], *flatten_top_vecs_[i]);
-  }
-  concat_layer_->Reshape(concat_bottom_vec_, top);
+  if (split_layer_) {
+    CHECK_EQ(4, bottom[0]->num_axes()) << "STOCHASTIC input must have 4 axes, "
+        << "corresponding to (num, channels, height, width)";
+    split_layer_->Reshape(bottom, split_top_vec_);
+    for (int i = 0; i < pyramid_height_; ++i) {
+      pooling_layers_[i].reset(new PoolingLayer<Dtype>(
+          GetPoolingParam(i, bottom[0]->height(), bottom[0]->width())));
+      pooling_layers_[i]->SetUp(pooling_bottom_vecs_[i], pooling_top_vecs_[i]);
+      flatten_layers_[i]->Reshape(pooling_top_vecs_[i], flatten_top_vecs_[i]);
+    }
+    concat_layer_->Reshape(concat_bottom_vec_, top);
+    return;
+  }
+  CHECK_GE(bottom[0]->num_axes(), 3) << "Input must have at least one "
+      << "spatial axis after (num, channels)";
+  channels_ = bottom[0]->shape(1);
+  num_spatial_axes_ = bottom[0]->num_axes() - 2;
+  spatial_dim_ = bottom[0]->count(2);
+  CHECK_GT(spatial_dim_, 0) << "Input dimensions cannot be zero.";
+  inner_dim_ = bottom[0]->shape(-1);
+  const int outer_dim = spatial_dim_ / inner_dim_;
+  vector<int> shape(1, pyramid_height_ + 1);
+  level_offsets_.Reshape(shape);
+  shape.resize(3);
+  shape[0] = pyramid_height_;
+  shape[1] = num_spatial_axes_;
+  shape[2] = 2;
+  windows_.Reshape(shape);
+  shape.resize(2);
+  shape[1] = inner_dim_;
+  inner_bins_.Reshape(shape);
+  shape[1] = outer_dim;
+  outer_bins_.Reshape(shape);
+  int* level_offsets = level_offsets_.mutable_cpu_data();
+  int* windows = windows_.mutable_cpu_data();
+  level_offsets[0] = 0;
+  for (int l = 0; l < pyramid_height_; ++l) {
+    // Like a PoolingLayer with kernel and stride ceil(size / 2^l), padded so
+    // that the 2^l windows cover each axis.
+    const int num_bins = 1 << l;
+    int* level_windows = windows + l * num_spatial_axes_ * 2;
+    int level_bins = 1;
+    for (int d = 0; d < num_spatial_axes_; ++d) {
+      const int size = bottom[0]->shape(2 + d);
+      const int kernel = (size + num_bins - 1) / num_bins;
+      level_windows[2 * d] = kernel;
+      level_windows[2 * d + 1] = (kernel * num_bins - size + 1) / 2;
+      level_bins *= num_bins;
+    }
+    level_offsets[l + 1] = level_offsets[l] + level_bins;
+    // The bin of each position along the last axis, and of each position
+    // along the other axes, in the row-major order of the bins.
+    const int* inner_window = level_windows + 2 * (num_spatial_axes_ - 1);
+    int* inner_bins = inner_bins_.mutable_cpu_data() + l * inner_dim_;
+    for (int i = 0; i < inner_dim_; ++i) {
+      inner_bins[i] = (i + inner_window[1]) / inner_window[0];
+    }
+    int* outer_bins = outer_bins_.mutable_cpu_data() + l * outer_dim;
+    for (int o = 0; o < outer_dim; ++o) {
+      int index = o;
+      int bin = 0;
+      int bin_stride = num_bins;
+      for (int d = num_spatial_axes_ - 2; d >= 0; --d) {
+        const int size = bottom[0]->shape(2 + d);
+        bin += (index % size + level_windows[2 * d + 1]) /
+            level_windows[2 * d] * bin_stride;
+        index /= size;
+        bin_stride *= num_bins;
+      }
+      outer_bins[o] = bin;
+    }
+  }
+  const int pyramid_dim = level_offsets[pyramid_height_];
+  vector<int> top_shape(2);
+  top_shape[0] = bottom[0]->shape(0);
+  top_shape[1] = channels_ * pyramid_dim;
+  top[0]->Reshape(top_shape);
+  if (max_pool_) {
+    max_idx_.Reshape(top_shape);
+    return;
+  }
+  // The average counts the padding in its window, as PoolingLayer does.
+  bin_scales_.Reshape(vector<int>(1, pyramid_dim));
+  Dtype* bin_scales = bin_scales_.mutable_cpu_data();
+  for (int l = 0; l < pyramid_height_; ++l) {
+    const int num_bins = 1 << l;
+    const int* level_windows = windows + l * num_spatial_axes_ * 2;
+    for (int b = level_offsets[l]; b < level_offsets[l + 1]; ++b) {
+      int bin = b - level_offsets[l];
+      int pool_size = 1;
+      for (int d = num_spatial_axes_ - 1; d >= 0; --d) {
+        const int kernel = level_windows[2 * d];
+        const int pad = level_windows[2 * d + 1];
+        const int start = bin % num_bins * kernel - pad;
+        const int end = min(start + kernel, bottom[0]->shape(2 + d) + pad);
+        pool_size *= max(end - start, 0);
+        bin /= num_bins;
+      }
+      bin_scales[b] = pool_size > 0 ? Dtype(1) / pool_size : Dtype(0);
+    }
+  }
 }
 
 template <typename Dtype>
-void SPPLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+void SPPLayer<Dtype>::ForwardSubLayers(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   split_layer_->Forward(bottom, split_top_vec_);
-  for (int i = 0; i < pyramid_height_; i++) {
-    pooling_layers_[i]->Forward(
-        *pooling_bottom_vecs_[i], *pooling_top_vecs_[i]);
-    flatten_layers_[i]->Forward(
-        *pooling_top_vecs_[i], *flatten_top_vecs_[i]);
+  for (int i = 0; i < pyramid_height_; ++i) {
+    pooling_layers_[i]->Forward(pooling_bottom_vecs_[i], pooling_top_vecs_[i]);
+    flatten_layers_[i]->Forward(pooling_top_vecs_[i], flatten_top_vecs_[i]);
   }
   concat_layer_->Forward(concat_bottom_vec_, top);
 }
 
+template <typename Dtype>
+void SPPLayer<Dtype>::BackwardSubLayers(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  vector<bool> concat_propagate_down(pyramid_height_, true);
+  concat_layer_->Backward(top, concat_propagate_down, concat_bottom_vec_);
+  for (int i = 0; i < pyramid_height_; ++i) {
+    flatten_layers_[i]->Backward(flatten_top_vecs_[i], propagate_down,
+        pooling_top_vecs_[i]);
+    pooling_layers_[i]->Backward(pooling_top_vecs_[i], propagate_down,
+        pooling_bottom_vecs_[i]);
+  }
+  split_layer_->Backward(split_top_vec_, propagate_down, bottom);
+}
+
+template <typename Dtype>
+void SPPLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  if (split_layer_) {
+    ForwardSubLayers(bottom, top);
+    return;
+  }
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  int* mask = max_pool_ ? max_idx_.mutable_cpu_data() : NULL;
+  const int* level_offsets = level_offsets_.cpu_data();
+  const int* inner_bins = inner_bins_.cpu_data();
+  const int* outer_bins = outer_bins_.cpu_data();
+  const Dtype* bin_scales = max_pool_ ? NULL : bin_scales_.cpu_data();
+  const int pyramid_dim = level_offsets[pyramid_height_];
+  const int outer_dim = spatial_dim_ / inner_dim_;
+  const int num_planes = bottom[0]->count(0, 2);
+#ifdef _OPENMP
+  #pragma omp parallel for if (bottom[0]->count() > kSPPGrain) schedule(static)
+#endif
+  for (int plane = 0; plane < num_planes; ++plane) {
+    const int n = plane / channels_;
+    const int c = plane % channels_;
+    // The first top element of each level for this channel.
+    vector<int> level_tops(pyramid_height_);
+    for (int l = 0; l < pyramid_height_; ++l) {
+      const int level_bins = level_offsets[l + 1] - level_offsets[l];
+      level_tops[l] = (n * pyramid_dim + level_offsets[l]) * channels_ +
+          c * level_bins;
+      caffe_set(level_bins, max_pool_ ? Dtype(-FLT_MAX) : Dtype(0),
+          top_data + level_tops[l]);
+      if (max_pool_) {
+        caffe_set(level_bins, -1, mask + level_tops[l]);
+      }
+    }
+    // Pool each row of the channel into all the levels while it is cached.
+    const Dtype* plane_data = bottom_data + plane * spatial_dim_;
+    for (int o = 0; o < outer_dim; ++o) {
+      const Dtype* row = plane_data + o * inner_dim_;
+      for (int l = 0; l < pyramid_height_; ++l) {
+        const int* row_bins = inner_bins + l * inner_dim_;
+        Dtype* row_top = top_data + level_tops[l] +
+            outer_bins[l * outer_dim + o];
+        if (max_pool_) {
+          int* row_mask = mask + (row_top - top_data);
+          for (int i = 0; i < inner_dim_; ++i) {
+            if (row[i] > row_top[row_bins[i]]) {
+              row_top[row_bins[i]] = row[i];
+              row_mask[row_bins[i]] = o * inner_dim_ + i;
+            }
+          }
+        } else {
+          for (int i = 0; i < inner_dim_; ++i) {
+            row_top[row_bins[i]] += row[i];
+          }
+        }
+      }
+    }
+    for (int l = 0; l < pyramid_height_; ++l) {
+      const int level_bins = level_offsets[l + 1] - level_offsets[l];
+      Dtype* level_top = top_data + level_tops[l];
+      for (int b = 0; b < level_bins; ++b) {
+        if (!max_pool_) {
+          level_top[b] *= bin_scales[level_offsets[l] + b];
+        } else if (mask[level_tops[l] + b] < 0) {
+          // A window lying in the padding.
+          level_top[b] = 0;
+        }
+      }
+    }
+  }
+}
+
 template <typename Dtype>
 void SPPLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   if (!propagate_down[0]) {
     return;
   }
-  vector<bool> concat_propagate_down(pyramid_height_, true);
-  concat_layer_->Backward(top, concat_propagate_down, concat_bottom_vec_);
-  for (int i = 0; i < pyramid_height_; i++) {
-    flatten_layers_[i]->Backward(
-        *flatten_top_vecs_[i], propagate_down, *pooling_top_vecs_[i]);
-    pooling_layers_[i]->Backward(
-        *pooling_top_vecs_[i], propagate_down, *pooling_bottom_vecs_[i]);
+  if (split_layer_) {
+    BackwardSubLayers(top, propagate_down, bottom);
+    return;
+  }
+  const Dtype* top_diff = top[0]->cpu_diff();
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  const int* mask = max_pool_ ? max_idx_.cpu_data() : NULL;
+  const int* level_offsets = level_offsets_.cpu_data();
+  const int* inner_bins = inner_bins_.cpu_data();
+  const int* outer_bins = outer_bins_.cpu_data();
+  const Dtype* bin_scales = max_pool_ ? NULL : bin_scales_.cpu_data();
+  const int pyramid_dim = level_offsets[pyramid_height_];
+  const int outer_dim = spatial_dim_ / inner_dim_;
+  const int num_planes = bottom[0]->count(0, 2);
+#ifdef _OPENMP
+  #pragma omp parallel for if (bottom[0]->count() > kSPPGrain) schedule(static)
+#endif
+  for (int plane = 0; plane < num_planes; ++plane) {
+    const int n = plane / channels_;
+    const int c = plane % channels_;
+    Dtype* plane_diff = bottom_diff + plane * spatial_dim_;
+    caffe_set(spatial_dim_, Dtype(0), plane_diff);
+    vector<int> level_tops(pyramid_height_);
+    for (int l = 0; l < pyramid_height_; ++l) {
+      const int level_bins = level_offsets[l + 1] - level_offsets[l];
+      level_tops[l] = (n * pyramid_dim + level_offsets[l]) * channels_ +
+          c * level_bins;
+      if (max_pool_) {
+        const int* level_mask = mask + level_tops[l];
+        const Dtype* level_top_diff = top_diff + level_tops[l];
+        for (int b = 0; b < level_bins; ++b) {
+          if (level_mask[b] >= 0) {
+            plane_diff[level_mask[b]] += level_top_diff[b];
+          }
+        }
+      }
+    }
+    if (max_pool_) { continue; }
+    // Each position gets the scaled diff of its bin in every level.
+    for (int o = 0; o < outer_dim; ++o) {
+      Dtype* row_diff = plane_diff + o * inner_dim_;
+      for (int l = 0; l < pyramid_height_; ++l) {
+        const int* row_bins = inner_bins + l * inner_dim_;
+        const int row_bin = outer_bins[l * outer_dim + o];
+        const Dtype* row_top_diff = top_diff + level_tops[l] + row_bin;
+        const Dtype* row_scales = bin_scales + level_offsets[l] + row_bin;
+        for (int i = 0; i < inner_dim_; ++i) {
+          row_diff[i] += row_top_diff[row_bins[i]] * row_scales[row_bins[i]];
+        }
+      }
+    }
   }
-  split_layer_->Backward(split_top_vec_, propagate_down, bottom);
 }
 
+#ifdef CPU_ONLY
+STUB_GPU(SPPLayer);
+#endif
 
 INSTANTIATE_CLASS(SPPLayer);
 REGISTER_LAYER_CLASS(SPP);
@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// One thread per top element pools the window of its bin. A NULL mask
+// selects average pooling.
+template <typename Dtype>
+__global__ void SPPForward(const int nthreads,
+    const Dtype* const bottom_data, const int channels,
+    const int num_spatial_axes, const int* const spatial_shape,
+    const int spatial_dim, const int pyramid_height,
+    const int* const level_offsets, const int* const windows,
+    const Dtype* const bin_scales, Dtype* const top_data, int* const mask) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int pyramid_dim = level_offsets[pyramid_height];
+    const int n = index / (channels * pyramid_dim);
+    int offset = index % (channels * pyramid_dim);
+    int l = 0;
+    while (offset >= channels * level_offsets[l + 1]) { ++l; }
+    offset -= channels * level_offsets[l];
+    const int level_bins = level_offsets[l + 1] - level_offsets[l];
+    const int c = offset / level_bins;
+    const int bin = offset % level_bins;
+    const int num_bins = 1 << l;
+    const int* const level_windows = windows + l * num_spatial_axes * 2;
+    int start[kMaxBlobAxes];  // NOLINT(runtime/arrays)
+    int end[kMaxBlobAxes];  // NOLINT(runtime/arrays)
+    int position[kMaxBlobAxes];  // NOLINT(runtime/arrays)
+    bool done = false;
+    for (int d = num_spatial_axes - 1, b = bin; d >= 0; --d, b /= num_bins) {
+      start[d] = b % num_bins * level_windows[2 * d] - level_windows[2 * d + 1];
+      end[d] = min(start[d] + level_windows[2 * d], spatial_shape[d]);
+      start[d] = max(start[d], 0);
+      position[d] = start[d];
+      done |= start[d] >= end[d];
+    }
+    const Dtype* const plane = bottom_data + (n * channels + c) * spatial_dim;
+    Dtype value = mask ? -FLT_MAX : 0;
+    int max_index = -1;
+    while (!done) {
+      int plane_index = 0;
+      for (int d = 0; d < num_spatial_axes; ++d) {
+        plane_index = plane_index * spatial_shape[d] + position[d];
+      }
+      if (!mask) {
+        value += plane[plane_index];
+      } else if (plane[plane_index] > value) {
+        value = plane[plane_index];
+        max_index = plane_index;
+      }
+      int d = num_spatial_axes - 1;
+      while (d >= 0 && ++position[d] == end[d]) {
+        position[d] = start[d];
+        --d;
+      }
+      done = d < 0;
+    }
+    if (mask) {
+      top_data[index] = max_index < 0 ? 0 : value;
+      mask[index] = max_index;
+    } else {
+      top_data[index] = value * bin_scales[level_offsets[l] + bin];
+    }
+  }
+}
+
+// One thread per bottom element gathers the diff of its bin in each level.
+template <typename Dtype>
+__global__ void SPPBackward(const int nthreads, const Dtype* const top_diff,
+    const int channels, const int spatial_dim, const int inner_dim,
+    const int pyramid_height, const int* const level_offsets,
+    const int* const inner_bins, const int* const outer_bins,
+    const Dtype* const bin_scales, const int* const mask,
+    Dtype* const bottom_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int plane = index / spatial_dim;
+    const int n = plane / channels;
+    const int c = plane % channels;
+    const int plane_index = index % spatial_dim;
+    const int o = plane_index / inner_dim;
+    const int i = plane_index % inner_dim;
+    const int outer_dim = spatial_dim / inner_dim;
+    const int pyramid_dim = level_offsets[pyramid_height];
+    Dtype gradient = 0;
+    for (int l = 0; l < pyramid_height; ++l) {
+      const int level_bins = level_offsets[l + 1] - level_offsets[l];
+      const int bin = outer_bins[l * outer_dim + o] +
+          inner_bins[l * inner_dim + i];
+      const int top_index = (n * pyramid_dim + level_offsets[l]) * channels +
+          c * level_bins + bin;
+      if (!mask) {
+        gradient += top_diff[top_index] * bin_scales[level_offsets[l] + bin];
+      } else if (mask[top_index] == plane_index) {
+        gradient += top_diff[top_index];
+      }
+    }
+    bottom_diff[index] = gradient;
+  }
+}
+
+template <typename Dtype>
+void SPPLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  if (split_layer_) {
+    ForwardSubLayers(bottom, top);
+    return;
+  }
+  const int count = top[0]->count();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  SPPForward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
+      count, bottom[0]->gpu_data(), channels_, num_spatial_axes_,
+      bottom[0]->gpu_shape() + 2, spatial_dim_, pyramid_height_,
+      level_offsets_.gpu_data(), windows_.gpu_data(),
+      max_pool_ ? NULL : bin_scales_.gpu_data(), top[0]->mutable_gpu_data(),
+      max_pool_ ? max_idx_.mutable_gpu_data() : NULL);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template <typename Dtype>
+void SPPLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) {
+    return;
+  }
+  if (split_layer_) {
+    BackwardSubLayers(top, propagate_down, bottom);
+    return;
+  }
+  const int count = bottom[0]->count();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  SPPBackward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
+      count, top[0]->gpu_diff(), channels_, spatial_dim_, inner_dim_,
+      pyramid_height_, level_offsets_.gpu_data(), inner_bins_.gpu_data(),
+      outer_bins_.gpu_data(), max_pool_ ? NULL : bin_scales_.gpu_data(),
+      max_pool_ ? max_idx_.gpu_data() : NULL, bottom[0]->mutable_gpu_diff());
+  CUDA_POST_KERNEL_CHECK;
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS(SPPLayer);
+
+}  // namespace caffe
@@ -9,15 +9,30 @@
 
 namespace caffe {
 
+// Computes out = tanh(in); in may be out.
+template <typename Dtype>
+static void TanHForward(const int count, const Dtype* in, Dtype* out) {
+#ifdef _OPENMP
+  #pragma omp parallel for if (count > kNeuronGrain) schedule(static)
+#endif
+  for (int i = 0; i < count; ++i) {
+    out[i] = tanh(in[i]);
+  }
+}
+
 template <typename Dtype>
 void TanHLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* top_data = top[0]->mutable_cpu_data();
-  const int count = bottom[0]->count();
-  for (int i = 0; i < count; ++i) {
-    top_data[i] = tanh(bottom_data[i]);
+  if (this->fused_) {
+    return;
   }
+  TanHForward(bottom[0]->count(), bottom[0]->cpu_data(),
+      top[0]->mutable_cpu_data());
+}
+
+template <typename Dtype>
+void TanHLayer<Dtype>::Activate_cpu(const int count, Dtype* data) {
+  TanHForward(count, data, data);
 }
 
 template <typename Dtype>
@@ -29,9 +44,11 @@ void TanHLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int count = bottom[0]->count();
-    Dtype tanhx;
+#ifdef _OPENMP
+    #pragma omp parallel for simd if (count > kNeuronGrain) schedule(static)
+#endif
     for (int i = 0; i < count; ++i) {
-      tanhx = top_data[i];
+      const Dtype tanhx = top_data[i];
       bottom_diff[i] = top_diff[i] * (1 - tanhx * tanhx);
     }
   }
@@ -39,6 +56,7 @@ void TanHLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
 
 #ifdef CPU_ONLY
 STUB_GPU(TanHLayer);
+STUB_GPU_ACTIVATE(TanHLayer);
 #endif
 
 INSTANTIATE_CLASS(TanHLayer);
@@ -19,6 +19,9 @@ __global__ void TanHForward(const int n, const Dtype* in, Dtype* out) {
 template <typename Dtype>
 void TanHLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
+  if (this->fused_) {
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->gpu_data();
   Dtype* top_data = top[0]->mutable_gpu_data();
   const int count = bottom[0]->count();
@@ -53,7 +56,17 @@ void TanHLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   }
 }
 
+template <typename Dtype>
+void TanHLayer<Dtype>::Activate_gpu(const int count, Dtype* data) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  TanHForward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
+      count, data, data);
+  CUDA_POST_KERNEL_CHECK;
+}
+
 INSTANTIATE_LAYER_GPU_FUNCS(TanHLayer);
+template void TanHLayer<float>::Activate_gpu(const int count, float* data);
+template void TanHLayer<double>::Activate_gpu(const int count, double* data);
 
 
 }  // namespace caffe
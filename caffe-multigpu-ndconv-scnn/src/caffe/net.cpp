@@ -1,27 +1,166 @@
 #include <algorithm>
+#include <climits>
+#include <cmath>
+#include <functional>
 #include <map>
 #include <set>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
 #include "hdf5.h"
 
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
+#include "caffe/neuron_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/dag_scheduler.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/upgrade_proto.hpp"
+#include "caffe/util/mpi_shard.hpp"
 #include "caffe/util/mpi_templates.hpp"
+#include "caffe/util/rng.hpp"
 #include "caffe/util/insert_gathers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
 namespace caffe {
 
+namespace {
+
+// The alignment of the blobs placed in a shared arena.
+const size_t kArenaAlignment = 64;
+
+inline size_t ArenaAlign(size_t size) {
+  return (size + kArenaAlignment - 1) / kArenaAlignment * kArenaAlignment;
+}
+
+// Lets the memory of the blobs inside each segment, memories[i] being the
+// data or the diff of blob i, share an arena with the other segments. The
+// blobs marked in kept keep their own memory, as do the blobs sharing it with
+// a kept blob or with a blob of another segment, which are marked on return.
+shared_ptr<SyncedMemory> ShareSegmentMemory(
+    const vector<SyncedMemory*>& memories, const vector<int>& blob_segments,
+    const int num_segments, vector<bool>* kept, size_t* planned_size) {
+  // The segment of each memory, or -1 if kept.
+  map<SyncedMemory*, int> memory_segments;
+  for (int i = 0; i < memories.size(); ++i) {
+    if (!memories[i] || memories[i]->size() == 0) { continue; }
+    const int segment = (*kept)[i] ? -1 : blob_segments[i];
+    map<SyncedMemory*, int>::iterator it = memory_segments.find(memories[i]);
+    if (it == memory_segments.end()) {
+      memory_segments[memories[i]] = segment;
+    } else if (it->second != segment) {
+      it->second = -1;
+    }
+  }
+  vector<size_t> segment_sizes(num_segments, 0);
+  map<SyncedMemory*, size_t> offsets;
+  *planned_size = 0;
+  for (int i = 0; i < memories.size(); ++i) {
+    if (!memories[i] || memories[i]->size() == 0) { continue; }
+    const int segment = memory_segments[memories[i]];
+    if (segment < 0) {
+      (*kept)[i] = true;
+    } else if (!offsets.count(memories[i])) {
+      offsets[memories[i]] = segment_sizes[segment];
+      segment_sizes[segment] += ArenaAlign(memories[i]->size());
+      *planned_size += memories[i]->size();
+    }
+  }
+  const size_t arena_size =
+      *std::max_element(segment_sizes.begin(), segment_sizes.end());
+  shared_ptr<SyncedMemory> arena(new SyncedMemory(arena_size));
+  if (arena_size > 0) {
+    char* arena_data = static_cast<char*>(arena->mutable_cpu_data());
+    for (map<SyncedMemory*, size_t>::iterator it = offsets.begin();
+         it != offsets.end(); ++it) {
+      it->first->set_cpu_data(arena_data + it->second);
+    }
+  }
+  return arena;
+}
+
+// Lets the memory of the blobs used at disjoint times share an arena:
+// memories[i] is the data or the diff of blob i, used from layer
+// first_uses[i] to layer last_uses[i]. A memory shared by several blobs is
+// used over the union of their uses, and keeps its own memory if one of them
+// is pinned. The largest memories are placed first, each at the lowest offset
+// free from the memories already placed and used at the same time.
+shared_ptr<SyncedMemory> ShareMemoryOverTime(
+    const vector<SyncedMemory*>& memories, const vector<int>& first_uses,
+    const vector<int>& last_uses, const vector<bool>& pinned,
+    size_t* planned_size) {
+  map<SyncedMemory*, int> buffer_ids;
+  vector<SyncedMemory*> buffers;
+  vector<int> buffer_first_uses, buffer_last_uses;
+  vector<bool> buffer_pinned;
+  for (int i = 0; i < memories.size(); ++i) {
+    if (!memories[i] || memories[i]->size() == 0) { continue; }
+    if (!buffer_ids.count(memories[i])) {
+      buffer_ids[memories[i]] = buffers.size();
+      buffers.push_back(memories[i]);
+      buffer_first_uses.push_back(INT_MAX);
+      buffer_last_uses.push_back(-1);
+      buffer_pinned.push_back(false);
+    }
+    const int buffer_id = buffer_ids[memories[i]];
+    buffer_first_uses[buffer_id] =
+        std::min(buffer_first_uses[buffer_id], first_uses[i]);
+    buffer_last_uses[buffer_id] =
+        std::max(buffer_last_uses[buffer_id], last_uses[i]);
+    if (pinned[i]) { buffer_pinned[buffer_id] = true; }
+  }
+  vector<pair<size_t, int> > order;
+  for (int i = 0; i < buffers.size(); ++i) {
+    if (!buffer_pinned[i]) {
+      order.push_back(make_pair(buffers[i]->size(), i));
+    }
+  }
+  std::sort(order.begin(), order.end(), std::greater<pair<size_t, int> >());
+  vector<size_t> offsets(buffers.size(), 0);
+  size_t arena_size = 0;
+  *planned_size = 0;
+  for (int i = 0; i < order.size(); ++i) {
+    const int buffer_id = order[i].second;
+    const size_t size = ArenaAlign(order[i].first);
+    vector<pair<size_t, size_t> > taken;
+    for (int j = 0; j < i; ++j) {
+      const int other_id = order[j].second;
+      if (buffer_first_uses[other_id] <= buffer_last_uses[buffer_id] &&
+          buffer_first_uses[buffer_id] <= buffer_last_uses[other_id]) {
+        taken.push_back(make_pair(offsets[other_id],
+            offsets[other_id] + buffers[other_id]->size()));
+      }
+    }
+    std::sort(taken.begin(), taken.end());
+    size_t offset = 0;
+    for (int j = 0; j < taken.size() && offset + size > taken[j].first; ++j) {
+      offset = std::max(offset, ArenaAlign(taken[j].second));
+    }
+    offsets[buffer_id] = offset;
+    arena_size = std::max(arena_size, offset + size);
+    *planned_size += order[i].first;
+  }
+  shared_ptr<SyncedMemory> arena(new SyncedMemory(arena_size));
+  if (arena_size > 0) {
+    char* arena_data = static_cast<char*>(arena->mutable_cpu_data());
+    for (int i = 0; i < order.size(); ++i) {
+      const int buffer_id = order[i].second;
+      buffers[buffer_id]->set_cpu_data(arena_data + offsets[buffer_id]);
+    }
+  }
+  return arena;
+}
+
+}  // namespace
+
 template <typename Dtype>
 Net<Dtype>::Net(const NetParameter& param) {
   Init(param);
@@ -52,7 +191,16 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   // Determine which layers should be in parallel and insert a MPIGatherLayer
   // properly.
   DetermineLayerParallelOrSerial(param);
-  InsertGathers(serial_layers_, &param);
+  data_parallel_ = param.mpi_data_parallel();
+  if (data_parallel_ && !sharded_layers_.empty()) {
+    LOG(INFO) << "Net has model-parallel layers; ignoring mpi_data_parallel";
+    data_parallel_ = false;
+  }
+  if (data_parallel_) {
+    serial_layers_.clear();
+  } else {
+    InsertGathers(serial_layers_, &param);
+  }
 #endif
   // Basically, build all the layers and set up their connections.
   name_ = param.name();
@@ -254,6 +402,78 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   }
   ShareWeights();
   debug_info_ = param.debug_info();
+  if (param.dag_scheduler()) {
+    int num_threads = param.dag_threads();
+    if (num_threads <= 0) {
+      num_threads = std::max(1, int(boost::thread::hardware_concurrency()));
+    }
+    LOG(INFO) << "Running independent layers on " << num_threads
+              << " threads in CPU mode.";
+    scheduler_.reset(new DagScheduler(num_threads));
+    layer_rngs_.resize(layers_.size());
+    for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+      layer_rngs_[layer_id].reset(new Caffe::RNG(caffe_rng_rand()));
+    }
+    layer_losses_.assign(layers_.size(), Dtype(0));
+  }
+  if (param.fuse_activations()) {
+    FuseActivations();
+  }
+  zero_copy_concat_ = param.zero_copy_concat();
+  if (zero_copy_concat_) {
+    PlanViews();
+  }
+  memory_plan_ = false;
+  if (param.memory_plan()) {
+    if (phase_ != TEST) {
+      LOG(WARNING) << "Ignoring memory_plan outside the TEST phase, as the "
+                   << "backward pass needs the data of every blob.";
+    } else if (scheduler_) {
+      LOG(WARNING) << "Ignoring memory_plan with dag_scheduler, as layers "
+                   << "running concurrently could use the same memory.";
+    } else {
+      memory_plan_ = true;
+      for (int i = 0; i < param.pinned_blob_size(); ++i) {
+        CHECK(has_blob(param.pinned_blob(i)))
+            << "Unknown pinned_blob " << param.pinned_blob(i);
+        pinned_blobs_.insert(param.pinned_blob(i));
+      }
+      PlanMemory();
+    }
+  }
+  checkpointing_ = false;
+  resident_segment_ = -1;
+  if (param.checkpoint()) {
+    if (phase_ != TRAIN) {
+      LOG(WARNING) << "Ignoring checkpoint outside the TRAIN phase, use "
+                   << "memory_plan instead.";
+    } else if (scheduler_) {
+      LOG(WARNING) << "Ignoring checkpoint with dag_scheduler, as layers "
+                   << "running concurrently could use the same memory.";
+    } else {
+      InitCheckpoints(param);
+      PlanCheckpoints();
+    }
+  }
+  share_diffs_ = false;
+  if (param.share_diffs()) {
+    if (scheduler_) {
+      LOG(WARNING) << "Ignoring share_diffs with dag_scheduler, as layers "
+                   << "running concurrently could use the same memory.";
+    } else if (!segment_begins_.empty()) {
+      LOG(WARNING) << "Ignoring share_diffs with checkpoint, which already "
+                   << "shares the diffs inside the segments.";
+    } else {
+      share_diffs_ = true;
+      ShareDiffs();
+    }
+  }
+  if (zero_copy_concat_) {
+    ApplyViews();
+  }
+#ifdef USE_MPI
+  blob_pending_layer_.assign(blobs_.size(), -1);
+#endif
   LOG(INFO) << "Network initialization done.";
   LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
 }
@@ -468,6 +688,10 @@ void Net<Dtype>::AppendParam(const NetParameter& param, const int layer_id,
     has_params_decay_.push_back(param_spec->has_decay_mult());
     params_lr_.push_back(param_spec->lr_mult());
     params_weight_decay_.push_back(param_spec->decay_mult());
+#ifdef USE_MPI
+    learnable_params_sharded_.push_back(
+        sharded_layers_.count(layer_names_[layer_id]) > 0);
+#endif
   } else {
     // Named param blob with name we've seen before: share params
     const int owner_net_param_id = param_names_index_[param_name];
@@ -520,6 +744,18 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
   CHECK_LT(end, layers_.size());
   Dtype loss = 0;
+  if (UseScheduler()) {
+    vector<int> layer_ids;
+    for (int i = start; i <= end; ++i) {
+      layer_ids.push_back(i);
+    }
+    RunScheduled(layer_ids, true);
+    // Sum the losses in the order of the layers, whatever the schedule.
+    for (int i = start; i <= end; ++i) {
+      loss += layer_losses_[i];
+    }
+    return loss;
+  }
   if (debug_info_) {
     for (int i = 0; i < net_input_blobs_.size(); ++i) {
       InputDebugInfo(i);
@@ -527,10 +763,36 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   }
   for (int i = start; i <= end; ++i) {
     // LOG(ERROR) << "Forwarding " << layer_names_[i];
+    if (checkpointing_ && layer_recomputed_[i]) {
+      // Save the random stream, to draw the same numbers when recomputing.
+      if (!recompute_rngs_[i]) {
+        recompute_rngs_[i].reset(new Caffe::RNG(0));
+      }
+      *static_cast<rng_t*>(recompute_rngs_[i]->generator()) = *caffe_rng();
+    }
+#ifdef USE_MPI
+    WaitForPendingBlobs(i);
+#endif
+    // Reshaping a view in place would leave Concat and Slice copying between
+    // overlapping ranges.
+    if (!view_shapes_.empty() && ViewsReshaped(i)) {
+      DropViews();
+    }
     Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
     loss += layer_loss;
+#ifdef USE_MPI
+    MarkPendingBlobs(i);
+    if (debug_info_) { WaitForPendingBlobs(i); }
+#endif
     if (debug_info_) { ForwardDebugInfo(i); }
   }
+  if (checkpointing_) {
+    resident_segment_ = layer_segments_[end];
+  }
+#ifdef USE_MPI
+  // The caller may read any blob once we return.
+  WaitForAllPendingBlobs();
+#endif
   return loss;
 }
 
@@ -589,13 +851,138 @@ template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
+  if (UseScheduler()) {
+    vector<int> layer_ids;
+    for (int i = start; i >= end; --i) {
+      if (layer_need_backward_[i]) {
+        layer_ids.push_back(i);
+      }
+    }
+    RunScheduled(layer_ids, false);
+    return;
+  }
   for (int i = start; i >= end; --i) {
     if (layer_need_backward_[i]) {
+      if (checkpointing_ && layer_segments_[i] != resident_segment_) {
+        RecomputeSegment(layer_segments_[i], i);
+      }
+#ifdef USE_MPI
+      WaitForPendingBlobs(i);
+#endif
       layers_[i]->Backward(
           top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
+#ifdef USE_MPI
+      MarkPendingBlobs(i);
+      if (debug_info_) { WaitForPendingBlobs(i); }
+#endif
       if (debug_info_) { BackwardDebugInfo(i); }
     }
   }
+#ifdef USE_MPI
+  WaitForAllPendingBlobs();
+#endif
+}
+
+template <typename Dtype>
+bool Net<Dtype>::UseScheduler() const {
+  // Debug info is displayed layer by layer, in order.
+  return scheduler_ && Caffe::mode() == Caffe::CPU && !debug_info_;
+}
+
+// Adds a dependency of task on dependency, unless there is already one;
+// added[dependency] records the last task that got a dependency on it.
+static void AddLayerDependency(int task, int dependency, vector<int>* added,
+    DagScheduler::Graph* graph) {
+  if (dependency >= 0 && (*added)[dependency] != task) {
+    (*added)[dependency] = task;
+    graph->AddDependency(task, dependency);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::RunScheduled(const vector<int>& layer_ids,
+    const bool forward) {
+  // The layers depend on each other through the resources they read and
+  // write: the blobs, the params (by owner) and MPI, which keeps the layers
+  // communicating in order. A layer waits for the last writer of whatever it
+  // reads, and a writer also for the readers since the last writer, so that
+  // every layer sees the same data as when the layers run in order.
+  const int num_blobs = blobs_.size();
+  const int mpi_resource = num_blobs + params_.size();
+  vector<int> last_writer(mpi_resource + 1, -1);
+  vector<vector<int> > readers(mpi_resource + 1);
+  vector<int> added(layer_ids.size(), -1);
+  DagScheduler::Graph graph;
+  graph.Reset(layer_ids.size());
+  for (int task = 0; task < layer_ids.size(); ++task) {
+    const int layer_id = layer_ids[task];
+    vector<int> reads, writes;
+    if (forward) {
+      reads = bottom_id_vecs_[layer_id];
+      writes = top_id_vecs_[layer_id];
+    } else {
+      reads = top_id_vecs_[layer_id];
+      for (int j = 0; j < bottom_id_vecs_[layer_id].size(); ++j) {
+        if (bottom_need_backward_[layer_id][j]) {
+          writes.push_back(bottom_id_vecs_[layer_id][j]);
+        } else {
+          reads.push_back(bottom_id_vecs_[layer_id][j]);
+        }
+      }
+      for (int j = 0; j < param_id_vecs_[layer_id].size(); ++j) {
+        const int param_id = param_id_vecs_[layer_id][j];
+        const int owner_id = param_owners_[param_id] < 0 ?
+            param_id : param_owners_[param_id];
+        writes.push_back(num_blobs + owner_id);
+      }
+    }
+#ifdef USE_MPI
+    if (layers_[layer_id]->UsesMPI()) {
+      writes.push_back(mpi_resource);
+      graph.on_caller[task] = true;
+    }
+#endif
+    for (int j = 0; j < reads.size(); ++j) {
+      AddLayerDependency(task, last_writer[reads[j]], &added, &graph);
+    }
+    for (int j = 0; j < writes.size(); ++j) {
+      AddLayerDependency(task, last_writer[writes[j]], &added, &graph);
+      const vector<int>& resource_readers = readers[writes[j]];
+      for (int k = 0; k < resource_readers.size(); ++k) {
+        AddLayerDependency(task, resource_readers[k], &added, &graph);
+      }
+    }
+    for (int j = 0; j < reads.size(); ++j) {
+      readers[reads[j]].push_back(task);
+    }
+    for (int j = 0; j < writes.size(); ++j) {
+      last_writer[writes[j]] = task;
+      readers[writes[j]].clear();
+    }
+  }
+  scheduler_->Run(graph, boost::bind(&Net<Dtype>::RunScheduledLayer, this,
+      &layer_ids, forward, _1));
+}
+
+template <typename Dtype>
+void Net<Dtype>::RunScheduledLayer(const vector<int>* layer_ids,
+    const bool forward, const int index) {
+  const int layer_id = (*layer_ids)[index];
+  // Draw from the layer's own random stream, whichever thread runs it.
+  Caffe::RNG* thread_rng =
+      Caffe::set_thread_rng_stream(layer_rngs_[layer_id].get());
+  if (forward) {
+    layer_losses_[layer_id] =
+        layers_[layer_id]->Forward(bottom_vecs_[layer_id], top_vecs_[layer_id]);
+  } else {
+    layers_[layer_id]->Backward(top_vecs_[layer_id],
+        bottom_need_backward_[layer_id], bottom_vecs_[layer_id]);
+  }
+#ifdef USE_MPI
+  // Other threads may use the blobs as soon as the task completes.
+  layers_[layer_id]->WaitForCommunication();
+#endif
+  Caffe::set_thread_rng_stream(thread_rng);
 }
 
 template <typename Dtype>
@@ -703,6 +1090,30 @@ void Net<Dtype>::ShareTrainedLayersWith(const Net* other) {
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::CopyTrainedLayersFrom(const Net* other) {
+  int num_source_layers = other->layers().size();
+  for (int i = 0; i < num_source_layers; ++i) {
+    Layer<Dtype>* source_layer = other->layers()[i].get();
+    const string& source_layer_name = other->layer_names()[i];
+    if (!layer_names_index_.count(source_layer_name)) {
+      DLOG(INFO) << "Ignoring source layer " << source_layer_name;
+      continue;
+    }
+    int target_layer_id = layer_names_index_[source_layer_name];
+    DLOG(INFO) << "Copying source layer " << source_layer_name;
+    vector<shared_ptr<Blob<Dtype> > >& target_blobs =
+        layers_[target_layer_id]->blobs();
+    CHECK_EQ(target_blobs.size(), source_layer->blobs().size())
+        << "Incompatible number of blobs for layer " << source_layer_name;
+    for (int j = 0; j < target_blobs.size(); ++j) {
+      Blob<Dtype>* source_blob = source_layer->blobs()[j].get();
+      CHECK(target_blobs[j]->shape() == source_blob->shape());
+      target_blobs[j]->CopyFrom(*source_blob);
+    }
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::BackwardFrom(int start) {
   BackwardFromTo(start, 0);
@@ -738,6 +1149,555 @@ void Net<Dtype>::Reshape() {
   for (int i = 0; i < layers_.size(); ++i) {
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
   }
+  if (zero_copy_concat_) {
+    PlanViews();
+  }
+  if (memory_plan_) {
+    PlanMemory();
+  }
+  if (!segment_begins_.empty()) {
+    PlanCheckpoints();
+  }
+  if (share_diffs_) {
+    ShareDiffs();
+  }
+  if (zero_copy_concat_) {
+    ApplyViews();
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::GetBlobLifetimes(vector<int>* first_uses,
+    vector<int>* last_uses) const {
+  first_uses->assign(blobs_.size(), INT_MAX);
+  last_uses->assign(blobs_.size(), -1);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size() +
+         top_id_vecs_[layer_id].size(); ++i) {
+      const int blob_id = i < bottom_id_vecs_[layer_id].size() ?
+          bottom_id_vecs_[layer_id][i] :
+          top_id_vecs_[layer_id][i - bottom_id_vecs_[layer_id].size()];
+      (*first_uses)[blob_id] = std::min((*first_uses)[blob_id], layer_id);
+      (*last_uses)[blob_id] = std::max((*last_uses)[blob_id], layer_id);
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanMemory() {
+  if (Caffe::mode() != Caffe::CPU) {
+    LOG(INFO) << "Not planning the memory of " << name_
+              << " outside CPU mode.";
+    return;
+  }
+  vector<SyncedMemory*> data(blobs_.size());
+  vector<bool> pinned(blobs_.size(), false);
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    data[blob_id] = blobs_[blob_id]->data().get();
+    pinned[blob_id] = pinned_blobs_.count(blob_names_[blob_id]) > 0;
+  }
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    pinned[net_input_blob_indices_[i]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    pinned[net_output_blob_indices_[i]] = true;
+  }
+  // Layers without bottoms (e.g. DummyData) may only fill their tops once.
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (!bottom_id_vecs_[layer_id].empty()) { continue; }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      pinned[top_id_vecs_[layer_id][i]] = true;
+    }
+  }
+  // An MPIGather may still be sending or receiving after later layers ran.
+  PinAsynchronousBlobs(&pinned);
+  vector<int> first_uses, last_uses;
+  GetBlobLifetimes(&first_uses, &last_uses);
+  ExtendViewLifetimes(&first_uses, &last_uses, &pinned);
+  size_t planned_size;
+  memory_arena_ = ShareMemoryOverTime(data, first_uses, last_uses, pinned,
+      &planned_size);
+  LOG(INFO) << "Memory plan: " << planned_size << " bytes of blobs share "
+            << memory_arena_->size() << " bytes.";
+}
+
+template <typename Dtype>
+void Net<Dtype>::ShareDiffs() {
+  // The diff of a blob may be read without being written if one of the
+  // layers using it does not propagate down to it. Such diffs stay zero in
+  // their own memory.
+  vector<bool> diff_written(blobs_.size(), true);
+  vector<bool> diff_used(blobs_.size(), false);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      const int blob_id = bottom_id_vecs_[layer_id][i];
+      diff_used[blob_id] = true;
+      if (!layer_need_backward_[layer_id] ||
+          !bottom_need_backward_[layer_id][i]) {
+        diff_written[blob_id] = false;
+      }
+    }
+  }
+  vector<bool> pinned(blobs_.size(), false);
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    pinned[blob_id] = !diff_used[blob_id] || !diff_written[blob_id] ||
+        blob_loss_weights_[blob_id] != Dtype(0);
+  }
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    pinned[net_input_blob_indices_[i]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    pinned[net_output_blob_indices_[i]] = true;
+  }
+  for (int blob_id = 0; blob_id < view_roots_.size(); ++blob_id) {
+    if (view_roots_[blob_id] >= 0) { pinned[blob_id] = true; }
+  }
+  // The Iscatter of an MPIGather may still be in flight in later layers.
+  PinAsynchronousBlobs(&pinned);
+  // The first top of a split layer accumulates into the diff of its bottom:
+  // Split adds the diffs of the other tops to it in place.
+  size_t split_size = 0;
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (string(layers_[layer_id]->type()) != "Split" ||
+        layers_[layer_id]->loss(0)) {
+      continue;
+    }
+    Blob<Dtype>* top = top_vecs_[layer_id][0];
+    Blob<Dtype>* bottom = bottom_vecs_[layer_id][0];
+    if (!pinned[top_id_vecs_[layer_id][0]] && top->diff() != bottom->diff()) {
+      split_size += top->count() * sizeof(Dtype);
+      top->ShareDiff(*bottom);
+    }
+  }
+  size_t planned_size = 0;
+  size_t arena_size = 0;
+  if (Caffe::mode() == Caffe::CPU) {
+    vector<SyncedMemory*> diffs(blobs_.size());
+    for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+      diffs[blob_id] = blobs_[blob_id]->diff().get();
+    }
+    vector<int> first_uses, last_uses;
+    GetBlobLifetimes(&first_uses, &last_uses);
+    ExtendViewLifetimes(&first_uses, &last_uses, &pinned);
+    diff_arena_ = ShareMemoryOverTime(diffs, first_uses, last_uses, pinned,
+        &planned_size);
+    arena_size = diff_arena_->size();
+  }
+  LOG(INFO) << "Sharing diffs saves " << split_size + planned_size -
+      arena_size << " bytes: split layers accumulate " << split_size
+      << " bytes of diffs in place, and " << planned_size << " bytes of "
+      << "diffs share " << arena_size << " bytes.";
+}
+
+template <typename Dtype>
+void Net<Dtype>::FuseActivations() {
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    NeuronLayer<Dtype>* activation =
+        dynamic_cast<NeuronLayer<Dtype>*>(layers_[layer_id].get());
+    if (!activation || !activation->CanFuse() ||
+        activation->loss(0) != Dtype(0)) {
+      continue;
+    }
+    // The activation must compute in place on the top of the last layer
+    // writing its bottom, with no layer reading that top in between.
+    const int blob_id = bottom_id_vecs_[layer_id][0];
+    if (top_id_vecs_[layer_id][0] != blob_id) { continue; }
+    int producer = layer_id - 1;
+    for (; producer >= 0; --producer) {
+      const vector<int>& tops = top_id_vecs_[producer];
+      const vector<int>& bottoms = bottom_id_vecs_[producer];
+      if (std::find(tops.begin(), tops.end(), blob_id) != tops.end()) {
+        break;
+      }
+      if (std::find(bottoms.begin(), bottoms.end(), blob_id) !=
+          bottoms.end()) {
+        producer = -1;
+        break;
+      }
+    }
+    if (producer < 0 || !layers_[producer]->CanFuseActivation() ||
+        top_id_vecs_[producer].size() != 1 ||
+        layers_[producer]->loss(0) != Dtype(0)) {
+      continue;
+    }
+    layers_[producer]->set_fused_activation(activation);
+    activation->set_fused(true);
+    LOG(INFO) << "Fusing " << layer_names_[layer_id] << " into "
+              << layer_names_[producer];
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanViews() {
+  view_roots_.assign(blobs_.size(), -1);
+  view_offsets_.assign(blobs_.size(), 0);
+  view_shapes_.clear();
+  if (Caffe::mode() != Caffe::CPU) {
+    LOG(INFO) << "Not planning the views of " << name_
+              << " outside CPU mode.";
+    return;
+  }
+  // The inputs, the outputs, the tops of layers without bottoms and the blobs
+  // with a loss weight keep their own memory.
+  vector<bool> excluded(blobs_.size(), false);
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    excluded[net_input_blob_indices_[i]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    excluded[net_output_blob_indices_[i]] = true;
+  }
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (blob_loss_weights_[blob_id] != Dtype(0)) { excluded[blob_id] = true; }
+    // Blobs sharing memory with other blobs, e.g. by share_diffs.
+    const shared_ptr<SyncedMemory>& data = blobs_[blob_id]->data();
+    const shared_ptr<SyncedMemory>& diff = blobs_[blob_id]->diff();
+    if (data.use_count() > 1 + view_memories_.count(data) ||
+        diff.use_count() > 1 + view_memories_.count(diff)) {
+      excluded[blob_id] = true;
+    }
+  }
+  // A layer computing a blob in place would overwrite the parts viewing it,
+  // which their own layers may still need for their backward pass. And the
+  // diff of a Slice top must be written by all the layers using it, as the
+  // Slice layer no longer fills it in.
+  vector<bool> in_place(blobs_.size(), false);
+  vector<bool> diff_written(blobs_.size(), true);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    const vector<int>& top_ids = top_id_vecs_[layer_id];
+    if (bottom_ids.empty()) {
+      for (int i = 0; i < top_ids.size(); ++i) { excluded[top_ids[i]] = true; }
+    }
+    for (int i = 0; i < bottom_ids.size(); ++i) {
+      if (std::find(top_ids.begin(), top_ids.end(), bottom_ids[i]) !=
+          top_ids.end()) {
+        in_place[bottom_ids[i]] = true;
+      }
+      if (!layer_need_backward_[layer_id] ||
+          !bottom_need_backward_[layer_id][i]) {
+        diff_written[bottom_ids[i]] = false;
+      }
+    }
+  }
+  // Each part points into the blob it is concatenated into or sliced from,
+  // which may itself be a part of another Concat or Slice.
+  vector<int> parents(blobs_.size(), -1);
+  vector<int> parent_offsets(blobs_.size(), 0);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const string type(layers_[layer_id]->type());
+    if (type != "Concat" && type != "Slice") { continue; }
+    const bool concat = type == "Concat";
+    const LayerParameter& layer_param = layers_[layer_id]->layer_param();
+    const int whole = concat ? top_id_vecs_[layer_id][0] :
+        bottom_id_vecs_[layer_id][0];
+    const vector<int>& parts = concat ? bottom_id_vecs_[layer_id] :
+        top_id_vecs_[layer_id];
+    int axis;
+    if (concat) {
+      const ConcatParameter& concat_param = layer_param.concat_param();
+      axis = concat_param.has_concat_dim() ? concat_param.concat_dim() :
+          blobs_[whole]->CanonicalAxisIndex(concat_param.axis());
+    } else {
+      const SliceParameter& slice_param = layer_param.slice_param();
+      axis = slice_param.has_slice_dim() ? slice_param.slice_dim() :
+          blobs_[whole]->CanonicalAxisIndex(slice_param.axis());
+    }
+    if (blobs_[whole]->count(0, axis) != 1 || (concat && in_place[whole])) {
+      continue;
+    }
+    const bool slice_backward = !concat && layer_need_backward_[layer_id] &&
+        bottom_need_backward_[layer_id][0];
+    int offset = 0;
+    for (int i = 0; i < parts.size(); ++i) {
+      const int part = parts[i];
+      if (!excluded[part] && parents[part] < 0 && part != whole &&
+          (concat || !in_place[part]) &&
+          (!slice_backward || diff_written[part])) {
+        parents[part] = whole;
+        parent_offsets[part] = offset;
+      }
+      offset += blobs_[part]->count();
+    }
+  }
+  size_t view_size = 0;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    int root = blob_id;
+    int offset = 0;
+    while (parents[root] >= 0) {
+      offset += parent_offsets[root];
+      root = parents[root];
+    }
+    if (root != blob_id) {
+      view_roots_[blob_id] = root;
+      view_size += blobs_[blob_id]->count() * sizeof(Dtype);
+    }
+    view_offsets_[blob_id] = offset;
+  }
+  if (view_size > 0) {
+    for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+      view_shapes_.push_back(blobs_[blob_id]->shape());
+    }
+  }
+  LOG(INFO) << "Zero-copy concat: " << view_size << " bytes of blobs are "
+            << "views into the blobs they are concatenated into or sliced "
+            << "from.";
+}
+
+template <typename Dtype>
+void Net<Dtype>::ApplyViews() {
+  for (int blob_id = 0; blob_id < view_roots_.size(); ++blob_id) {
+    const int root = view_roots_[blob_id];
+    if (root < 0) { continue; }
+    const int offset = view_offsets_[blob_id];
+    blobs_[blob_id]->data()->set_cpu_data(
+        blobs_[root]->mutable_cpu_data() + offset);
+    view_memories_.insert(blobs_[root]->data());
+    // Only allocate the diffs used by a backward pass.
+    if (blob_need_backward_[blob_id]) {
+      blobs_[blob_id]->diff()->set_cpu_data(
+          blobs_[root]->mutable_cpu_diff() + offset);
+      view_memories_.insert(blobs_[root]->diff());
+    }
+  }
+}
+
+template <typename Dtype>
+bool Net<Dtype>::ViewsReshaped(const int layer_id) const {
+  // A layer shapes its tops from the shapes of its bottoms, so the views hold
+  // as long as the bottoms keep their planned shapes, unless the layer
+  // reshapes its tops from the values of its bottoms.
+  const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+  for (int i = 0; i < bottom_ids.size(); ++i) {
+    if (blobs_[bottom_ids[i]]->shape() != view_shapes_[bottom_ids[i]]) {
+      return true;
+    }
+  }
+  if (!layers_[layer_id]->ReshapeEveryForward()) {
+    return false;
+  }
+  const vector<int>& top_ids = top_id_vecs_[layer_id];
+  for (int i = 0; i < top_ids.size(); ++i) {
+    if (view_roots_[top_ids[i]] >= 0 || std::find(view_roots_.begin(),
+        view_roots_.end(), top_ids[i]) != view_roots_.end()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename Dtype>
+void Net<Dtype>::DropViews() {
+  LOG(INFO) << "The shapes of " << name_ << " changed in Forward; the blobs "
+            << "stop being views until the next Reshape.";
+  for (int blob_id = 0; blob_id < view_roots_.size(); ++blob_id) {
+    if (view_roots_[blob_id] < 0) { continue; }
+    Blob<Dtype>* blob = blobs_[blob_id].get();
+    const bool copy_diff = blob_need_backward_[blob_id];
+    Blob<Dtype> values;
+    values.CopyFrom(*blob, false, true);
+    if (copy_diff) { values.CopyFrom(*blob, true); }
+    // Growing the blob past the capacity of its memory allocates memory of
+    // its own, which then keeps the shape of the view.
+    blob->Reshape(vector<int>(1, blob->data()->size() / sizeof(Dtype) + 1));
+    blob->Reshape(values.shape());
+    blob->CopyFrom(values);
+    if (copy_diff) { blob->CopyFrom(values, true); }
+    view_roots_[blob_id] = -1;
+  }
+  view_shapes_.clear();
+}
+
+template <typename Dtype>
+void Net<Dtype>::ExtendViewLifetimes(vector<int>* first_uses,
+    vector<int>* last_uses, vector<bool>* pinned) const {
+  for (int blob_id = 0; blob_id < view_roots_.size(); ++blob_id) {
+    const int root = view_roots_[blob_id];
+    if (root < 0) { continue; }
+    (*pinned)[blob_id] = true;
+    (*first_uses)[root] = std::min((*first_uses)[root],
+        (*first_uses)[blob_id]);
+    (*last_uses)[root] = std::max((*last_uses)[root], (*last_uses)[blob_id]);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::PinAsynchronousBlobs(vector<bool>* pinned) const {
+#ifdef USE_MPI
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (!layers_[layer_id]->IsAsynchronous()) { continue; }
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      (*pinned)[bottom_id_vecs_[layer_id][i]] = true;
+    }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      (*pinned)[top_id_vecs_[layer_id][i]] = true;
+    }
+  }
+#endif
+}
+
+template <typename Dtype>
+void Net<Dtype>::InitCheckpoints(const NetParameter& param) {
+  segment_begins_.assign(1, 0);
+  if (param.checkpoint_layer_size() > 0) {
+    set<int> segment_ends;
+    for (int i = 0; i < param.checkpoint_layer_size(); ++i) {
+      CHECK(has_layer(param.checkpoint_layer(i)))
+          << "Unknown checkpoint_layer " << param.checkpoint_layer(i);
+      segment_ends.insert(layer_names_index_[param.checkpoint_layer(i)]);
+    }
+    for (set<int>::iterator it = segment_ends.begin();
+         it != segment_ends.end(); ++it) {
+      if (*it + 1 < layers_.size()) {
+        segment_begins_.push_back(*it + 1);
+      }
+    }
+  } else {
+    int num_segments = param.checkpoint_segments();
+    if (num_segments <= 0) {
+      num_segments = std::max(1,
+          static_cast<int>(sqrt(static_cast<double>(layers_.size())) + 0.5));
+    }
+    // Balance the activations computed by the segments, not counting the
+    // tops computed in place.
+    vector<size_t> layer_sizes(layers_.size(), 0);
+    size_t total_size = 0;
+    for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+      const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+      for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+        const int blob_id = top_id_vecs_[layer_id][i];
+        if (std::find(bottom_ids.begin(), bottom_ids.end(), blob_id) ==
+            bottom_ids.end()) {
+          layer_sizes[layer_id] += blobs_[blob_id]->count();
+        }
+      }
+      total_size += layer_sizes[layer_id];
+    }
+    size_t size = 0;
+    for (int layer_id = 0; layer_id + 1 < layers_.size() &&
+         segment_begins_.size() < num_segments; ++layer_id) {
+      size += layer_sizes[layer_id];
+      if (size * num_segments >= total_size * segment_begins_.size()) {
+        segment_begins_.push_back(layer_id + 1);
+      }
+    }
+  }
+  layer_segments_.resize(layers_.size());
+  for (int segment = 0; segment < segment_begins_.size(); ++segment) {
+    const int end = segment + 1 < segment_begins_.size() ?
+        segment_begins_[segment + 1] : layers_.size();
+    for (int layer_id = segment_begins_[segment]; layer_id < end; ++layer_id) {
+      layer_segments_[layer_id] = segment;
+    }
+  }
+  recompute_rngs_.resize(layers_.size());
+  LOG(INFO) << "Checkpointing " << segment_begins_.size() << " segments.";
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanCheckpoints() {
+  checkpointing_ = false;
+  resident_segment_ = -1;
+  if (Caffe::mode() != Caffe::CPU) {
+    LOG(INFO) << "Not checkpointing " << name_ << " outside CPU mode.";
+    return;
+  }
+  // Keep the blobs used by several segments, and those that cannot be
+  // computed again: the inputs, the tops of layers without bottoms or that
+  // cannot recompute their forward pass, and the blobs holding loss weights
+  // in their diff.
+  vector<bool> kept(blobs_.size(), false);
+  vector<int> blob_segments(blobs_.size(), -1);
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    kept[net_input_blob_indices_[i]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    kept[net_output_blob_indices_[i]] = true;
+  }
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (blob_loss_weights_[blob_id] != Dtype(0)) { kept[blob_id] = true; }
+  }
+  for (int blob_id = 0; blob_id < view_roots_.size(); ++blob_id) {
+    if (view_roots_[blob_id] >= 0) {
+      kept[blob_id] = true;
+      kept[view_roots_[blob_id]] = true;
+    }
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const int segment = layer_segments_[layer_id];
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    const vector<int>& top_ids = top_id_vecs_[layer_id];
+    const bool recomputable = !bottom_ids.empty() &&
+        layers_[layer_id]->CanRecomputeForward();
+    for (int i = 0; i < bottom_ids.size() + top_ids.size(); ++i) {
+      const bool is_top = i >= bottom_ids.size();
+      const int blob_id = is_top ? top_ids[i - bottom_ids.size()] :
+          bottom_ids[i];
+      if (blob_segments[blob_id] < 0) {
+        blob_segments[blob_id] = segment;
+      } else if (blob_segments[blob_id] != segment) {
+        kept[blob_id] = true;
+      }
+      if (is_top && !recomputable) { kept[blob_id] = true; }
+    }
+  }
+  // A segment may start while an MPIGather of the previous one is in flight.
+  PinAsynchronousBlobs(&kept);
+  vector<SyncedMemory*> data(blobs_.size());
+  vector<SyncedMemory*> diffs(blobs_.size());
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    data[blob_id] = blobs_[blob_id]->data().get();
+    diffs[blob_id] = blobs_[blob_id]->diff().get();
+  }
+  vector<bool> data_kept(kept);
+  vector<bool> diff_kept(kept);
+  size_t data_size, diff_size;
+  checkpoint_data_arena_ = ShareSegmentMemory(data, blob_segments,
+      segment_begins_.size(), &data_kept, &data_size);
+  checkpoint_diff_arena_ = ShareSegmentMemory(diffs, blob_segments,
+      segment_begins_.size(), &diff_kept, &diff_size);
+  // Only the layers computing the data of a blob inside their segment need
+  // to run again.
+  layer_recomputed_.assign(layers_.size(), false);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      if (!data_kept[top_id_vecs_[layer_id][i]]) {
+        layer_recomputed_[layer_id] = true;
+      }
+    }
+  }
+  checkpointing_ = true;
+  LOG(INFO) << "Checkpointing: " << data_size + diff_size << " bytes of data "
+            << "and diffs share " << checkpoint_data_arena_->size() +
+            checkpoint_diff_arena_->size() << " bytes.";
+}
+
+template <typename Dtype>
+void Net<Dtype>::RecomputeSegment(const int segment, const int end) {
+#ifdef USE_MPI
+  // The blobs of the previous segment may share memory with this one.
+  WaitForAllPendingBlobs();
+#endif
+  Caffe::RNG rng(0);
+  Caffe::RNG* previous_rng = Caffe::set_thread_rng_stream(&rng);
+  for (int i = segment_begins_[segment]; i <= end; ++i) {
+    if (!layer_recomputed_[i]) { continue; }
+    CHECK(recompute_rngs_[i]) << "Run the forward pass before the backward "
+        << "pass when checkpointing.";
+    // Draw the same random numbers as in the forward pass.
+    *caffe_rng() = *static_cast<rng_t*>(recompute_rngs_[i]->generator());
+#ifdef USE_MPI
+    WaitForPendingBlobs(i);
+#endif
+    layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+#ifdef USE_MPI
+    MarkPendingBlobs(i);
+#endif
+  }
+#ifdef USE_MPI
+  WaitForAllPendingBlobs();
+#endif
+  Caffe::set_thread_rng_stream(previous_rng);
+  resident_segment_ = segment;
 }
 
 template <typename Dtype>
@@ -763,6 +1723,11 @@ void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
     for (int j = 0; j < target_blobs.size(); ++j) {
       const bool kReshape = true;
       target_blobs[j]->FromProto(source_layer.blobs(j), kReshape);
+#ifdef USE_MPI
+      if (sharded_layers_.count(source_layer_name)) {
+        ShardBlobRows(target_blobs[j].get());
+      }
+#endif
     }
   }
 }
@@ -772,6 +1737,8 @@ void Net<Dtype>::CopyTrainedLayersFrom(const string trained_filename) {
   if (trained_filename.size() >= 3 &&
       trained_filename.compare(trained_filename.size() - 3, 3, ".h5") == 0) {
     CopyTrainedLayersFromHDF5(trained_filename);
+  } else if (IsWeightFilename(trained_filename)) {
+    CopyTrainedLayersFromWeightFile(trained_filename);
   } else {
     CopyTrainedLayersFromBinaryProto(trained_filename);
   }
@@ -828,6 +1795,11 @@ void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
       }
       hdf5_load_nd_dataset(layer_hid, dataset_name.c_str(), 0, kMaxBlobAxes,
           target_blobs[j].get());
+#ifdef USE_MPI
+      if (sharded_layers_.count(source_layer_name)) {
+        ShardBlobRows(target_blobs[j].get());
+      }
+#endif
     }
     H5Gclose(layer_hid);
   }
@@ -835,6 +1807,52 @@ void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
   H5Fclose(file_hid);
 }
 
+template <typename Dtype>
+void Net<Dtype>::CopyTrainedLayersFromWeightFile(
+    const string trained_filename) {
+  shared_ptr<WeightFile> weights(new WeightFile(trained_filename));
+  // The params are not updated at TEST, so they can be read from the mapping.
+  const bool map_params = (phase_ == TEST);
+  bool mapped = false;
+  const vector<WeightFile::Entry>& entries = weights->entries();
+  for (int i = 0; i < entries.size(); ++i) {
+    const WeightFile::Entry& entry = entries[i];
+    const string& source_layer_name = entry.layer_name;
+    if (!layer_names_index_.count(source_layer_name)) {
+      DLOG(INFO) << "Ignoring source layer " << source_layer_name;
+      continue;
+    }
+    int target_layer_id = layer_names_index_[source_layer_name];
+    vector<shared_ptr<Blob<Dtype> > >& target_blobs =
+        layers_[target_layer_id]->blobs();
+    CHECK_LT(entry.blob_id, target_blobs.size())
+        << "Incompatible number of blobs for layer " << source_layer_name;
+    Blob<Dtype>* target_blob = target_blobs[entry.blob_id].get();
+    bool sharded = false;
+#ifdef USE_MPI
+    sharded = sharded_layers_.count(source_layer_name) > 0;
+#endif
+    if (map_params && !sharded && WeightFile::IsStoredAs<Dtype>(entry)) {
+      target_blob->Reshape(entry.shape);
+      CHECK_EQ(target_blob->count(), entry.count)
+          << "Incompatible shape of blob " << entry.blob_id << " for layer "
+          << source_layer_name;
+      target_blob->set_cpu_data(weights->data<Dtype>(entry));
+      mapped = true;
+    } else {
+      weights->CopyTo(entry, target_blob);
+    }
+#ifdef USE_MPI
+    if (sharded) {
+      ShardBlobRows(target_blob);
+    }
+#endif
+  }
+  if (mapped) {
+    mapped_weights_.push_back(weights);
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
   param->Clear();
@@ -858,6 +1876,11 @@ void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
 
 template <typename Dtype>
 void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
+#ifdef USE_MPI
+  CHECK(sharded_layers_.empty())
+      << "Saving model-parallel layers to HDF5 is not supported; "
+      << "use the binary proto format instead.";
+#endif
   hid_t file_hid = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
       H5P_DEFAULT);
   CHECK_GE(file_hid, 0)
@@ -989,18 +2012,148 @@ const shared_ptr<Layer<Dtype> > Net<Dtype>::layer_by_name(
 #ifdef USE_MPI
 template <typename Dtype>
 void Net<Dtype>::SyncLayers() {
+  // Only the param data is broadcast: the diffs are cleared before they are
+  // used, and test nets never need to allocate them.
+  vector<Blob<Dtype>*> blobs;
+  for (int i = 0; i < params_.size(); ++i) {
+    // Shared params are synchronized through their owner, and each process
+    // holds a different shard of a model-parallel layer.
+    if (param_owners_[i] >= 0 ||
+        sharded_layers_.count(layer_names_[param_layer_indices_[i].first])) {
+      continue;
+    }
+    blobs.push_back(params_[i].get());
+  }
+  const bool kSkipIfEqual = true;
+  BroadcastBlobData(blobs, kSkipIfEqual);
+}
+
+template <typename Dtype>
+void Net<Dtype>::SyncSerialLayers() {
+  vector<Blob<Dtype>*> blobs;
+  for (int i = 0; i < params_.size(); ++i) {
+    const string& layer_name = layer_names_[param_layer_indices_[i].first];
+    if (param_owners_[i] >= 0 || !serial_layers_.count(layer_name) ||
+        sharded_layers_.count(layer_name)) {
+      continue;
+    }
+    blobs.push_back(params_[i].get());
+  }
+  BroadcastBlobData(blobs, false);
+}
+
+template <typename Dtype>
+void Net<Dtype>::BroadcastBlobData(const vector<Blob<Dtype>*>& blobs,
+    bool skip_if_equal) {
+  size_t count = 0;
+  for (int i = 0; i < blobs.size(); ++i) {
+    count += blobs[i]->count();
+  }
+  if (count == 0) return;
+  CHECK_LE(count, INT_MAX) << "Too many params to broadcast at once";
+  // Pack everything into one buffer, so that a single broadcast is needed.
+  vector<Dtype> buffer(count);
+  const bool is_root = (Caffe::mpi_rank() == 0);
+  if (is_root || skip_if_equal) {
+    size_t offset = 0;
+    for (int i = 0; i < blobs.size(); ++i) {
+      caffe_copy(blobs[i]->count(), blobs[i]->cpu_data(), &buffer[offset]);
+      offset += blobs[i]->count();
+    }
+  }
+  if (skip_if_equal) {
+    // Typically every process has loaded the same .caffemodel; compare the
+    // checksums before paying for the broadcast. max(~h) == ~min(h).
+    uint64_t checksum = 14695981039346656037ULL;
+    const unsigned char* bytes =
+        reinterpret_cast<const unsigned char*>(&buffer[0]);
+    for (size_t i = 0; i < count * sizeof(Dtype); ++i) {
+      checksum = (checksum ^ bytes[i]) * 1099511628211ULL;
+    }
+    unsigned long long checksums[2] = { checksum, ~checksum };  // NOLINT
+    MPI_Allreduce(MPI_IN_PLACE, checksums, 2, MPI_UNSIGNED_LONG_LONG, MPI_MAX,
+        MPI_COMM_WORLD);
+    if (checksums[0] == ~checksums[1]) {
+      LOG(INFO) << "Params are identical on all the MPI processes; "
+                << "skipping the broadcast";
+      return;
+    }
+  }
+  MPIBcast<Dtype>(count, &buffer[0]);
+  if (!is_root) {
+    size_t offset = 0;
+    for (int i = 0; i < blobs.size(); ++i) {
+      caffe_copy(blobs[i]->count(), &buffer[offset],
+          blobs[i]->mutable_cpu_data());
+      offset += blobs[i]->count();
+    }
+  }
+}
+
+template <typename Dtype>
+bool Net<Dtype>::IsParallelBlob(const int blob_id) const {
+  // The last layer writing the blob decides, to follow in-place layers.
+  bool parallel = true;
   for (int i = 0; i < layers_.size(); ++i) {
-    vector<shared_ptr<Blob<Dtype> > >& blobs = layers_[i]->blobs();
-    for (int j = 0; j < blobs.size(); ++j) {
-      MPIBcast<Dtype>(blobs[j]->count(), blobs[j]->mutable_cpu_data());
-      MPIBcast<Dtype>(blobs[j]->count(), blobs[j]->mutable_cpu_diff());
+    const vector<int>& top_ids = top_id_vecs_[i];
+    if (std::find(top_ids.begin(), top_ids.end(), blob_id) != top_ids.end()) {
+      parallel = !serial_layers_.count(layer_names_[i]);
+    }
+  }
+  return parallel;
+}
+
+template <typename Dtype>
+void Net<Dtype>::MarkPendingBlobs(const int layer_id) {
+  if (!layers_[layer_id]->IsAsynchronous()) return;
+  for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+    blob_pending_layer_[bottom_id_vecs_[layer_id][i]] = layer_id;
+  }
+  for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+    blob_pending_layer_[top_id_vecs_[layer_id][i]] = layer_id;
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::WaitForPendingBlobs(const int layer_id) {
+  // A layer may read or write (in-place) any of its bottoms and tops, so wait
+  // for every asynchronous layer that still has one of them in flight.
+  const vector<int>* blob_ids[2] =
+      { &bottom_id_vecs_[layer_id], &top_id_vecs_[layer_id] };
+  for (int k = 0; k < 2; ++k) {
+    for (int i = 0; i < blob_ids[k]->size(); ++i) {
+      const int pending_layer_id = blob_pending_layer_[(*blob_ids[k])[i]];
+      if (pending_layer_id < 0) continue;
+      layers_[pending_layer_id]->WaitForCommunication();
+      ClearPendingBlobs(pending_layer_id);
     }
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::WaitForAllPendingBlobs() {
+  for (int i = 0; i < blob_pending_layer_.size(); ++i) {
+    const int pending_layer_id = blob_pending_layer_[i];
+    if (pending_layer_id < 0) continue;
+    layers_[pending_layer_id]->WaitForCommunication();
+    ClearPendingBlobs(pending_layer_id);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::ClearPendingBlobs(const int layer_id) {
+  for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+    blob_pending_layer_[bottom_id_vecs_[layer_id][i]] = -1;
+  }
+  for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+    blob_pending_layer_[top_id_vecs_[layer_id][i]] = -1;
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::DetermineLayerParallelOrSerial(const NetParameter& param) {
   serial_layers_.clear();
+  sharded_layers_.clear();
   int num_layers = param.layer_size();
   // First pass: set serial according to the layer type.
   for (int i = 0; i < num_layers; ++i) {
@@ -1017,6 +2170,12 @@ void Net<Dtype>::DetermineLayerParallelOrSerial(const NetParameter& param) {
 	layer_type == "MPIGather") {
       serial_layers_.insert(layer_name);
     }
+    // Model-parallel layers produce a replicated output, so everything above
+    // them is still serial, but their parameters are sharded.
+    if (layer_type == "InnerProduct" &&
+        layer_param.inner_product_param().model_parallel()) {
+      sharded_layers_.insert(layer_name);
+    }
   }
   // Build the DAG
   vector<set<string> > layer_bottoms(num_layers);
@@ -4,9 +4,14 @@
 #include <string>
 #include <vector>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "hdf5.h"
 #include "hdf5_hl.h"
 
+#include "caffe/loss_layers.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/solver.hpp"
@@ -14,10 +19,47 @@
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/upgrade_proto.hpp"
+#include "caffe/util/mpi_shard.hpp"
 #include "caffe/util/mpi_templates.hpp"
 
 namespace caffe {
 
+#ifdef USE_MPI
+// Whether a history blob belongs to a param sharded by a model-parallel layer.
+// AdaDelta appends a second history blob per param after the first ones.
+template <typename Dtype>
+static bool HistoryIsSharded(const Net<Dtype>& net, int history_id) {
+  const vector<bool>& sharded = net.learnable_params_sharded();
+  return sharded[history_id % sharded.size()];
+}
+#endif
+
+void SnapshotWriter::Start(const string& model_filename,
+    const string& state_filename) {
+  CHECK(!is_started()) << "A snapshot is already being written.";
+  model_filename_ = model_filename;
+  state_filename_ = state_filename;
+  CHECK(StartInternalThread()) << "Snapshot writer thread could not start.";
+}
+
+// Each file is written under a temporary name first, so that a crash while
+// writing never leaves a truncated snapshot behind.
+static void WriteProtoToBinaryFileAtomic(const Message& proto,
+    const string& filename) {
+  const string tmp_filename = filename + ".tmp";
+  WriteProtoToBinaryFile(proto, tmp_filename);
+  CHECK_EQ(std::rename(tmp_filename.c_str(), filename.c_str()), 0)
+      << "Couldn't rename " << tmp_filename << " to " << filename;
+}
+
+void SnapshotWriter::InternalThreadEntry() {
+  WriteProtoToBinaryFileAtomic(net_param_, model_filename_);
+  LOG(INFO) << "Snapshotting solver state to binary proto file "
+            << state_filename_;
+  WriteProtoToBinaryFileAtomic(state_, state_filename_);
+  LOG(INFO) << "Snapshot " << model_filename_ << " written";
+}
+
 template <typename Dtype>
 Solver<Dtype>::Solver(const SolverParameter& param)
     : net_() {
@@ -38,6 +80,15 @@ void Solver<Dtype>::Init(const SolverParameter& param) {
             << param.DebugString();
   param_ = param;
   CHECK_GE(param_.average_loss(), 1) << "average_loss should be non-negative.";
+  test_iter_ = 0;
+  test_async_ = param_.test_async();
+#ifdef USE_MPI
+  if (test_async_ && Caffe::mpi_size() > 1) {
+    // The test would run its collectives concurrently with the training ones.
+    LOG(WARNING) << "test_async is ignored when running on several processes.";
+    test_async_ = false;
+  }
+#endif
   if (param_.random_seed() >= 0) {
     Caffe::set_random_seed(param_.random_seed());
   }
@@ -159,6 +210,11 @@ void Solver<Dtype>::InitTestNets() {
       net_state.MergeFrom(param_.test_state(i));
     }
     net_params[i].mutable_state()->CopyFrom(net_state);
+#ifdef USE_MPI
+    if (param_.distributed_test()) {
+      net_params[i].set_mpi_data_parallel(true);
+    }
+#endif
     LOG(INFO)
         << "Creating test net (#" << i << ") specified by " << sources[i];
     test_nets_[i].reset(new Net<Dtype>(net_params[i]));
@@ -209,9 +265,21 @@ void Solver<Dtype>::Step(int iters) {
       const vector<Blob<Dtype>*>& result = net_->output_blobs();
       int score_index = 0;
       for (int j = 0; j < result.size(); ++j) {
-        /// TODO: Check whether the result is an output of a parallel layer.
-        /// If so, average across MPI processes.
         const Dtype* result_vec = result[j]->cpu_data();
+#ifdef USE_MPI
+        // Outputs of parallel layers only cover this process' part of the
+        // batch, so average them across the MPI processes.
+        vector<Dtype> mean_result;
+        if (net_->IsParallelBlob(net_->output_blob_indices()[j])) {
+          mean_result.assign(result_vec, result_vec + result[j]->count());
+          MPIAllreduce<Dtype>(mean_result.size(), MPI_IN_PLACE,
+              &mean_result[0], MPI_SUM);
+          for (int k = 0; k < mean_result.size(); ++k) {
+            mean_result[k] /= Caffe::mpi_size();
+          }
+          result_vec = &mean_result[0];
+        }
+#endif
         const string& output_name =
             net_->blob_names()[net_->output_blob_indices()[j]];
         const Dtype loss_weight =
@@ -260,6 +328,9 @@ void Solver<Dtype>::Solve(const char* resume_file) {
       && (!param_.snapshot() || iter_ % param_.snapshot() != 0)) {
     Snapshot();
   }
+  if (snapshot_writer_) {
+    snapshot_writer_->Wait();
+  }
   // After the optimization is done, run an additional train and test pass to
   // display the train and test loss/outputs if appropriate (based on the
   // display and test_interval settings, respectively).  Unlike in the rest of
@@ -274,26 +345,114 @@ void Solver<Dtype>::Solve(const char* resume_file) {
   if (param_.test_interval() && iter_ % param_.test_interval() == 0) {
     TestAll();
   }
+  if (test_thread_) {
+    test_thread_->WaitForInternalThreadToExit();
+  }
   LOG(INFO) << "Optimization Done.";
 }
 
 template <typename Dtype>
 void Solver<Dtype>::TestAll() {
+  if (test_async_) {
+    TestAllAsync();
+    return;
+  }
+  test_iter_ = iter_;
+#ifdef USE_MPI
+  for (int test_net_id = 0; test_net_id < test_nets_.size(); ++test_net_id) {
+    if (test_nets_[test_net_id]->data_parallel()) {
+      // The test nets share the params of the train net, whose serial layers
+      // are only up to date on the root process.
+      net_->SyncSerialLayers();
+      break;
+    }
+  }
+#endif
   for (int test_net_id = 0; test_net_id < test_nets_.size(); ++test_net_id) {
     Test(test_net_id);
   }
 }
 
+template <typename Dtype>
+void Solver<Dtype>::TestAllAsync() {
+  if (!test_thread_) {
+    test_thread_.reset(new TestThread(this));
+  }
+  // Only one test may be in flight, as the test nets hold the weights.
+  if (test_thread_->is_started()) {
+    LOG(INFO) << "Iteration " << iter_ << ", waiting for the test of "
+              << "iteration " << test_iter_;
+    test_thread_->WaitForInternalThreadToExit();
+  }
+  test_iter_ = iter_;
+  for (int test_net_id = 0; test_net_id < test_nets_.size(); ++test_net_id) {
+    CHECK_NOTNULL(test_nets_[test_net_id].get())->
+        CopyTrainedLayersFrom(net_.get());
+  }
+  test_thread_->Start();
+}
+
+template <typename Dtype>
+void Solver<Dtype>::TestThread::Start() {
+#ifndef CPU_ONLY
+  if (Caffe::mode() == Caffe::GPU) {
+    CUDA_CHECK(cudaGetDevice(&device_));
+  }
+#endif
+  rng_seed_ = caffe_rng_rand();
+  CHECK(StartInternalThread()) << "Test thread could not start.";
+}
+
+template <typename Dtype>
+void Solver<Dtype>::TestThread::InternalThreadEntry() {
+  // The Caffe singleton, with its mode and cuBLAS/cuRAND handles, is shared
+  // with the training thread and must be left alone; only the current CUDA
+  // device and the boost rng are per thread.
+#ifndef CPU_ONLY
+  if (Caffe::mode() == Caffe::GPU) {
+    CUDA_CHECK(cudaSetDevice(device_));
+  }
+#endif
+  Caffe::RNG rng(rng_seed_);
+  Caffe::set_thread_rng_stream(&rng);
+  const int num_threads = solver_->param_.test_threads();
+  if (num_threads > 0) {
+#ifdef _OPENMP
+    omp_set_num_threads(num_threads);
+#endif
+#ifdef USE_MKL
+    mkl_set_num_threads_local(num_threads);
+#endif
+  }
+  for (int test_net_id = 0; test_net_id < solver_->test_nets_.size();
+       ++test_net_id) {
+    solver_->Test(test_net_id);
+  }
+  Caffe::set_thread_rng_stream(NULL);
+}
+
 template <typename Dtype>
 void Solver<Dtype>::Test(const int test_net_id) {
-  LOG(INFO) << "Iteration " << iter_
+  LOG(INFO) << "Iteration " << test_iter_
             << ", Testing net (#" << test_net_id << ")";
-  CHECK_NOTNULL(test_nets_[test_net_id].get())->
-      ShareTrainedLayersWith(net_.get());
+  if (!test_async_) {
+    CHECK_NOTNULL(test_nets_[test_net_id].get())->
+        ShareTrainedLayersWith(net_.get());
+  }
   vector<Dtype> test_score;
   vector<int> test_score_output_id;
   vector<Blob<Dtype>*> bottom_vec;
   const shared_ptr<Net<Dtype> >& test_net = test_nets_[test_net_id];
+  // The multi-label AP layers accumulate their scores over the whole test.
+  vector<MultiLabelAPLayer<Dtype>*> ap_layers;
+  for (int i = 0; i < test_net->layers().size(); ++i) {
+    MultiLabelAPLayer<Dtype>* ap_layer =
+        dynamic_cast<MultiLabelAPLayer<Dtype>*>(test_net->layers()[i].get());
+    if (ap_layer) {
+      ap_layer->ResetStatistics();
+      ap_layers.push_back(ap_layer);
+    }
+  }
   Dtype loss = 0;
   for (int i = 0; i < param_.test_iter(test_net_id); ++i) {
     Dtype iter_loss;
@@ -320,8 +479,24 @@ void Solver<Dtype>::Test(const int test_net_id) {
       }
     }
   }
+  Dtype num_test_iters = param_.test_iter(test_net_id);
+#ifdef USE_MPI
+  if (test_net->data_parallel()) {
+    // Every process has evaluated its own shard of each test batch; sum the
+    // scores, the loss and the number of evaluations over all of them.
+    vector<Dtype> reduce_buffer(test_score);
+    reduce_buffer.push_back(loss);
+    reduce_buffer.push_back(num_test_iters);
+    MPIAllreduce<Dtype>(reduce_buffer.size(), MPI_IN_PLACE, &reduce_buffer[0],
+        MPI_SUM);
+    std::copy(reduce_buffer.begin(), reduce_buffer.begin() + test_score.size(),
+        test_score.begin());
+    loss = reduce_buffer[test_score.size()];
+    num_test_iters = reduce_buffer[test_score.size() + 1];
+  }
+#endif
   if (param_.test_compute_loss()) {
-    loss /= param_.test_iter(test_net_id);
+    loss /= num_test_iters;
     LOG(INFO) << "Test loss: " << loss;
   }
   for (int i = 0; i < test_score.size(); ++i) {
@@ -330,7 +505,7 @@ void Solver<Dtype>::Test(const int test_net_id) {
     const string& output_name = test_net->blob_names()[output_blob_index];
     const Dtype loss_weight = test_net->blob_loss_weights()[output_blob_index];
     ostringstream loss_msg_stream;
-    Dtype mean_score = test_score[i] / param_.test_iter(test_net_id);
+    Dtype mean_score = test_score[i] / num_test_iters;
     if (loss_weight) {
       loss_msg_stream << " (* " << loss_weight
                       << " = " << loss_weight * mean_score << " loss)";
@@ -338,13 +513,51 @@ void Solver<Dtype>::Test(const int test_net_id) {
     LOG(INFO) << "    Test net output #" << i << ": " << output_name << " = "
         << mean_score << loss_msg_stream.str();
   }
+  for (int i = 0; i < ap_layers.size(); ++i) {
+#ifdef USE_MPI
+    if (test_net->data_parallel()) {
+      ap_layers[i]->ReduceStatistics();
+    }
+#endif
+    vector<Dtype> ap;
+    const Dtype mean_ap = ap_layers[i]->ComputeAP(&ap);
+    const string& layer_name = ap_layers[i]->layer_param().name();
+    for (int j = 0; j < ap.size(); ++j) {
+      if (ap[j] < 0) {
+        LOG(INFO) << "    Test net " << layer_name << " AP #" << j
+            << " = n/a (no positive instances)";
+      } else {
+        LOG(INFO) << "    Test net " << layer_name << " AP #" << j
+            << " = " << ap[j];
+      }
+    }
+    LOG(INFO) << "    Test net " << layer_name << " mAP = " << mean_ap;
+  }
 }
 
 template <typename Dtype>
 void Solver<Dtype>::Snapshot() {
 #ifdef USE_MPI
-  if (Caffe::mpi_rank() != 0) return;
+  if (!net_->sharded_layers().empty()) {
+    CHECK_EQ(param_.snapshot_format(),
+        caffe::SolverParameter_SnapshotFormat_BINARYPROTO)
+        << "Model-parallel layers can only be snapshotted to binary proto.";
+  }
+  if (Caffe::mpi_rank() != 0) {
+    if (net_->sharded_layers().empty()) return;
+    // The model-parallel layers gather their shards to the root while it
+    // serializes the net and the solver state, so take part in that.
+    NetParameter net_param;
+    net_->ToProto(&net_param, param_.snapshot_diff());
+    SnapshotSolverState("");
+    return;
+  }
 #endif
+  if (param_.snapshot_async() && param_.snapshot_format() ==
+      caffe::SolverParameter_SnapshotFormat_BINARYPROTO) {
+    SnapshotAsync();
+    return;
+  }
   string model_filename;
   switch (param_.snapshot_format()) {
     case caffe::SolverParameter_SnapshotFormat_BINARYPROTO:
@@ -360,6 +573,21 @@ void Solver<Dtype>::Snapshot() {
   SnapshotSolverState(model_filename);
 }
 
+template <typename Dtype>
+void Solver<Dtype>::SnapshotAsync() {
+  if (!snapshot_writer_) {
+    snapshot_writer_.reset(new SnapshotWriter());
+  }
+  // Only one snapshot may be in flight, as the staging protos are reused.
+  snapshot_writer_->Wait();
+  string model_filename = SnapshotFilename(".caffemodel");
+  LOG(INFO) << "Snapshotting to binary proto file " << model_filename
+            << " in the background";
+  net_->ToProto(snapshot_writer_->net_param(), param_.snapshot_diff());
+  SnapshotSolverStateToProto(model_filename, snapshot_writer_->state());
+  snapshot_writer_->Start(model_filename, SnapshotFilename(".solverstate"));
+}
+
 template <typename Dtype>
 string Solver<Dtype>::SnapshotFilename(const string extension) {
   string filename(param_.snapshot_prefix());
@@ -481,9 +709,27 @@ void SGDSolver<Dtype>::ClipGradients() {
   if (clip_gradients < 0) { return; }
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
   Dtype sumsq_diff = 0;
+#ifdef USE_MPI
+  // Sharded params hold a different slice on each rank, so their share of
+  // the norm is summed over the ranks; the others are already identical.
+  const vector<bool>& sharded = this->net_->learnable_params_sharded();
+  Dtype sharded_sumsq_diff = 0;
+  for (int i = 0; i < net_params.size(); ++i) {
+    if (sharded[i]) {
+      sharded_sumsq_diff += net_params[i]->sumsq_diff();
+    } else {
+      sumsq_diff += net_params[i]->sumsq_diff();
+    }
+  }
+  if (!this->net_->sharded_layers().empty()) {
+    MPIAllreduce<Dtype>(1, MPI_IN_PLACE, &sharded_sumsq_diff, MPI_SUM);
+  }
+  sumsq_diff += sharded_sumsq_diff;
+#else
   for (int i = 0; i < net_params.size(); ++i) {
     sumsq_diff += net_params[i]->sumsq_diff();
   }
+#endif
   const Dtype l2norm_diff = std::sqrt(sumsq_diff);
   if (l2norm_diff > clip_gradients) {
     Dtype scale_factor = clip_gradients / l2norm_diff;
@@ -520,6 +766,14 @@ void SGDSolver<Dtype>::ApplyUpdate() {
 #endif
 
   ClipGradients();
+  if (Caffe::mode() == Caffe::CPU && this->param_.fused_update() &&
+      HasFusedUpdate()) {
+    for (int param_id = 0; param_id < this->net_->learnable_params().size();
+         ++param_id) {
+      ComputeFusedUpdate_cpu(param_id, rate);
+    }
+    return;
+  }
   for (int param_id = 0; param_id < this->net_->learnable_params().size();
        ++param_id) {
     Normalize(param_id);
@@ -529,6 +783,57 @@ void SGDSolver<Dtype>::ApplyUpdate() {
   this->net_->Update();
 }
 
+// The fused updates below are spread over the OpenMP threads (when built with
+// USE_OPENMP) for params larger than kFusedUpdateGrain elements; the loop
+// bodies are simple enough for the compiler to vectorize.
+static const int kFusedUpdateGrain = 1 << 15;
+
+// The gradient after normalization and weight decay, as computed by
+// SGDSolver::Normalize() and SGDSolver::Regularize().
+template <typename Dtype>
+inline Dtype RegularizedGradient(Dtype diff, Dtype data, Dtype normalization,
+    Dtype decay, bool l1) {
+  const Dtype penalty = l1 ? Dtype((data > 0) - (data < 0)) : data;
+  return normalization * diff + decay * penalty;
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::GetFusedUpdateScalars(int param_id, Dtype* normalization,
+    Dtype* local_decay, bool* l1) {
+  const string& regularization_type = this->param_.regularization_type();
+  CHECK(regularization_type == "L1" || regularization_type == "L2")
+      << "Unknown regularization type: " << regularization_type;
+  *normalization = Dtype(1) / this->param_.iter_size();
+  *local_decay = this->param_.weight_decay() *
+      this->net_->params_weight_decay()[param_id];
+  *l1 = (regularization_type == "L1");
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ComputeFusedUpdate_cpu(int param_id, Dtype rate) {
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  Dtype normalization, local_decay;
+  bool l1;
+  GetFusedUpdateScalars(param_id, &normalization, &local_decay, &l1);
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const Dtype momentum = this->param_.momentum();
+  const int count = param->count();
+  Dtype* data = param->mutable_cpu_data();
+  Dtype* diff = param->mutable_cpu_diff();
+  Dtype* history = history_[param_id]->mutable_cpu_data();
+#ifdef _OPENMP
+  #pragma omp parallel for if (count > kFusedUpdateGrain) schedule(static)
+#endif
+  for (int i = 0; i < count; ++i) {
+    const Dtype grad = RegularizedGradient(diff[i], data[i], normalization,
+        local_decay, l1);
+    const Dtype update = local_rate * grad + momentum * history[i];
+    history[i] = update;
+    diff[i] = update;
+    data[i] -= update;
+  }
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::Normalize(int param_id) {
   if (this->param_.iter_size() == 1) { return; }
@@ -667,18 +972,33 @@ void SGDSolver<Dtype>::SnapshotSolverState(const string& model_filename) {
 }
 
 template <typename Dtype>
-void SGDSolver<Dtype>::SnapshotSolverStateToBinaryProto(
-    const string& model_filename) {
-  SolverState state;
-  state.set_iter(this->iter_);
-  state.set_learned_net(model_filename);
-  state.set_current_step(this->current_step_);
-  state.clear_history();
+void SGDSolver<Dtype>::SnapshotSolverStateToProto(
+    const string& model_filename, SolverState* state) {
+  state->set_iter(this->iter_);
+  state->set_learned_net(model_filename);
+  state->set_current_step(this->current_step_);
+  state->clear_history();
   for (int i = 0; i < history_.size(); ++i) {
     // Add history
-    BlobProto* history_blob = state.add_history();
+    BlobProto* history_blob = state->add_history();
+#ifdef USE_MPI
+    if (HistoryIsSharded(*this->net_, i)) {
+      GatherBlobRowsToProto(*history_[i], history_blob);
+      continue;
+    }
+#endif
     history_[i]->ToProto(history_blob);
   }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::SnapshotSolverStateToBinaryProto(
+    const string& model_filename) {
+  SolverState state;
+  SnapshotSolverStateToProto(model_filename, &state);
+#ifdef USE_MPI
+  if (Caffe::mpi_rank() != 0) return;
+#endif
   string snapshot_filename = Solver<Dtype>::SnapshotFilename(".solverstate");
   LOG(INFO)
     << "Snapshotting solver state to binary proto file" << snapshot_filename;
@@ -728,6 +1048,11 @@ void SGDSolver<Dtype>::RestoreSolverStateFromBinaryProto(
   LOG(INFO) << "SGDSolver: restoring history";
   for (int i = 0; i < history_.size(); ++i) {
     history_[i]->FromProto(state.history(i));
+#ifdef USE_MPI
+    if (HistoryIsSharded(*this->net_, i)) {
+      ShardBlobRows(history_[i].get());
+    }
+#endif
   }
 }
 
@@ -751,6 +1076,11 @@ void SGDSolver<Dtype>::RestoreSolverStateFromHDF5(const string& state_file) {
     oss << i;
     hdf5_load_nd_dataset<Dtype>(history_hid, oss.str().c_str(), 0,
                                 kMaxBlobAxes, history_[i].get());
+#ifdef USE_MPI
+    if (HistoryIsSharded(*this->net_, i)) {
+      ShardBlobRows(history_[i].get());
+    }
+#endif
   }
   H5Gclose(history_hid);
   H5Fclose(file_hid);
@@ -816,6 +1146,35 @@ void NesterovSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void NesterovSolver<Dtype>::ComputeFusedUpdate_cpu(int param_id, Dtype rate) {
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  Dtype normalization, local_decay;
+  bool l1;
+  this->GetFusedUpdateScalars(param_id, &normalization, &local_decay, &l1);
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const Dtype momentum = this->param_.momentum();
+  const int count = param->count();
+  Dtype* data = param->mutable_cpu_data();
+  Dtype* diff = param->mutable_cpu_diff();
+  Dtype* history = this->history_[param_id]->mutable_cpu_data();
+#ifdef _OPENMP
+  #pragma omp parallel for if (count > kFusedUpdateGrain) schedule(static)
+#endif
+  for (int i = 0; i < count; ++i) {
+    const Dtype grad = RegularizedGradient(diff[i], data[i], normalization,
+        local_decay, l1);
+    const Dtype history_prev = history[i];
+    const Dtype history_new = local_rate * grad + momentum * history_prev;
+    // step back then over step
+    const Dtype update = (Dtype(1) + momentum) * history_new -
+        momentum * history_prev;
+    history[i] = history_new;
+    diff[i] = update;
+    data[i] -= update;
+  }
+}
+
 template <typename Dtype>
 void AdaGradSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
@@ -894,6 +1253,32 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdaGradSolver<Dtype>::ComputeFusedUpdate_cpu(int param_id, Dtype rate) {
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  Dtype normalization, local_decay;
+  bool l1;
+  this->GetFusedUpdateScalars(param_id, &normalization, &local_decay, &l1);
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const Dtype delta = this->param_.delta();
+  const int count = param->count();
+  Dtype* data = param->mutable_cpu_data();
+  Dtype* diff = param->mutable_cpu_diff();
+  Dtype* history = this->history_[param_id]->mutable_cpu_data();
+#ifdef _OPENMP
+  #pragma omp parallel for if (count > kFusedUpdateGrain) schedule(static)
+#endif
+  for (int i = 0; i < count; ++i) {
+    const Dtype grad = RegularizedGradient(diff[i], data[i], normalization,
+        local_decay, l1);
+    const Dtype history_new = history[i] + grad * grad;
+    const Dtype update = local_rate * grad / (std::sqrt(history_new) + delta);
+    history[i] = history_new;
+    diff[i] = update;
+    data[i] -= update;
+  }
+}
+
 template <typename Dtype>
 void RMSPropSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
@@ -8,7 +8,7 @@ namespace caffe {
 
 SyncedMemory::~SyncedMemory() {
   if (cpu_ptr_ && own_cpu_data_) {
-    CaffeFreeHost(cpu_ptr_);
+    CaffeFreeHost(cpu_ptr_, size_);
   }
 
 #ifndef CPU_ONLY
@@ -18,11 +18,13 @@ SyncedMemory::~SyncedMemory() {
 #endif  // CPU_ONLY
 }
 
-inline void SyncedMemory::to_cpu() {
+inline void SyncedMemory::to_cpu(bool zero_fill) {
   switch (head_) {
   case UNINITIALIZED:
     CaffeMallocHost(&cpu_ptr_, size_);
-    caffe_memset(size_, 0, cpu_ptr_);
+    if (zero_fill) {
+      caffe_memset(size_, 0, cpu_ptr_);
+    }
     head_ = HEAD_AT_CPU;
     own_cpu_data_ = true;
     break;
@@ -76,7 +78,7 @@ const void* SyncedMemory::cpu_data() {
 void SyncedMemory::set_cpu_data(void* data) {
   CHECK(data);
   if (own_cpu_data_) {
-    CaffeFreeHost(cpu_ptr_);
+    CaffeFreeHost(cpu_ptr_, size_);
   }
   cpu_ptr_ = data;
   head_ = HEAD_AT_CPU;
@@ -98,6 +100,12 @@ void* SyncedMemory::mutable_cpu_data() {
   return cpu_ptr_;
 }
 
+void* SyncedMemory::mutable_cpu_data_for_overwrite() {
+  to_cpu(false);
+  head_ = HEAD_AT_CPU;
+  return cpu_ptr_;
+}
+
 void* SyncedMemory::mutable_gpu_data() {
 #ifndef CPU_ONLY
   to_gpu();
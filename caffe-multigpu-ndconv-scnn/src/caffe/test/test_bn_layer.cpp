@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/common_layers.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class BNLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+ protected:
+  BNLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 4, 5)),
+        blob_top_(new Blob<Dtype>()) {
+    // fill the values
+    FillerParameter filler_param;
+    filler_param.set_mean(2);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    layer_param_.mutable_bn_param()->mutable_slope_filler()->set_value(2);
+    layer_param_.mutable_bn_param()->mutable_bias_filler()->set_value(1);
+  }
+  virtual ~BNLayerTest() { delete blob_bottom_; delete blob_top_; }
+
+  // Reshapes the bottom to a clip with two spatial axes besides time.
+  void ReshapeBottom5D() {
+    vector<int> shape(5);
+    shape[0] = 2;
+    shape[1] = 3;
+    shape[2] = 2;
+    shape[3] = 3;
+    shape[4] = 4;
+    blob_bottom_->Reshape(shape);
+    FillerParameter filler_param;
+    filler_param.set_mean(2);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+  }
+
+  // Checks that each channel of the top has mean 1 and standard deviation 2,
+  // the bias and slope set by the fixture.
+  void CheckTopStatistics() {
+    const int num = blob_top_->shape(0);
+    const int channels = blob_top_->shape(1);
+    const int spatial_dim = blob_top_->count(2);
+    const Dtype* top_data = blob_top_->cpu_data();
+    for (int c = 0; c < channels; ++c) {
+      Dtype sum = 0, var = 0;
+      for (int n = 0; n < num; ++n) {
+        for (int i = 0; i < spatial_dim; ++i) {
+          const Dtype data = top_data[(n * channels + c) * spatial_dim + i];
+          sum += data;
+          var += (data - 1) * (data - 1);
+        }
+      }
+      sum /= num * spatial_dim;
+      var /= num * spatial_dim;
+      const Dtype kErrorBound = 0.001;
+      EXPECT_NEAR(1, sum, kErrorBound);
+      EXPECT_NEAR(4, var, kErrorBound);
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  LayerParameter layer_param_;
+};
+
+TYPED_TEST_CASE(BNLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(BNLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  BNLayer<Dtype> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  this->CheckTopStatistics();
+}
+
+TYPED_TEST(BNLayerTest, TestForward5D) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->ReshapeBottom5D();
+  BNLayer<Dtype> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_->shape(), this->blob_bottom_->shape());
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  this->CheckTopStatistics();
+}
+
+TYPED_TEST(BNLayerTest, TestForwardMovingAverage) {
+  typedef typename TypeParam::Dtype Dtype;
+  BNLayer<Dtype> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // The running statistics start at zero and move towards the batch ones.
+  const Dtype momentum = this->layer_param_.bn_param().momentum();
+  const Dtype* mean = layer.blobs()[2]->cpu_data();
+  const Dtype* variance = layer.blobs()[3]->cpu_data();
+  const int spatial_dim = this->blob_bottom_->count(2);
+  for (int c = 0; c < this->blob_bottom_->channels(); ++c) {
+    Dtype sum = 0, sum_squares = 0;
+    for (int n = 0; n < this->blob_bottom_->num(); ++n) {
+      const Dtype* data = this->blob_bottom_->cpu_data() +
+          this->blob_bottom_->offset(n, c);
+      for (int i = 0; i < spatial_dim; ++i) {
+        sum += data[i];
+        sum_squares += data[i] * data[i];
+      }
+    }
+    const int size = this->blob_bottom_->num() * spatial_dim;
+    const Dtype batch_mean = sum / size;
+    const Dtype batch_variance = sum_squares / size - batch_mean * batch_mean;
+    const Dtype kErrorBound = 0.001;
+    EXPECT_NEAR((1 - momentum) * batch_mean, mean[c], kErrorBound);
+    EXPECT_NEAR((1 - momentum) * batch_variance, variance[c], kErrorBound);
+  }
+}
+
+TYPED_TEST(BNLayerTest, TestForwardInPlace) {
+  typedef typename TypeParam::Dtype Dtype;
+  BNLayer<Dtype> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  BNLayer<Dtype> in_place_layer(this->layer_param_);
+  in_place_layer.SetUp(this->blob_bottom_vec_, this->blob_bottom_vec_);
+  in_place_layer.Forward(this->blob_bottom_vec_, this->blob_bottom_vec_);
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+        this->blob_bottom_->cpu_data()[i], 1e-5);
+  }
+}
+
+#ifdef USE_MPI
+TYPED_TEST(BNLayerTest, TestForwardSyncStats) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The same global batch on every process, two images each, with a mean
+  // much larger than its deviation.
+  const int num_per_process = 2;
+  vector<int> shape = this->blob_bottom_->shape();
+  shape[0] = num_per_process * Caffe::mpi_size();
+  Blob<Dtype> global_bottom(shape);
+  Blob<Dtype> global_top;
+  FillerParameter filler_param;
+  filler_param.set_mean(1000);
+  Caffe::set_random_seed(1701);
+  GaussianFiller<Dtype> filler(filler_param);
+  vector<Blob<Dtype>*> global_bottom_vec(1, &global_bottom);
+  vector<Blob<Dtype>*> global_top_vec(1, &global_top);
+  this->layer_param_.mutable_bn_param()->set_moving_average(true);
+  BNLayer<Dtype> global_layer(this->layer_param_);
+  global_layer.SetUp(global_bottom_vec, global_top_vec);
+  // Each process normalizes its own part with the synced statistics.
+  shape[0] = num_per_process;
+  this->blob_bottom_->Reshape(shape);
+  const int offset = global_bottom.offset(num_per_process * Caffe::mpi_rank());
+  this->layer_param_.mutable_bn_param()->set_sync_stats(true);
+  BNLayer<Dtype> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const vector<bool> propagate_down(1, true);
+  const Dtype kErrorBound = 1e-3;
+  // The second pass takes its sums about the mean of the first.
+  for (int pass = 0; pass < 2; ++pass) {
+    filler.Fill(&global_bottom);
+    global_layer.Forward(global_bottom_vec, global_top_vec);
+    caffe_rng_gaussian<Dtype>(global_top.count(), Dtype(0), Dtype(1),
+        global_top.mutable_cpu_diff());
+    global_layer.Backward(global_top_vec, propagate_down, global_bottom_vec);
+    caffe_copy(this->blob_bottom_->count(), global_bottom.cpu_data() + offset,
+        this->blob_bottom_->mutable_cpu_data());
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_copy(this->blob_top_->count(), global_top.cpu_diff() + offset,
+        this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+    // The running mean and variance.
+    for (int i = 2; i < 4; ++i) {
+      for (int c = 0; c < this->blob_bottom_->channels(); ++c) {
+        const Dtype expected = global_layer.blobs()[i]->cpu_data()[c];
+        EXPECT_NEAR(expected, layer.blobs()[i]->cpu_data()[c],
+            kErrorBound * std::max(Dtype(1), std::fabs(expected)));
+      }
+    }
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(global_top.cpu_data()[offset + i],
+          this->blob_top_->cpu_data()[i], kErrorBound);
+      EXPECT_NEAR(global_bottom.cpu_diff()[offset + i],
+          this->blob_bottom_->cpu_diff()[i], kErrorBound);
+    }
+  }
+}
+#endif  // USE_MPI
+
+TYPED_TEST(BNLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  BNLayer<Dtype> layer(this->layer_param_);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(BNLayerTest, TestGradient5D) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->ReshapeBottom5D();
+  BNLayer<Dtype> layer(this->layer_param_);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+}  // namespace caffe
@@ -25,7 +25,7 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
  protected:
   GradientBasedSolverTest() :
       seed_(1701), num_(4), channels_(3), height_(10), width_(10),
-      share_(false) {
+      share_(false), snapshot_async_(false), fused_update_(true) {
         input_file_ = new string(
         CMAKE_SOURCE_DIR "caffe/test/test_data/solver_data_list.txt" CMAKE_EXT);
       }
@@ -40,6 +40,8 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
   // TODO this is brittle and the hdf5 file should be checked instead.
   int num_, channels_, height_, width_;
   bool share_;
+  bool snapshot_async_;
+  bool fused_update_;
   Dtype delta_;  // Stability constant for AdaGrad.
 
   // Test data: check out generate_sample_data.py in the same directory.
@@ -171,10 +173,14 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     if (momentum != 0) {
       proto << "momentum: " << momentum << " ";
     }
+    if (!fused_update_) {
+      proto << "fused_update: false ";
+    }
     MakeTempDir(&snapshot_prefix_);
     proto << "snapshot_prefix: '" << snapshot_prefix_ << "/' ";
     if (snapshot) {
       proto << "snapshot: " << num_iters << " ";
+      proto << "snapshot_async: " << snapshot_async_ << " ";
     }
     Caffe::set_random_seed(this->seed_);
     this->InitSolverFromProtoString(proto.str());
@@ -410,6 +416,52 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     EXPECT_NEAR(expected_bias, accum_bias, error_margin);
   }
 
+  // Check that the fused CPU update leaves the same params and history as
+  // the separate Normalize/Regularize/ComputeUpdateValue/Update steps.
+  void CheckFusedUpdate(const Dtype kLearningRate, const Dtype kWeightDecay,
+      const Dtype kMomentum, const int kNumIters, const int kIterSize) {
+    const double kPrecision = 1e-4;
+    const double kMinPrecision = 1e-7;
+    // Solve with the unfused update and save params and history.
+    fused_update_ = false;
+    RunLeastSquaresSolver(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+        kIterSize);
+    vector<shared_ptr<Blob<Dtype> > > expected;
+    const vector<Blob<Dtype>*>& unfused_params =
+        solver_->net()->learnable_params();
+    const vector<shared_ptr<Blob<Dtype> > >& unfused_history =
+        solver_->history();
+    for (int i = 0; i < unfused_params.size(); ++i) {
+      expected.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      expected.back()->CopyFrom(*unfused_params[i], false, true);
+    }
+    for (int i = 0; i < unfused_history.size(); ++i) {
+      expected.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      expected.back()->CopyFrom(*unfused_history[i], false, true);
+    }
+    // Solve again with the fused update.
+    fused_update_ = true;
+    RunLeastSquaresSolver(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+        kIterSize);
+    vector<Blob<Dtype>*> actual = solver_->net()->learnable_params();
+    const vector<shared_ptr<Blob<Dtype> > >& history = solver_->history();
+    for (int i = 0; i < history.size(); ++i) {
+      actual.push_back(history[i].get());
+    }
+    ASSERT_EQ(expected.size(), actual.size());
+    for (int i = 0; i < actual.size(); ++i) {
+      ASSERT_EQ(expected[i]->count(), actual[i]->count());
+      for (int j = 0; j < actual[i]->count(); ++j) {
+        const Dtype expected_value = expected[i]->cpu_data()[j];
+        const Dtype actual_value = actual[i]->cpu_data()[j];
+        const Dtype error_margin = std::max(kMinPrecision, kPrecision *
+            std::min(fabs(expected_value), fabs(actual_value)));
+        EXPECT_NEAR(expected_value, actual_value, error_margin)
+            << "blob " << i << " differed at dim " << j;
+      }
+    }
+  }
+
   // Test that the correct update is computed for a regularized least squares
   // problem:
   //
@@ -630,6 +682,17 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingAccumShare) {
       kIterSize);
 }
 
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateFusedMatchesUnfused) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->CheckFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 TYPED_TEST(SGDSolverTest, TestSnapshot) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -653,6 +716,18 @@ TYPED_TEST(SGDSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestSnapshotAsync) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->snapshot_async_ = true;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 
 template <typename TypeParam>
 class AdaGradSolverTest : public GradientBasedSolverTest<TypeParam> {
@@ -733,6 +808,17 @@ TYPED_TEST(AdaGradSolverTest, TestLeastSquaresUpdateWithEverythingAccumShare) {
       kIterSize);
 }
 
+TYPED_TEST(AdaGradSolverTest, TestLeastSquaresUpdateFusedMatchesUnfused) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->CheckFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 TYPED_TEST(AdaGradSolverTest, TestSnapshot) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -870,6 +956,17 @@ TYPED_TEST(NesterovSolverTest, TestLeastSquaresUpdateWithEverythingAccumShare) {
       kIterSize);
 }
 
+TYPED_TEST(NesterovSolverTest, TestLeastSquaresUpdateFusedMatchesUnfused) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->CheckFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 TYPED_TEST(NesterovSolverTest, TestSnapshot) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -1055,7 +1152,7 @@ TYPED_TEST(RMSPropSolverTest, TestRMSPropLeastSquaresUpdateWithRmsDecay) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
   const Dtype kWeightDecay = 0.0;
-  const Dtype kMomentum = 0.0;
+  const Dtype kMomentum = 0;
   const int kNumIters = 4;
   for (int i = 0; i <= kNumIters; ++i) {
     this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
@@ -1066,7 +1163,7 @@ TYPED_TEST(RMSPropSolverTest, TestRMSPropLeastSquaresUpdateWithEverything) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
   const Dtype kWeightDecay = 0.5;
-  const Dtype kMomentum = 0.0;
+  const Dtype kMomentum = 0;
   const int kNumIters = 4;
   for (int i = 0; i <= kNumIters; ++i) {
     this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
@@ -1078,7 +1175,7 @@ TYPED_TEST(RMSPropSolverTest,
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
   const Dtype kWeightDecay = 0.5;
-  const Dtype kMomentum = 0.0;
+  const Dtype kMomentum = 0;
   const int kNumIters = 4;
   this->share_ = true;
   for (int i = 0; i <= kNumIters; ++i) {
@@ -1090,7 +1187,7 @@ TYPED_TEST(RMSPropSolverTest, TestLeastSquaresUpdateWithEverythingAccum) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
   const Dtype kWeightDecay = 0.5;
-  const Dtype kMomentum = 0.0;
+  const Dtype kMomentum = 0;
   const int kNumIters = 4;
   const int kIterSize = 2;
   this->CheckAccumulation(kLearningRate, kWeightDecay, kMomentum, kNumIters,
@@ -1101,7 +1198,7 @@ TYPED_TEST(RMSPropSolverTest, TestLeastSquaresUpdateWithEverythingAccumShare) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
   const Dtype kWeightDecay = 0.5;
-  const Dtype kMomentum = 0.0;
+  const Dtype kMomentum = 0;
   const int kNumIters = 4;
   const int kIterSize = 2;
   this->share_ = true;
@@ -110,4 +110,106 @@ TYPED_TEST(InnerProductLayerTest, TestGradient) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestForwardFactored) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->set_rank(3);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  ASSERT_EQ(3, layer.blobs().size());
+  EXPECT_EQ(3, layer.blobs()[0]->shape(1));
+  EXPECT_EQ(3, layer.blobs()[2]->shape(0));
+  EXPECT_EQ(60, layer.blobs()[2]->shape(1));
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // The same as a dense layer with the product of the factors as weights.
+  const int num_output = 10, rank = 3, dim = 60;
+  const Dtype* factor_u = layer.blobs()[0]->cpu_data();
+  const Dtype* bias = layer.blobs()[1]->cpu_data();
+  const Dtype* factor_v = layer.blobs()[2]->cpu_data();
+  const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  for (int n = 0; n < this->blob_bottom_->num(); ++n) {
+    for (int i = 0; i < num_output; ++i) {
+      Dtype expected = bias[i];
+      for (int k = 0; k < dim; ++k) {
+        Dtype weight = 0;
+        for (int r = 0; r < rank; ++r) {
+          weight += factor_u[i * rank + r] * factor_v[r * dim + k];
+        }
+        expected += weight * bottom_data[n * dim + k];
+      }
+      EXPECT_NEAR(expected, top_data[n * num_output + i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestGradientFactored) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->set_rank(3);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+#ifdef USE_MPI
+TYPED_TEST(InnerProductLayerTest, TestForwardModelParallel) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_random_seed(1701);
+  shared_ptr<InnerProductLayer<Dtype> > layer(
+      new InnerProductLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> expected_top;
+  expected_top.CopyFrom(*this->blob_top_, false, true);
+  inner_product_param->set_model_parallel(true);
+  Caffe::set_random_seed(1701);
+  layer.reset(new InnerProductLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(layer->blobs()[0]->num(), 10 / Caffe::mpi_size());
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  ASSERT_EQ(this->blob_top_->count(), expected_top.count());
+  const Dtype* data = this->blob_top_->cpu_data();
+  const Dtype* expected_data = expected_top.cpu_data();
+  for (int i = 0; i < expected_top.count(); ++i) {
+    EXPECT_NEAR(data[i], expected_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestGradientModelParallel) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->set_model_parallel(true);
+  inner_product_param->set_gather_bottom(true);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_min(1);
+  inner_product_param->mutable_bias_filler()->set_max(2);
+  InnerProductLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+#endif  // USE_MPI
+
 }  // namespace caffe
@@ -229,6 +229,52 @@ TYPED_TEST(LRNLayerTest, TestForwardWithinChannel) {
   }
 }
 
+TYPED_TEST(LRNLayerTest, TestForwardWithinChannelBeta) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_lrn_param()->set_norm_region(
+      LRNParameter_NormRegion_WITHIN_CHANNEL);
+  layer_param.mutable_lrn_param()->set_local_size(3);
+  layer_param.mutable_lrn_param()->set_beta(0.6);
+  LRNLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> top_reference;
+  this->ReferenceLRNForward(*(this->blob_bottom_), layer_param,
+      &top_reference);
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i], top_reference.cpu_data()[i],
+                this->epsilon_);
+  }
+}
+
+TYPED_TEST(LRNLayerTest, TestForwardLargeInput) {
+  typedef typename TypeParam::Dtype Dtype;
+  // More than the 1 << 15 elements above which the CPU passes are threaded.
+  this->blob_bottom_->Reshape(2, 16, 32, 36);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  const LRNParameter_NormRegion regions[] = {
+      LRNParameter_NormRegion_ACROSS_CHANNELS,
+      LRNParameter_NormRegion_WITHIN_CHANNEL};
+  for (int r = 0; r < 2; ++r) {
+    LayerParameter layer_param;
+    layer_param.mutable_lrn_param()->set_norm_region(regions[r]);
+    layer_param.mutable_lrn_param()->set_local_size(r == 0 ? 5 : 3);
+    LRNLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<Dtype> top_reference;
+    this->ReferenceLRNForward(*(this->blob_bottom_), layer_param,
+        &top_reference);
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+                  top_reference.cpu_data()[i], this->epsilon_);
+    }
+  }
+}
+
 TYPED_TEST(LRNLayerTest, TestGradientWithinChannel) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
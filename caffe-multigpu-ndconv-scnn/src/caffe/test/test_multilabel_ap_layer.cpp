@@ -0,0 +1,100 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/loss_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class MultiLabelAPLayerTest : public CPUDeviceTest<Dtype> {
+ protected:
+  MultiLabelAPLayerTest()
+      : blob_bottom_score_(new Blob<Dtype>(3, 2, 1, 1)),
+        blob_bottom_label_(new Blob<Dtype>(3, 2, 1, 1)) {
+    blob_bottom_vec_.push_back(blob_bottom_score_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    layer_param_.mutable_multilabel_ap_param()->set_apply_sigmoid(false);
+  }
+  virtual ~MultiLabelAPLayerTest() {
+    delete blob_bottom_score_;
+    delete blob_bottom_label_;
+  }
+
+  // Fills the batch with 3 instances of 2 labels. The first label is
+  // positive for some instances, the second one for none.
+  void FillBatch(const Dtype* scores, const Dtype* labels) {
+    for (int i = 0; i < 3; ++i) {
+      blob_bottom_score_->mutable_cpu_data()[2 * i] = scores[i];
+      blob_bottom_score_->mutable_cpu_data()[2 * i + 1] = scores[i];
+      blob_bottom_label_->mutable_cpu_data()[2 * i] = labels[i];
+      blob_bottom_label_->mutable_cpu_data()[2 * i + 1] = 0;
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_score_;
+  Blob<Dtype>* const blob_bottom_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  LayerParameter layer_param_;
+};
+
+TYPED_TEST_CASE(MultiLabelAPLayerTest, TestDtypes);
+
+TYPED_TEST(MultiLabelAPLayerTest, TestAccumulate) {
+  MultiLabelAPLayer<TypeParam> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Ranked by score, the labels are 1 0 1 0 0 1 over the two batches.
+  const TypeParam scores[2][3] = {{0.9, 0.7, 0.5}, {0.8, 0.6, 0.4}};
+  const TypeParam labels[2][3] = {{1, 1, 0}, {0, 0, 1}};
+  for (int batch = 0; batch < 2; ++batch) {
+    this->FillBatch(scores[batch], labels[batch]);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  }
+  vector<TypeParam> ap;
+  const TypeParam mean_ap = layer.ComputeAP(&ap);
+  ASSERT_EQ(2, ap.size());
+  const TypeParam expected_ap = (1. + 2. / 3 + 3. / 6) / 3;
+  EXPECT_NEAR(expected_ap, ap[0], 1e-5);
+  EXPECT_EQ(-1, ap[1]);
+  EXPECT_NEAR(expected_ap, mean_ap, 1e-5);
+
+  layer.ResetStatistics();
+  this->FillBatch(scores[0], labels[0]);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_NEAR(1, layer.ComputeAP(&ap), 1e-5);
+}
+
+TYPED_TEST(MultiLabelAPLayerTest, TestTies) {
+  this->layer_param_.mutable_multilabel_ap_param()->set_num_bins(2);
+  MultiLabelAPLayer<TypeParam> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // The first two instances share the top bin.
+  const TypeParam scores[3] = {0.9, 0.8, 0.1};
+  const TypeParam labels[3] = {0, 1, 1};
+  this->FillBatch(scores, labels);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  vector<TypeParam> ap;
+  layer.ComputeAP(&ap);
+  EXPECT_NEAR((1. / 2 + 2. / 3) / 2, ap[0], 1e-5);
+}
+
+TYPED_TEST(MultiLabelAPLayerTest, TestIgnoreLabelAndSigmoid) {
+  this->layer_param_.mutable_multilabel_ap_param()->set_apply_sigmoid(true);
+  this->layer_param_.mutable_multilabel_ap_param()->set_ignore_label(-1);
+  MultiLabelAPLayer<TypeParam> layer(this->layer_param_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Without the ignored negative scoring highest, the positives come first.
+  const TypeParam scores[3] = {5, 2, -3};
+  const TypeParam labels[3] = {-1, 1, 0};
+  this->FillBatch(scores, labels);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  vector<TypeParam> ap;
+  EXPECT_NEAR(1, layer.ComputeAP(&ap), 1e-5);
+}
+
+}  // namespace caffe
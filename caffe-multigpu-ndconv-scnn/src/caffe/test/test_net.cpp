@@ -1,3 +1,4 @@
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
@@ -8,8 +9,12 @@
 
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/layer_factory.hpp"
 #include "caffe/net.hpp"
+#include "caffe/neuron_layers.hpp"
+#include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/weight_file.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -23,9 +28,11 @@ class NetTest : public MultiDeviceTest<TypeParam> {
  protected:
   NetTest() : seed_(1701) {}
 
-  virtual void InitNetFromProtoString(const string& proto) {
+  virtual void InitNetFromProtoString(const string& proto,
+      const Phase phase = TRAIN) {
     NetParameter param;
     CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    param.mutable_state()->set_phase(phase);
     net_.reset(new Net<Dtype>(param));
   }
 
@@ -55,6 +62,43 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // Trains the net of proto and the net of proto + extra_option from the same
+  // seed, and expects the same loss, params and param diffs at every
+  // iteration. Leaves net_ set to the net with the option.
+  virtual void ExpectSameTraining(const string& proto,
+      const string& extra_option, const int iterations) {
+    vector<Blob<Dtype>*> bottom;
+    Caffe::set_random_seed(seed_);
+    InitNetFromProtoString(proto);
+    // Data fillers refill on every forward, so keep the reference results of
+    // each iteration.
+    vector<Dtype> loss(iterations);
+    vector<shared_ptr<Blob<Dtype> > > params;
+    vector<vector<shared_ptr<Blob<Dtype> > > > param_diffs(iterations);
+    CopyNetParams(false, &params);
+    for (int i = 0; i < iterations; ++i) {
+      loss[i] = net_->ForwardBackward(bottom);
+      CopyNetParams(true, &param_diffs[i]);
+      net_->ClearParamDiffs();
+    }
+
+    Caffe::set_random_seed(seed_);
+    InitNetFromProtoString(proto + extra_option);
+    for (int i = 0; i < iterations; ++i) {
+      EXPECT_EQ(loss[i], net_->ForwardBackward(bottom));
+      const vector<shared_ptr<Blob<Dtype> > >& net_params = net_->params();
+      ASSERT_EQ(params.size(), net_params.size());
+      for (int j = 0; j < params.size(); ++j) {
+        for (int k = 0; k < params[j]->count(); ++k) {
+          EXPECT_EQ(params[j]->cpu_data()[k], net_params[j]->cpu_data()[k]);
+          EXPECT_EQ(param_diffs[i][j]->cpu_diff()[k],
+                    net_params[j]->cpu_diff()[k]);
+        }
+      }
+      net_->ClearParamDiffs();
+    }
+  }
+
   virtual void InitTinyNet(const bool force_backward = false,
                            const bool accuracy_layer = false) {
     string proto =
@@ -490,7 +534,7 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
-  virtual void InitDiffDataSharedWeightsNet() {
+  virtual void InitDiffDataSharedWeightsNet(const Phase phase = TRAIN) {
     const string& proto =
         "name: 'DiffDataSharedWeightsNetwork' "
         "layer { "
@@ -549,7 +593,7 @@ class NetTest : public MultiDeviceTest<TypeParam> {
         "  bottom: 'data2' "
         "  bottom: 'innerproduct2' "
         "} ";
-    InitNetFromProtoString(proto);
+    InitNetFromProtoString(proto, phase);
   }
 
   virtual void InitReshapableNet() {
@@ -1226,6 +1270,750 @@ TYPED_TEST(NetTest, TestSharedWeightsResume) {
   }
 }
 
+TYPED_TEST(NetTest, TestWeightFile) {
+  typedef typename TypeParam::Dtype Dtype;
+
+  // Create a net with weight sharing; Update it once.
+  Caffe::set_random_seed(this->seed_);
+  this->InitDiffDataSharedWeightsNet();
+  vector<Blob<Dtype>*> bottom;
+  this->net_->ForwardBackward(bottom);
+  this->net_->Update();
+  Blob<Dtype> shared_params;
+  const bool kReshape = true;
+  const bool kCopyDiff = false;
+  shared_params.CopyFrom(*this->net_->layers()[1]->blobs()[0], kCopyDiff,
+      kReshape);
+  const int count = shared_params.count();
+
+  // Write the net to a weight file, through a .caffemodel.
+  NetParameter net_param;
+  this->net_->ToProto(&net_param);
+  string filename;
+  MakeTempFilename(&filename);
+  filename += kWeightFileExtension;
+  WeightFile::Write(net_param, filename);
+
+  // Load it in the TEST phase, where the params are backed by the mapping.
+  this->InitDiffDataSharedWeightsNet(TEST);
+  this->net_->CopyTrainedLayersFrom(filename);
+  Blob<Dtype>* ip1_weights = this->net_->layers()[1]->blobs()[0].get();
+  Blob<Dtype>* ip2_weights = this->net_->layers()[2]->blobs()[0].get();
+  EXPECT_EQ(ip1_weights->cpu_data(), ip2_weights->cpu_data());
+  for (int i = 0; i < count; ++i) {
+    EXPECT_EQ(shared_params.cpu_data()[i], ip1_weights->cpu_data()[i]);
+  }
+
+  // Convert it back to a .caffemodel.
+  WeightFile weights(filename);
+  NetParameter converted_param;
+  weights.ToProto(&converted_param);
+  Blob<Dtype> converted_params;
+  converted_params.FromProto(converted_param.layer(1).blobs(0));
+  ASSERT_EQ(count, converted_params.count());
+  for (int i = 0; i < count; ++i) {
+    EXPECT_EQ(shared_params.cpu_data()[i], converted_params.cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestDagScheduler) {
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  // Two branches joined by an Eltwise layer, with an in-place layer and a
+  // fan-out that needs a split.
+  const string& proto =
+      "name: 'BranchNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'DummyData' "
+      "  dummy_data_param { "
+      "    shape { dim: 4 dim: 6 } "
+      "    shape { dim: 4 dim: 3 } "
+      "    data_filler { type: 'constant' value: 0.5 } "
+      "    data_filler { type: 'constant' value: 1 } "
+      "  } "
+      "  top: 'data' "
+      "  top: 'label' "
+      "} "
+      "layer { "
+      "  name: 'ip_a' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'ip_a' "
+      "} "
+      "layer { "
+      "  name: 'relu_a' "
+      "  type: 'ReLU' "
+      "  bottom: 'ip_a' "
+      "  top: 'ip_a' "
+      "} "
+      "layer { "
+      "  name: 'ip_a2' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'ip_a' "
+      "  top: 'ip_a2' "
+      "} "
+      "layer { "
+      "  name: 'ip_b' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'ip_b' "
+      "} "
+      "layer { "
+      "  name: 'sum' "
+      "  type: 'Eltwise' "
+      "  bottom: 'ip_a2' "
+      "  bottom: 'ip_b' "
+      "  top: 'sum' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'sum' "
+      "  bottom: 'label' "
+      "} ";
+  this->ExpectSameTraining(proto, "dag_scheduler: true dag_threads: 3 ", 2);
+}
+
+TYPED_TEST(NetTest, TestMemoryPlan) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  // A chain of layers: ip1 is dead once ip2 is computed, so ip3 can reuse
+  // its memory.
+  string proto =
+      "name: 'ChainNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 6 } ";
+  string bottom = "data";
+  for (int i = 1; i <= 4; ++i) {
+    std::ostringstream top;
+    top << "ip" << i;
+    proto += "layer { "
+        "  name: '" + top.str() + "' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { type: 'gaussian' std: 0.5 } "
+        "    bias_filler { type: 'gaussian' std: 0.5 } "
+        "  } "
+        "  bottom: '" + bottom + "' "
+        "  top: '" + top.str() + "' "
+        "} ";
+    bottom = top.str();
+  }
+  this->InitNetFromProtoString(proto, TEST);
+  shared_ptr<Net<Dtype> > net = this->net_;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(net->input_blobs()[0]);
+  net->ForwardPrefilled();
+
+  for (int pin = 0; pin < 2; ++pin) {
+    const string& planned_proto = proto + "memory_plan: true " +
+        (pin ? "pinned_blob: 'ip1' " : "");
+    this->InitNetFromProtoString(planned_proto, TEST);
+    this->net_->CopyTrainedLayersFrom(net.get());
+    this->net_->input_blobs()[0]->CopyFrom(*net->input_blobs()[0]);
+    for (int i = 0; i < 2; ++i) {
+      this->net_->ForwardPrefilled();
+      const Blob<Dtype>& output = *net->output_blobs()[0];
+      const Blob<Dtype>& planned_output = *this->net_->output_blobs()[0];
+      ASSERT_EQ(output.count(), planned_output.count());
+      for (int j = 0; j < output.count(); ++j) {
+        EXPECT_EQ(output.cpu_data()[j], planned_output.cpu_data()[j]);
+      }
+    }
+    const Blob<Dtype>& ip1 = *this->net_->blob_by_name("ip1");
+    if (pin) {
+      EXPECT_NE(ip1.cpu_data(), this->net_->blob_by_name("ip3")->cpu_data());
+      for (int j = 0; j < ip1.count(); ++j) {
+        EXPECT_EQ(net->blob_by_name("ip1")->cpu_data()[j], ip1.cpu_data()[j]);
+      }
+    } else {
+      EXPECT_EQ(ip1.cpu_data(), this->net_->blob_by_name("ip3")->cpu_data());
+    }
+  }
+}
+
+#ifdef USE_MPI
+TYPED_TEST(NetTest, TestMemoryPlanAsynchronous) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  // The gather of ip1 may still be in flight while ip2 to ip4 are computed,
+  // so neither its bottom nor its top may share memory with them.
+  const string& proto =
+      "name: 'GatherNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 6 } "
+      "memory_plan: true "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 5 } "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "} "
+      "layer { "
+      "  name: 'gather' "
+      "  type: 'MPIGather' "
+      "  bottom: 'ip1' "
+      "  top: 'gathered' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 5 } "
+      "  bottom: 'gathered' "
+      "  top: 'ip2' "
+      "} "
+      "layer { "
+      "  name: 'ip3' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 5 } "
+      "  bottom: 'ip2' "
+      "  top: 'ip3' "
+      "} "
+      "layer { "
+      "  name: 'ip4' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 5 } "
+      "  bottom: 'ip3' "
+      "  top: 'ip4' "
+      "} ";
+  this->InitNetFromProtoString(proto, TEST);
+  const char* in_flight[] = {"ip1", "gathered"};
+  const char* later[] = {"ip2", "ip3", "ip4"};
+  for (int i = 0; i < 2; ++i) {
+    const Dtype* data = this->net_->blob_by_name(in_flight[i])->cpu_data();
+    for (int j = 0; j < 3; ++j) {
+      EXPECT_NE(data, this->net_->blob_by_name(later[j])->cpu_data());
+    }
+  }
+}
+#endif  // USE_MPI
+
+TYPED_TEST(NetTest, TestCheckpoint) {
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  // A chain with an in-place layer and a dropout, whose mask must be drawn
+  // again when recomputing its segment.
+  const string& proto =
+      "name: 'ChainNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'DummyData' "
+      "  dummy_data_param { "
+      "    shape { dim: 4 dim: 6 } "
+      "    shape { dim: 4 dim: 3 } "
+      "    data_filler { type: 'gaussian' std: 1 } "
+      "    data_filler { type: 'gaussian' std: 1 } "
+      "  } "
+      "  top: 'data' "
+      "  top: 'label' "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 8 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'ip1' "
+      "  top: 'ip1' "
+      "} "
+      "layer { "
+      "  name: 'drop1' "
+      "  type: 'Dropout' "
+      "  bottom: 'ip1' "
+      "  top: 'drop1' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 8 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'drop1' "
+      "  top: 'ip2' "
+      "} "
+      "layer { "
+      "  name: 'tanh2' "
+      "  type: 'TanH' "
+      "  bottom: 'ip2' "
+      "  top: 'tanh2' "
+      "} "
+      "layer { "
+      "  name: 'ip3' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'tanh2' "
+      "  top: 'ip3' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'ip3' "
+      "  bottom: 'label' "
+      "} ";
+  this->ExpectSameTraining(proto, "checkpoint: true ", 2);
+  this->ExpectSameTraining(proto,
+      "checkpoint: true checkpoint_layer: 'data' checkpoint_layer: 'ip2' ", 2);
+}
+
+#ifdef USE_MPI
+TYPED_TEST(NetTest, TestCheckpointAsynchronous) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  // The gather in the first segment may still be in flight while the second
+  // segment runs, so its blobs may not share memory with ip3.
+  const string& proto =
+      "name: 'GatherNetwork' "
+      "checkpoint: true "
+      "checkpoint_layer: 'ip2' "
+      "checkpoint_layer: 'ip4' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'DummyData' "
+      "  dummy_data_param { "
+      "    shape { dim: 2 dim: 6 } "
+      "    shape { dim: 2 dim: 5 } "
+      "  } "
+      "  top: 'data' "
+      "  top: 'label' "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 5 } "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "} "
+      "layer { "
+      "  name: 'gather' "
+      "  type: 'MPIGather' "
+      "  bottom: 'ip1' "
+      "  top: 'gathered' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 5 } "
+      "  bottom: 'gathered' "
+      "  top: 'ip2' "
+      "} "
+      "layer { "
+      "  name: 'ip3' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 5 } "
+      "  bottom: 'ip2' "
+      "  top: 'ip3' "
+      "} "
+      "layer { "
+      "  name: 'ip4' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 5 } "
+      "  bottom: 'ip3' "
+      "  top: 'ip4' "
+      "} "
+      "layer { "
+      "  name: 'ip5' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 5 } "
+      "  bottom: 'ip4' "
+      "  top: 'ip5' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'ip5' "
+      "  bottom: 'label' "
+      "} ";
+  this->InitNetFromProtoString(proto);
+  const Blob<Dtype>& ip3 = *this->net_->blob_by_name("ip3");
+  const char* in_flight[] = {"ip1", "gathered"};
+  for (int i = 0; i < 2; ++i) {
+    const Blob<Dtype>& blob = *this->net_->blob_by_name(in_flight[i]);
+    EXPECT_NE(blob.cpu_data(), ip3.cpu_data());
+    EXPECT_NE(blob.cpu_diff(), ip3.cpu_diff());
+  }
+}
+#endif  // USE_MPI
+
+TYPED_TEST(NetTest, TestShareDiffs) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Two branches from a blob needing backward, hence a split whose first top
+  // accumulates into the diff of ip0.
+  const string& proto =
+      "name: 'BranchNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'DummyData' "
+      "  dummy_data_param { "
+      "    shape { dim: 4 dim: 6 } "
+      "    shape { dim: 4 dim: 3 } "
+      "    data_filler { type: 'constant' value: 0.5 } "
+      "    data_filler { type: 'constant' value: 1 } "
+      "  } "
+      "  top: 'data' "
+      "  top: 'label' "
+      "} "
+      "layer { "
+      "  name: 'ip0' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'ip0' "
+      "} "
+      "layer { "
+      "  name: 'ip_a' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'ip0' "
+      "  top: 'ip_a' "
+      "} "
+      "layer { "
+      "  name: 'relu_a' "
+      "  type: 'ReLU' "
+      "  bottom: 'ip_a' "
+      "  top: 'ip_a' "
+      "} "
+      "layer { "
+      "  name: 'ip_a2' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'ip_a' "
+      "  top: 'ip_a2' "
+      "} "
+      "layer { "
+      "  name: 'ip_b' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'ip0' "
+      "  top: 'ip_b' "
+      "} "
+      "layer { "
+      "  name: 'sum' "
+      "  type: 'Eltwise' "
+      "  bottom: 'ip_a2' "
+      "  bottom: 'ip_b' "
+      "  top: 'sum' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'sum' "
+      "  bottom: 'label' "
+      "} ";
+  this->ExpectSameTraining(proto, "share_diffs: true ", 2);
+  const Blob<Dtype>& ip0 = *this->net_->blob_by_name("ip0");
+  const Blob<Dtype>& split_top =
+      *this->net_->blob_by_name("ip0_ip0_0_split_0");
+  EXPECT_EQ(ip0.cpu_diff(), split_top.cpu_diff());
+}
+
+TYPED_TEST(NetTest, TestZeroCopyConcat) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  // A batch of one sliced into two branches, concatenated back along the
+  // channels.
+  const string& proto =
+      "name: 'ConcatNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'DummyData' "
+      "  dummy_data_param { "
+      "    shape { dim: 1 dim: 6 } "
+      "    shape { dim: 1 dim: 2 } "
+      "    data_filler { type: 'constant' value: 0.5 } "
+      "    data_filler { type: 'constant' value: 1 } "
+      "  } "
+      "  top: 'data' "
+      "  top: 'label' "
+      "} "
+      "layer { "
+      "  name: 'ip0' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'ip0' "
+      "} "
+      "layer { "
+      "  name: 'slice' "
+      "  type: 'Slice' "
+      "  slice_param { slice_point: 2 } "
+      "  bottom: 'ip0' "
+      "  top: 'slice_a' "
+      "  top: 'slice_b' "
+      "} "
+      "layer { "
+      "  name: 'ip_a' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'slice_a' "
+      "  top: 'ip_a' "
+      "} "
+      "layer { "
+      "  name: 'tanh_a' "
+      "  type: 'TanH' "
+      "  bottom: 'ip_a' "
+      "  top: 'ip_a' "
+      "} "
+      "layer { "
+      "  name: 'ip_b' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 4 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'slice_b' "
+      "  top: 'ip_b' "
+      "} "
+      "layer { "
+      "  name: 'concat' "
+      "  type: 'Concat' "
+      "  bottom: 'ip_a' "
+      "  bottom: 'ip_b' "
+      "  top: 'concat' "
+      "} "
+      "layer { "
+      "  name: 'ip_c' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 2 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'concat' "
+      "  top: 'ip_c' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'ip_c' "
+      "  bottom: 'label' "
+      "} ";
+  this->ExpectSameTraining(proto, "zero_copy_concat: true ", 2);
+  const Blob<Dtype>& ip0 = *this->net_->blob_by_name("ip0");
+  const Blob<Dtype>& concat = *this->net_->blob_by_name("concat");
+  EXPECT_EQ(ip0.cpu_data(), this->net_->blob_by_name("slice_a")->cpu_data());
+  EXPECT_EQ(ip0.cpu_diff() + 2,
+            this->net_->blob_by_name("slice_b")->cpu_diff());
+  EXPECT_EQ(concat.cpu_data(), this->net_->blob_by_name("ip_a")->cpu_data());
+  EXPECT_EQ(concat.cpu_diff() + 3,
+            this->net_->blob_by_name("ip_b")->cpu_diff());
+}
+
+TYPED_TEST(NetTest, TestZeroCopyConcatImplicitReshape) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  // The input sliced in two halves and concatenated back. Shrinking the input
+  // in Forward moves the second half to an offset overlapping its view.
+  const string& proto =
+      "name: 'ConcatNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 1 dim: 6 } "
+      "zero_copy_concat: true "
+      "layer { "
+      "  name: 'slice' "
+      "  type: 'Slice' "
+      "  bottom: 'data' "
+      "  top: 'slice_a' "
+      "  top: 'slice_b' "
+      "} "
+      "layer { "
+      "  name: 'concat' "
+      "  type: 'Concat' "
+      "  bottom: 'slice_a' "
+      "  bottom: 'slice_b' "
+      "  top: 'concat' "
+      "} ";
+  this->InitNetFromProtoString(proto, TEST);
+  Blob<Dtype>* data = this->net_->input_blobs()[0];
+  ASSERT_EQ(data->cpu_data() + 3,
+            this->net_->blob_by_name("slice_b")->cpu_data());
+  vector<int> shape(2, 1);
+  for (int shrink = 0; shrink < 2; ++shrink) {
+    shape[1] = shrink ? 4 : 6;
+    data->Reshape(shape);
+    for (int i = 0; i < data->count(); ++i) {
+      data->mutable_cpu_data()[i] = i + 1;
+    }
+    this->net_->ForwardPrefilled();
+    const Blob<Dtype>& concat = *this->net_->blob_by_name("concat");
+    ASSERT_EQ(data->count(), concat.count());
+    for (int i = 0; i < data->count(); ++i) {
+      EXPECT_EQ(i + 1, data->cpu_data()[i]);
+      EXPECT_EQ(i + 1, concat.cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestFuseActivations) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string& proto =
+      "name: 'FusedNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'DummyData' "
+      "  dummy_data_param { "
+      "    shape { dim: 2 dim: 3 dim: 4 dim: 4 } "
+      "    shape { dim: 2 dim: 2 } "
+      "    data_filler { type: 'gaussian' } "
+      "    data_filler { type: 'constant' value: 0.5 } "
+      "  } "
+      "  top: 'data' "
+      "  top: 'label' "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "} "
+      "layer { "
+      "  name: 'relu' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv' "
+      "  top: 'conv' "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'conv' "
+      "  top: 'ip' "
+      "} "
+      "layer { "
+      "  name: 'sigmoid' "
+      "  type: 'Sigmoid' "
+      "  bottom: 'ip' "
+      "  top: 'ip' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 2 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'ip' "
+      "  top: 'ip2' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'ip2' "
+      "  bottom: 'label' "
+      "} ";
+  this->ExpectSameTraining(proto, "fuse_activations: true ", 2);
+  const char* activations[] = {"relu", "sigmoid"};
+  for (int i = 0; i < 2; ++i) {
+    NeuronLayer<Dtype>* activation = dynamic_cast<NeuronLayer<Dtype>*>(
+        this->net_->layer_by_name(activations[i]).get());
+    ASSERT_TRUE(activation != NULL);
+    EXPECT_TRUE(activation->fused());
+  }
+}
+
+TYPED_TEST(NetTest, TestDagSchedulerDropout) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  // Four Dropout layers that may run at the same time on different threads.
+  string proto =
+      "name: 'DropoutNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'DummyData' "
+      "  dummy_data_param { "
+      "    shape { dim: 8 dim: 256 } "
+      "    data_filler { type: 'constant' value: 1 } "
+      "  } "
+      "  top: 'data' "
+      "} ";
+  for (int i = 0; i < 4; ++i) {
+    std::ostringstream layer;
+    layer << "layer { name: 'drop" << i << "' type: 'Dropout' "
+          << "bottom: 'data' top: 'drop" << i << "' } ";
+    proto += layer.str();
+  }
+  const int kNumRuns = 3;
+  const int num_threads[kNumRuns] = {1, 4, 4};
+  vector<Blob<Dtype>*> bottom;
+  vector<vector<shared_ptr<Blob<Dtype> > > > outputs(kNumRuns);
+  for (int run = 0; run < kNumRuns; ++run) {
+    std::ostringstream scheduled_proto;
+    scheduled_proto << proto << "dag_scheduler: true dag_threads: "
+                    << num_threads[run];
+    Caffe::set_random_seed(this->seed_);
+    this->InitNetFromProtoString(scheduled_proto.str());
+    this->net_->Forward(bottom);
+    this->CopyNetBlobs(false, &outputs[run]);
+  }
+  // Each layer draws from its own stream, whatever the number of threads.
+  for (int run = 1; run < kNumRuns; ++run) {
+    ASSERT_EQ(outputs[0].size(), outputs[run].size());
+    for (int i = 0; i < outputs[0].size(); ++i) {
+      for (int j = 0; j < outputs[0][i]->count(); ++j) {
+        EXPECT_EQ(outputs[0][i]->cpu_data()[j], outputs[run][i]->cpu_data()[j]);
+      }
+    }
+  }
+  // The layers do not all draw the same mask.
+  const shared_ptr<Blob<Dtype> > drop0 = this->net_->blob_by_name("drop0");
+  const shared_ptr<Blob<Dtype> > drop1 = this->net_->blob_by_name("drop1");
+  int num_same = 0;
+  for (int j = 0; j < drop0->count(); ++j) {
+    num_same += drop0->cpu_data()[j] == drop1->cpu_data()[j];
+  }
+  EXPECT_LT(num_same, drop0->count());
+}
+
 TYPED_TEST(NetTest, TestParamPropagateDown) {
   typedef typename TypeParam::Dtype Dtype;
   vector<Blob<Dtype>*> bottom;
@@ -2317,6 +3105,77 @@ TYPED_TEST(NetTest, TestReshape) {
   }
 }
 
+// A Power layer that counts the calls to its Reshape.
+template <typename Dtype>
+class ReshapeCountingLayer : public PowerLayer<Dtype> {
+ public:
+  explicit ReshapeCountingLayer(const LayerParameter& param)
+      : PowerLayer<Dtype>(param), num_reshapes_(0) {}
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+    ++num_reshapes_;
+    PowerLayer<Dtype>::Reshape(bottom, top);
+  }
+  int num_reshapes() const { return num_reshapes_; }
+
+ private:
+  int num_reshapes_;
+};
+
+template <typename Dtype>
+shared_ptr<Layer<Dtype> > CreateReshapeCountingLayer(
+    const LayerParameter& param) {
+  return shared_ptr<Layer<Dtype> >(new ReshapeCountingLayer<Dtype>(param));
+}
+
+TYPED_TEST(NetTest, TestReshapeSkipped) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (!LayerRegistry<Dtype>::Registry().count("ReshapeCounting")) {
+    LayerRegistry<Dtype>::AddCreator("ReshapeCounting",
+        CreateReshapeCountingLayer<Dtype>);
+  }
+  const string& proto =
+      "name: 'ReshapeCountingNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 4 } "
+      "layer { "
+      "  name: 'double' "
+      "  type: 'ReshapeCounting' "
+      "  power_param { scale: 2 } "
+      "  bottom: 'data' "
+      "  top: 'out' "
+      "} ";
+  this->InitNetFromProtoString(proto);
+  const ReshapeCountingLayer<Dtype>* layer =
+      dynamic_cast<const ReshapeCountingLayer<Dtype>*>(
+          this->net_->layer_by_name("double").get());
+  ASSERT_TRUE(layer != NULL);
+  Blob<Dtype>* input_blob = this->net_->input_blobs()[0];
+  Blob<Dtype>* output_blob = this->net_->output_blobs()[0];
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  int num_reshapes = layer->num_reshapes();
+  // Same shapes: no-op reshapes of the input are skipped by the layer.
+  // Then a larger input, which reallocates it, and a smaller one, which
+  // does not.
+  const int kNumSteps = 4;
+  const int nums[kNumSteps] = {2, 2, 5, 1};
+  const bool changed[kNumSteps] = {false, false, true, true};
+  for (int step = 0; step < kNumSteps; ++step) {
+    vector<int> shape = input_blob->shape();
+    shape[0] = nums[step];
+    input_blob->Reshape(shape);
+    filler.Fill(input_blob);
+    this->net_->ForwardPrefilled();
+    num_reshapes += changed[step];
+    EXPECT_EQ(num_reshapes, layer->num_reshapes());
+    EXPECT_EQ(input_blob->shape(), output_blob->shape());
+    for (int i = 0; i < input_blob->count(); ++i) {
+      EXPECT_EQ(2 * input_blob->cpu_data()[i], output_blob->cpu_data()[i]);
+    }
+  }
+}
+
 TYPED_TEST(NetTest, TestSkipPropagateDown) {
   // check bottom_need_backward if propagate_down is true
   this->InitSkipPropNet(false);
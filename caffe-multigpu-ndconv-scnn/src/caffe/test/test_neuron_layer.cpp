@@ -300,6 +300,55 @@ TYPED_TEST(NeuronLayerTest, TestTanHGradient) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(NeuronLayerTest, TestActivationsAboveGrain) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Large enough for the CPU loops to be split over the threads.
+  this->blob_bottom_->Reshape(2, 4, 64, 80);
+  ASSERT_GT(this->blob_bottom_->count(), kNeuronGrain);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      "relu_param { negative_slope: 0.01 }", &layer_param));
+  vector<shared_ptr<Layer<Dtype> > > layers;
+  layers.push_back(shared_ptr<Layer<Dtype> >(
+      new ReLULayer<Dtype>(layer_param)));
+  layers.push_back(shared_ptr<Layer<Dtype> >(
+      new SigmoidLayer<Dtype>(layer_param)));
+  layers.push_back(shared_ptr<Layer<Dtype> >(
+      new TanHLayer<Dtype>(layer_param)));
+  const vector<bool> propagate_down(1, true);
+  for (int l = 0; l < layers.size(); ++l) {
+    layers[l]->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_rng_gaussian<Dtype>(this->blob_top_->count(), Dtype(0), Dtype(1),
+        this->blob_top_->mutable_cpu_diff());
+    layers[l]->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    layers[l]->Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+    const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+    const Dtype* bottom_diff = this->blob_bottom_->cpu_diff();
+    const Dtype* top_data = this->blob_top_->cpu_data();
+    const Dtype* top_diff = this->blob_top_->cpu_diff();
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      const double x = bottom_data[i];
+      double y, dy;
+      if (l == 0) {
+        y = x > 0 ? x : 0.01 * x;
+        dy = x > 0 ? 1 : 0.01;
+      } else if (l == 1) {
+        y = 1. / (1. + exp(-x));
+        dy = y * (1. - y);
+      } else {
+        y = tanh(x);
+        dy = 1. - y * y;
+      }
+      EXPECT_NEAR(y, top_data[i], 1e-4);
+      EXPECT_NEAR(top_diff[i] * dy, bottom_diff[i], 1e-4);
+    }
+  }
+}
+
 TYPED_TEST(NeuronLayerTest, TestExpLayer) {
   typedef typename TypeParam::Dtype Dtype;
   // Test default base of "-1" -- should actually set base := e.
@@ -474,6 +523,17 @@ TYPED_TEST(NeuronLayerTest, TestDropoutThreeQuarters) {
   this->TestDropoutForward(kDropoutRatio);
 }
 
+TYPED_TEST(NeuronLayerTest, TestDropoutAboveGrain) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Large enough for the mask to be applied over the threads.
+  this->blob_bottom_->Reshape(2, 4, 64, 80);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  const float kDropoutRatio = 0.5;
+  this->TestDropoutForward(kDropoutRatio);
+}
+
 TYPED_TEST(NeuronLayerTest, TestDropoutTestPhase) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -1,5 +1,6 @@
 #include <cmath>
 #include <cstring>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -259,6 +260,109 @@ TYPED_TEST(RandomNumberGeneratorTest, TestRngBernoulli2) {
 }
 
 
+TYPED_TEST(RandomNumberGeneratorTest, TestRngPhiloxKnownAnswers) {
+  // The known answers of Philox4x32-10 from the Random123 distribution.
+  const unsigned int counters[3][4] = {
+    {0x00000000, 0x00000000, 0x00000000, 0x00000000},
+    {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+    {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}};
+  const unsigned int keys[3][2] = {
+    {0x00000000, 0x00000000},
+    {0xffffffff, 0xffffffff},
+    {0xa4093822, 0x299f31d0}};
+  const unsigned int answers[3][4] = {
+    {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8},
+    {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd},
+    {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}};
+  for (int i = 0; i < 3; ++i) {
+    unsigned int out[4];
+    caffe_rng_philox_block(counters[i], keys[i], out);
+    for (int j = 0; j < 4; ++j) {
+      EXPECT_EQ(answers[i][j], out[j]);
+    }
+  }
+}
+
+
+TYPED_TEST(RandomNumberGeneratorTest, TestRngPhiloxUniformBits) {
+  TypeParam* uniform_data =
+      static_cast<TypeParam*>(this->data_->mutable_cpu_data());
+  caffe_rng_philox_uniform(this->sample_size_, TypeParam(0), TypeParam(1),
+      uniform_data);
+  // Scaled by 2^24, the uniforms are integers for float, but not for double,
+  // which keeps 53 bits.
+  int num_fractional = 0;
+  for (int i = 0; i < this->sample_size_; ++i) {
+    const double scaled = uniform_data[i] * 16777216.;
+    num_fractional += scaled != floor(scaled);
+  }
+  if (sizeof(TypeParam) == sizeof(float)) {
+    EXPECT_EQ(0, num_fractional);
+  } else {
+    EXPECT_GT(num_fractional, this->sample_size_ * 0.99);
+  }
+}
+
+
+TYPED_TEST(RandomNumberGeneratorTest, TestRngPhiloxGaussian) {
+  const TypeParam mu = -2;
+  const TypeParam sigma = 3;
+  TypeParam* gaussian_data =
+      static_cast<TypeParam*>(this->data_->mutable_cpu_data());
+  caffe_rng_philox_gaussian(this->sample_size_, mu, sigma, gaussian_data);
+  this->RngGaussianChecks(mu, sigma, gaussian_data);
+}
+
+
+TYPED_TEST(RandomNumberGeneratorTest, TestRngPhiloxUniform) {
+  const TypeParam lower = -7.3;
+  const TypeParam upper = -2.3;
+  TypeParam* uniform_data =
+      static_cast<TypeParam*>(this->data_->mutable_cpu_data());
+  caffe_rng_philox_uniform(this->sample_size_, lower, upper, uniform_data);
+  this->RngUniformChecks(lower, upper, uniform_data);
+}
+
+
+TYPED_TEST(RandomNumberGeneratorTest, TestRngPhiloxBernoulliBits) {
+  const TypeParam p = 0.3;
+  // Leave the last word partially used.
+  const int n = this->sample_size_ - 5;
+  vector<unsigned int> bits((n + 31) / 32);
+  caffe_rng_philox_bernoulli_bits(n, p, &bits[0]);
+  int* bernoulli_data = static_cast<int*>(this->int_data_->mutable_cpu_data());
+  for (int i = 0; i < this->sample_size_; ++i) {
+    bernoulli_data[i] = i < n ? (bits[i / 32] >> (i % 32)) & 1 : 0;
+  }
+  this->RngBernoulliChecks(p * n / this->sample_size_, bernoulli_data);
+  EXPECT_EQ(0, bits.back() >> (n % 32));
+}
+
+
+TYPED_TEST(RandomNumberGeneratorTest, TestRngPhiloxSeed) {
+  TypeParam* data = static_cast<TypeParam*>(this->data_->mutable_cpu_data());
+  TypeParam* data_2 =
+      static_cast<TypeParam*>(this->data_2_->mutable_cpu_data());
+  caffe_rng_philox_uniform(this->sample_size_, TypeParam(0), TypeParam(1),
+      data);
+  // A new call starts a new stream...
+  caffe_rng_philox_uniform(this->sample_size_, TypeParam(0), TypeParam(1),
+      data_2);
+  int num_equal = 0;
+  for (int i = 0; i < this->sample_size_; ++i) {
+    num_equal += data[i] == data_2[i];
+  }
+  EXPECT_LT(num_equal, 10);
+  // ... and reseeding replays them.
+  Caffe::set_random_seed(this->seed_);
+  caffe_rng_philox_uniform(this->sample_size_, TypeParam(0), TypeParam(1),
+      data_2);
+  for (int i = 0; i < this->sample_size_; ++i) {
+    EXPECT_EQ(data[i], data_2[i]);
+  }
+}
+
+
 TYPED_TEST(RandomNumberGeneratorTest, TestRngGaussianTimesGaussian) {
   const TypeParam mu = 0;
   const TypeParam sigma = 1;
@@ -93,6 +93,21 @@ class SigmoidCrossEntropyLossLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // Sets a positive weight per output and ignores the targets of every
+  // third output, which are set to -1.
+  void SetWeightsAndIgnoredTargets(LayerParameter* layer_param) {
+    const int dim = this->blob_bottom_data_->count(1);
+    for (int i = 0; i < dim; ++i) {
+      layer_param->mutable_sigmoid_cross_entropy_loss_param()->add_pos_weight(
+          0.5 + i);
+    }
+    layer_param->mutable_loss_param()->set_ignore_label(-1);
+    Dtype* target = this->blob_bottom_targets_->mutable_cpu_data();
+    for (int i = 0; i < this->blob_bottom_targets_->count(); i += 3) {
+      target[i] = -1;
+    }
+  }
+
   Blob<Dtype>* const blob_bottom_data_;
   Blob<Dtype>* const blob_bottom_targets_;
   Blob<Dtype>* const blob_top_loss_;
@@ -106,6 +121,78 @@ TYPED_TEST(SigmoidCrossEntropyLossLayerTest, TestSigmoidCrossEntropyLoss) {
   this->TestForward();
 }
 
+TYPED_TEST(SigmoidCrossEntropyLossLayerTest, TestForwardWeightedIgnore) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetWeightsAndIgnoredTargets(&layer_param);
+  SigmoidCrossEntropyLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype layer_loss =
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int num = this->blob_bottom_data_->num();
+  const int dim = this->blob_bottom_data_->count(1);
+  const Dtype* input = this->blob_bottom_data_->cpu_data();
+  const Dtype* target = this->blob_bottom_targets_->cpu_data();
+  Dtype reference_loss = 0;
+  for (int i = 0; i < num * dim; ++i) {
+    if (target[i] == Dtype(-1)) { continue; }
+    const Dtype prediction = 1 / (1 + exp(-input[i]));
+    reference_loss -= (0.5 + i % dim) * target[i] * log(prediction);
+    reference_loss -= (1 - target[i]) * log(1 - prediction);
+  }
+  EXPECT_NEAR(reference_loss / num, layer_loss, 1e-4);
+}
+
+TYPED_TEST(SigmoidCrossEntropyLossLayerTest, TestGradientWeightedIgnore) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  const Dtype kLossWeight = 3.7;
+  layer_param.add_loss_weight(kLossWeight);
+  this->SetWeightsAndIgnoredTargets(&layer_param);
+  SigmoidCrossEntropyLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+  // The ignored outputs get no gradient.
+  const Dtype* target = this->blob_bottom_targets_->cpu_data();
+  const Dtype* diff = this->blob_bottom_data_->cpu_diff();
+  for (int i = 0; i < this->blob_bottom_targets_->count(); ++i) {
+    if (target[i] == Dtype(-1)) {
+      EXPECT_EQ(0, diff[i]);
+    }
+  }
+}
+
+TYPED_TEST(SigmoidCrossEntropyLossLayerTest, TestNegativeTargetsNotIgnored) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Targets of -1 are only ignored when ignore_label says so.
+  Dtype* target = this->blob_bottom_targets_->mutable_cpu_data();
+  for (int i = 0; i < this->blob_bottom_targets_->count(); i += 3) {
+    target[i] = -1;
+  }
+  LayerParameter layer_param;
+  SigmoidCrossEntropyLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype layer_loss =
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  this->blob_top_loss_->mutable_cpu_diff()[0] = 1;
+  vector<bool> propagate_down(2, false);
+  propagate_down[0] = true;
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+  const int num = this->blob_bottom_data_->num();
+  const Dtype* input = this->blob_bottom_data_->cpu_data();
+  const Dtype* diff = this->blob_bottom_data_->cpu_diff();
+  Dtype reference_loss = 0;
+  for (int i = 0; i < this->blob_bottom_data_->count(); ++i) {
+    const Dtype prediction = 1 / (1 + exp(-input[i]));
+    reference_loss -= target[i] * log(prediction);
+    reference_loss -= (1 - target[i]) * log(1 - prediction);
+    EXPECT_NEAR((prediction - target[i]) / num, diff[i], 1e-5);
+  }
+  EXPECT_NEAR(reference_loss / num, layer_loss, 1e-4);
+}
+
 TYPED_TEST(SigmoidCrossEntropyLossLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
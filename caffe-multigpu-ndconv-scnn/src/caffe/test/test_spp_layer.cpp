@@ -127,5 +127,81 @@ TYPED_TEST(SPPLayerTest, TestGradient) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(SPPLayerTest, TestForwardLevels) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(1, 1, 4, 4);
+  for (int i = 0; i < 16; ++i) {
+    this->blob_bottom_->mutable_cpu_data()[i] = i;
+  }
+  LayerParameter layer_param;
+  SPPParameter* spp_param = layer_param.mutable_spp_param();
+  spp_param->set_pyramid_height(2);
+  // The whole input, then the four 2x2 quadrants.
+  const Dtype expected_max[5] = {15, 5, 7, 13, 15};
+  const Dtype expected_ave[5] = {7.5, 2.5, 4.5, 10.5, 12.5};
+  for (int ave = 0; ave < 2; ++ave) {
+    spp_param->set_pool(ave ? SPPParameter_PoolMethod_AVE :
+        SPPParameter_PoolMethod_MAX);
+    SPPLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    ASSERT_EQ(5, this->blob_top_->count());
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_NEAR(ave ? expected_ave[i] : expected_max[i],
+          this->blob_top_->cpu_data()[i], 1e-5);
+    }
+  }
+}
+
+TYPED_TEST(SPPLayerTest, TestForwardStochastic) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(1, 1, 4, 4);
+  for (int i = 0; i < 16; ++i) {
+    this->blob_bottom_->mutable_cpu_data()[i] = i + 1;
+  }
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  SPPParameter* spp_param = layer_param.mutable_spp_param();
+  spp_param->set_pyramid_height(2);
+  spp_param->set_pool(SPPParameter_PoolMethod_STOCHASTIC);
+  SPPLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(1, this->blob_top_->num());
+  EXPECT_EQ(5, this->blob_top_->channels());
+  // PoolingLayer only samples on GPU.
+  if (Caffe::mode() != Caffe::GPU) { return; }
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // At test time each bin is the sum of its squares over its sum.
+  const Dtype expected[5] = {Dtype(1496) / 136, Dtype(66) / 14,
+      Dtype(138) / 22, Dtype(546) / 46, Dtype(746) / 54};
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_NEAR(expected[i], this->blob_top_->cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(SPPLayerTest, TestGradientND) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<int> shape(5, 2);
+  shape[2] = 3;
+  shape[3] = 4;
+  shape[4] = 5;
+  this->blob_bottom_->Reshape(shape);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  SPPParameter* spp_param = layer_param.mutable_spp_param();
+  spp_param->set_pyramid_height(3);
+  for (int ave = 0; ave < 2; ++ave) {
+    spp_param->set_pool(ave ? SPPParameter_PoolMethod_AVE :
+        SPPParameter_PoolMethod_MAX);
+    SPPLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    EXPECT_EQ(2 * (1 + 8 + 64), this->blob_top_->shape(1));
+    GradientChecker<Dtype> checker(1e-4, 1e-2);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  }
+}
 
 }  // namespace caffe
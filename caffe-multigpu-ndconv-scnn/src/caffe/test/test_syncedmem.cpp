@@ -6,6 +6,7 @@
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/device_alternate.hpp"
+#include "caffe/util/host_allocator.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -68,6 +69,60 @@ TEST_F(SyncedMemoryTest, TestCPUWrite) {
   }
 }
 
+TEST_F(SyncedMemoryTest, TestHostAllocatorReuse) {
+  EXPECT_EQ(HostAllocator::SizeClass(1), 64);
+  EXPECT_EQ(HostAllocator::SizeClass(65), 128);
+  EXPECT_EQ(HostAllocator::SizeClass(1000), 1024);
+  EXPECT_EQ(HostAllocator::SizeClass(1025), 1280);
+  HostAllocator& allocator = HostAllocator::Get();
+  void* ptr = allocator.Allocate(1000);
+  EXPECT_EQ(reinterpret_cast<size_t>(ptr) % 64, 0);
+  allocator.Free(ptr, 1000);
+  // A block of the same size class is served from the cache.
+  const HostAllocator::Stats stats = allocator.stats();
+  void* reused_ptr = allocator.Allocate(1010);
+  EXPECT_EQ(ptr, reused_ptr);
+  EXPECT_EQ(allocator.stats().num_cache_hits, stats.num_cache_hits + 1);
+  EXPECT_EQ(allocator.stats().bytes_in_use, stats.bytes_in_use + 1024);
+  allocator.Free(reused_ptr, 1010);
+}
+
+TEST_F(SyncedMemoryTest, TestHostAllocatorHugePages) {
+  HostAllocator& allocator = HostAllocator::Get();
+  // Drop the cached blocks, which were allocated without huge pages.
+  allocator.ReleaseCached();
+  allocator.set_use_huge_pages(true);
+  // Large blocks are aligned to the 2MB huge page size, small ones as usual.
+  const size_t size = 4 << 20;
+  void* ptr = allocator.Allocate(size);
+  EXPECT_EQ(reinterpret_cast<size_t>(ptr) % (2 << 20), 0);
+  memset(ptr, 1, size);
+  EXPECT_EQ(static_cast<char*>(ptr)[size - 1], 1);
+  void* small_ptr = allocator.Allocate(1000);
+  EXPECT_EQ(reinterpret_cast<size_t>(small_ptr) % 64, 0);
+  allocator.Free(small_ptr, 1000);
+  allocator.Free(ptr, size);
+  allocator.set_use_huge_pages(false);
+  allocator.ReleaseCached();
+}
+
+TEST_F(SyncedMemoryTest, TestCPUZeroFill) {
+  // Memory from a reused block is still zeroed, unless it is accessed for
+  // overwrite.
+  {
+    SyncedMemory mem(10);
+    caffe_memset(mem.size(), 1, mem.mutable_cpu_data());
+  }
+  SyncedMemory mem(10);
+  const void* cpu_data = mem.cpu_data();
+  for (int i = 0; i < mem.size(); ++i) {
+    EXPECT_EQ((static_cast<const char*>(cpu_data))[i], 0);
+  }
+  SyncedMemory overwritten_mem(10);
+  EXPECT_TRUE(overwritten_mem.mutable_cpu_data_for_overwrite());
+  EXPECT_EQ(overwritten_mem.head(), SyncedMemory::HEAD_AT_CPU);
+}
+
 #ifndef CPU_ONLY  // GPU test
 
 TEST_F(SyncedMemoryTest, TestGPURead) {
@@ -0,0 +1,160 @@
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <vector>
+
+#include "caffe/util/dag_scheduler.hpp"
+
+namespace caffe {
+
+void DagScheduler::Graph::Reset(int num_tasks) {
+  successors.assign(num_tasks, vector<int>());
+  num_dependencies.assign(num_tasks, 0);
+  on_caller.assign(num_tasks, false);
+}
+
+void DagScheduler::Graph::AddDependency(int task, int dependency) {
+  CHECK_LT(dependency, task) << "Tasks may only depend on earlier tasks.";
+  successors[dependency].push_back(task);
+  ++num_dependencies[task];
+}
+
+// Everything below is guarded by mutex.
+class DagScheduler::State {
+ public:
+  boost::mutex mutex;
+  boost::condition_variable condition;
+  vector<shared_ptr<boost::thread> > threads;
+  bool shutdown;
+
+  // The run in progress, if any.
+  const Graph* graph;
+  const boost::function<void(int)>* task;
+  vector<int> num_pending;
+  int num_remaining;
+  // The ready tasks of each thread (index 0 is the calling thread), and the
+  // ready tasks that must run on the calling thread.
+  vector<std::deque<int> > queues;
+  std::deque<int> caller_queue;
+
+  State() : shutdown(false), graph(NULL), task(NULL), num_remaining(0) {}
+
+  // Returns a ready task for thread_id, or -1 if there is none.
+  int Take(int thread_id) {
+    if (!graph) { return -1; }
+    if (thread_id == 0 && !caller_queue.empty()) {
+      const int next = caller_queue.front();
+      caller_queue.pop_front();
+      return next;
+    }
+    std::deque<int>& own = queues[thread_id];
+    if (!own.empty()) {
+      const int next = own.back();
+      own.pop_back();
+      return next;
+    }
+    for (int i = 1; i < queues.size(); ++i) {
+      std::deque<int>& victim = queues[(thread_id + i) % queues.size()];
+      if (!victim.empty()) {
+        const int next = victim.front();
+        victim.pop_front();
+        return next;
+      }
+    }
+    return -1;
+  }
+
+  void Push(int ready, int thread_id) {
+    if (graph->on_caller[ready]) {
+      caller_queue.push_back(ready);
+    } else {
+      queues[thread_id].push_back(ready);
+    }
+  }
+
+  // Marks done as completed by thread_id and queues the tasks it unblocks.
+  void Complete(int done, int thread_id) {
+    const vector<int>& successors = graph->successors[done];
+    for (int i = 0; i < successors.size(); ++i) {
+      if (--num_pending[successors[i]] == 0) {
+        Push(successors[i], thread_id);
+      }
+    }
+    --num_remaining;
+    condition.notify_all();
+  }
+};
+
+DagScheduler::DagScheduler(int num_threads)
+    : num_threads_(num_threads), state_(new State()) {
+  CHECK_GE(num_threads, 1);
+  state_->queues.resize(num_threads);
+  for (int i = 1; i < num_threads; ++i) {
+    state_->threads.push_back(shared_ptr<boost::thread>(
+        new boost::thread(&DagScheduler::WorkerLoop, this, i)));
+  }
+}
+
+DagScheduler::~DagScheduler() {
+  {
+    boost::mutex::scoped_lock lock(state_->mutex);
+    state_->shutdown = true;
+    state_->condition.notify_all();
+  }
+  for (int i = 0; i < state_->threads.size(); ++i) {
+    state_->threads[i]->join();
+  }
+}
+
+void DagScheduler::WorkerLoop(int thread_id) {
+  State& state = *state_;
+  boost::mutex::scoped_lock lock(state.mutex);
+  while (true) {
+    int next;
+    while (!state.shutdown && (next = state.Take(thread_id)) < 0) {
+      state.condition.wait(lock);
+    }
+    if (state.shutdown) { return; }
+    const boost::function<void(int)>& task = *state.task;
+    lock.unlock();
+    task(next);
+    lock.lock();
+    state.Complete(next, thread_id);
+  }
+}
+
+void DagScheduler::Run(const Graph& graph,
+    const boost::function<void(int)>& task) {
+  const int num_tasks = graph.successors.size();
+  State& state = *state_;
+  boost::mutex::scoped_lock lock(state.mutex);
+  CHECK(!state.graph) << "DagScheduler::Run is not reentrant.";
+  state.graph = &graph;
+  state.task = &task;
+  state.num_pending = graph.num_dependencies;
+  state.num_remaining = num_tasks;
+  // Spread the initially ready tasks over the threads.
+  int thread_id = 0;
+  for (int i = 0; i < num_tasks; ++i) {
+    if (state.num_pending[i] == 0) {
+      state.Push(i, thread_id);
+      thread_id = (thread_id + 1) % num_threads_;
+    }
+  }
+  state.condition.notify_all();
+  while (state.num_remaining > 0) {
+    const int next = state.Take(0);
+    if (next < 0) {
+      state.condition.wait(lock);
+      continue;
+    }
+    lock.unlock();
+    task(next);
+    lock.lock();
+    state.Complete(next, 0);
+  }
+  state.graph = NULL;
+  state.task = NULL;
+}
+
+}  // namespace caffe
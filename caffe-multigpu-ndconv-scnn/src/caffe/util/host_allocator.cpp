@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "caffe/util/host_allocator.hpp"
+
+namespace caffe {
+
+namespace {
+
+const size_t kAlignment = 64;
+const size_t kHugePageSize = 2 << 20;
+const size_t kDefaultMaxCachedBytes = size_t(1) << 30;
+
+void* SystemAllocate(size_t size, bool use_huge_pages) {
+  const bool huge = use_huge_pages && size >= kHugePageSize;
+  void* ptr = NULL;
+  const int error =
+      posix_memalign(&ptr, huge ? kHugePageSize : kAlignment, size);
+  CHECK_EQ(error, 0) << "host allocation of size " << size << " failed";
+#ifdef MADV_HUGEPAGE
+  if (huge) {
+    madvise(ptr, size, MADV_HUGEPAGE);
+  }
+#endif
+  return ptr;
+}
+
+}  // namespace
+
+HostAllocator& HostAllocator::Get() {
+  // Never destroyed, as blobs may be freed during static destruction.
+  static HostAllocator* allocator = new HostAllocator();
+  return *allocator;
+}
+
+HostAllocator::HostAllocator()
+    : max_cached_bytes_(kDefaultMaxCachedBytes), use_huge_pages_(false) {
+  stats_.num_allocations = 0;
+  stats_.num_cache_hits = 0;
+  stats_.bytes_in_use = 0;
+  stats_.peak_bytes_in_use = 0;
+  stats_.bytes_cached = 0;
+}
+
+size_t HostAllocator::SizeClass(size_t size) {
+  if (size <= kAlignment) { return kAlignment; }
+  // With four classes per power of two, less than a quarter of the size is
+  // wasted.
+  size_t power = kAlignment;
+  while (power <= size / 2) { power *= 2; }
+  const size_t step = std::max(kAlignment, power / 4);
+  return (size + step - 1) / step * step;
+}
+
+void* HostAllocator::Allocate(size_t size) {
+  const size_t size_class = SizeClass(size);
+  boost::mutex::scoped_lock lock(mutex_);
+  ++stats_.num_allocations;
+  stats_.bytes_in_use += size_class;
+  stats_.peak_bytes_in_use =
+      std::max(stats_.peak_bytes_in_use, stats_.bytes_in_use);
+  std::map<size_t, vector<void*> >::iterator it = cache_.find(size_class);
+  if (it != cache_.end() && !it->second.empty()) {
+    void* ptr = it->second.back();
+    it->second.pop_back();
+    ++stats_.num_cache_hits;
+    stats_.bytes_cached -= size_class;
+    return ptr;
+  }
+  const bool use_huge_pages = use_huge_pages_;
+  lock.unlock();
+  return SystemAllocate(size_class, use_huge_pages);
+}
+
+void HostAllocator::Free(void* ptr, size_t size) {
+  if (!ptr) { return; }
+  const size_t size_class = SizeClass(size);
+  boost::mutex::scoped_lock lock(mutex_);
+  stats_.bytes_in_use -= size_class;
+  if (stats_.bytes_cached + size_class <= max_cached_bytes_) {
+    cache_[size_class].push_back(ptr);
+    stats_.bytes_cached += size_class;
+    return;
+  }
+  lock.unlock();
+  free(ptr);
+}
+
+void HostAllocator::ReleaseCached() {
+  std::map<size_t, vector<void*> > cache;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    cache.swap(cache_);
+    stats_.bytes_cached = 0;
+  }
+  for (std::map<size_t, vector<void*> >::iterator it = cache.begin();
+       it != cache.end(); ++it) {
+    for (int i = 0; i < it->second.size(); ++i) {
+      free(it->second[i]);
+    }
+  }
+}
+
+HostAllocator::Stats HostAllocator::stats() const {
+  boost::mutex::scoped_lock lock(mutex_);
+  return stats_;
+}
+
+void HostAllocator::set_max_cached_bytes(size_t max_cached_bytes) {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    max_cached_bytes_ = max_cached_bytes;
+  }
+  if (stats().bytes_cached > max_cached_bytes) {
+    ReleaseCached();
+  }
+}
+
+void HostAllocator::set_use_huge_pages(bool use_huge_pages) {
+  boost::mutex::scoped_lock lock(mutex_);
+  use_huge_pages_ = use_huge_pages;
+}
+
+}  // namespace caffe
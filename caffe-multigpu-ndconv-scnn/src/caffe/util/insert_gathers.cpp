@@ -18,24 +18,26 @@ void InsertGathers(const set<string>& serial_layers, NetParameter* param) {
       layer_tops[i].insert(layer_param.top(j));
     }
   }
-  // Insert MPIGatherLayer between parallel --> serial layers
-  NetParameter param_gather;
-  param_gather.CopyFrom(*param);
-  param_gather.clear_layer();
+  // Insert MPIGatherLayer between parallel --> serial layers. Each gather
+  // layer is placed right after the layer producing its bottom rather than
+  // right before its consumer, so that the (asynchronous) gather overlaps with
+  // the layers in between.
+  vector<vector<LayerParameter> > gathers_after(num_layers);
+  vector<LayerParameter> layers_up(num_layers);
   for (int i = 0; i < num_layers; ++i) {
     const LayerParameter& layer_up = param->layer(i);
+    layers_up[i].CopyFrom(layer_up);
     if (serial_layers.find(layer_up.name()) == serial_layers.end() ||
         layer_up.type() == "MPIGather" ||
 	layer_up.type() == "SoftmaxWithLoss" ||
 	layer_up.type() == "SigmoidCrossEntropyLoss" ||
 	layer_up.type() == "Accuracy") {
-      LayerParameter* layer = param_gather.add_layer();
-      layer->CopyFrom(layer_up);
       continue;
     }
-    // First insert all the needed gather layers, then the upper layer, to make
-    // all the layers topo-ordered.
-    vector<pair<int, string> > update_bottoms;
+    // A model-parallel InnerProduct gathers its bottom by itself.
+    const bool model_parallel = layer_up.type() == "InnerProduct" &&
+        layer_up.inner_product_param().model_parallel();
+    bool gather_bottom = false;
     // There are some layers handling some blobs in-place. We use a reverse
     // for-loop to find the nearest layer.
     set<string> blobs_used;
@@ -55,21 +57,32 @@ void InsertGathers(const set<string>& serial_layers, NetParameter* param) {
         }
       }
       if (connecting_blobs.empty()) continue;
-      // Insert a MPIGatherLayer
-      LayerParameter* gather_layer = param_gather.add_layer();
+      if (model_parallel) {
+        gather_bottom = true;
+        continue;
+      }
+      // Insert a MPIGatherLayer after the lower layer
+      gathers_after[j].push_back(LayerParameter());
+      LayerParameter* gather_layer = &gathers_after[j].back();
       ConfigureGatherLayer(layer_down.name(), layer_up.name(),
           connecting_blobs, gather_layer);
-      // Record the bottom blobs of layer_up to be updated
+      // Update the bottom blobs of layer_up
       for (int k = 0; k < connecting_blobs.size(); ++k) {
         const int blob_idx = connecting_blobs[k].first;
-        update_bottoms.push_back(make_pair(blob_idx, gather_layer->top(k)));
+        layers_up[i].set_bottom(blob_idx, gather_layer->top(k));
       }
     }
-    // Insert the upper layer
-    LayerParameter* layer = param_gather.add_layer();
-    layer->CopyFrom(layer_up);
-    for (int k = 0; k < update_bottoms.size(); ++k) {
-      layer->set_bottom(update_bottoms[k].first, update_bottoms[k].second);
+    if (gather_bottom) {
+      layers_up[i].mutable_inner_product_param()->set_gather_bottom(true);
+    }
+  }
+  NetParameter param_gather;
+  param_gather.CopyFrom(*param);
+  param_gather.clear_layer();
+  for (int i = 0; i < num_layers; ++i) {
+    param_gather.add_layer()->CopyFrom(layers_up[i]);
+    for (int j = 0; j < gathers_after[i].size(); ++j) {
+      param_gather.add_layer()->CopyFrom(gathers_after[i][j]);
     }
   }
   param->CopyFrom(param_gather);
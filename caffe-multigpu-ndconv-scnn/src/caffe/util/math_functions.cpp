@@ -1,6 +1,8 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
 
 #include "caffe/common.hpp"
@@ -325,6 +327,199 @@ void caffe_rng_bernoulli<double>(const int n, const double p, unsigned int* r);
 template
 void caffe_rng_bernoulli<float>(const int n, const float p, unsigned int* r);
 
+void caffe_rng_philox_block(const unsigned int counter[4],
+    const unsigned int key[2], unsigned int out[4]) {
+  // Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+  // 3", SC 2011).
+  const uint32_t kPhiloxM0 = 0xD2511F53;
+  const uint32_t kPhiloxM1 = 0xCD9E8D57;
+  const uint32_t kPhiloxW0 = 0x9E3779B9;
+  const uint32_t kPhiloxW1 = 0xBB67AE85;
+  uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+  uint32_t k0 = key[0], k1 = key[1];
+  for (int round = 0; round < 10; ++round) {
+    const uint64_t p0 = static_cast<uint64_t>(kPhiloxM0) * c0;
+    const uint64_t p1 = static_cast<uint64_t>(kPhiloxM1) * c2;
+    c0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+    c1 = static_cast<uint32_t>(p1);
+    c2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+    c3 = static_cast<uint32_t>(p0);
+    k0 += kPhiloxW0;
+    k1 += kPhiloxW1;
+  }
+  out[0] = c0;
+  out[1] = c1;
+  out[2] = c2;
+  out[3] = c3;
+}
+
+namespace {
+
+// The generation is spread over the OpenMP threads above this many numbers.
+const int kPhiloxGrain = 1 << 14;
+
+// Every call starts a new stream, keyed from the Caffe RNG.
+void NewPhiloxKey(unsigned int key[2]) {
+  key[0] = (*caffe_rng())();
+  key[1] = (*caffe_rng())();
+}
+
+// Block i of four random words only depends on i and the key, so the blocks
+// may be generated in any order, on any thread.
+inline void PhiloxBlock(const unsigned int key[2], const uint32_t block,
+    uint32_t* out) {
+  const unsigned int counter[4] = {block, 0, 0, 0};
+  caffe_rng_philox_block(counter, key, out);
+}
+
+// Maps the words of a block to uniforms in [0, 1) with all the bits of the
+// mantissa: four floats of 24 bits, or two doubles of 53 bits.
+template <typename Dtype> struct PhiloxUnits;
+
+template <>
+struct PhiloxUnits<float> {
+  static const int kPerBlock = 4;
+  static void Map(const uint32_t* words, float* units) {
+    for (int i = 0; i < kPerBlock; ++i) {
+      units[i] = (words[i] >> 8) * (1.f / 16777216.f);
+    }
+  }
+};
+
+template <>
+struct PhiloxUnits<double> {
+  static const int kPerBlock = 2;
+  static void Map(const uint32_t* words, double* units) {
+    for (int i = 0; i < kPerBlock; ++i) {
+      units[i] = ((words[2 * i] >> 5) * 67108864. + (words[2 * i + 1] >> 6))
+          * (1. / 9007199254740992.);
+    }
+  }
+};
+
+}  // namespace
+
+template <typename Dtype>
+void caffe_rng_philox_uniform(const int n, const Dtype a, const Dtype b,
+                              Dtype* r) {
+  CHECK_GE(n, 0);
+  CHECK(r);
+  CHECK_LE(a, b);
+  unsigned int key[2];
+  NewPhiloxKey(key);
+  const int kPerBlock = PhiloxUnits<Dtype>::kPerBlock;
+  const int num_blocks = (n + kPerBlock - 1) / kPerBlock;
+#ifdef _OPENMP
+  #pragma omp parallel for if (n > kPhiloxGrain) schedule(static)
+#endif
+  for (int block = 0; block < num_blocks; ++block) {
+    uint32_t words[4];
+    PhiloxBlock(key, block, words);
+    Dtype units[kPerBlock];
+    PhiloxUnits<Dtype>::Map(words, units);
+    const int offset = block * kPerBlock;
+    const int size = std::min(kPerBlock, n - offset);
+    for (int i = 0; i < size; ++i) {
+      r[offset + i] = a + (b - a) * units[i];
+    }
+  }
+}
+
+template
+void caffe_rng_philox_uniform<float>(const int n, const float a,
+                                     const float b, float* r);
+
+template
+void caffe_rng_philox_uniform<double>(const int n, const double a,
+                                      const double b, double* r);
+
+template <typename Dtype>
+void caffe_rng_philox_gaussian(const int n, const Dtype mu,
+                               const Dtype sigma, Dtype* r) {
+  CHECK_GE(n, 0);
+  CHECK(r);
+  CHECK_GT(sigma, 0);
+  unsigned int key[2];
+  NewPhiloxKey(key);
+  const int kPerBlock = PhiloxUnits<Dtype>::kPerBlock;
+  const int num_blocks = (n + kPerBlock - 1) / kPerBlock;
+#ifdef _OPENMP
+  #pragma omp parallel for if (n > kPhiloxGrain) schedule(static)
+#endif
+  for (int block = 0; block < num_blocks; ++block) {
+    uint32_t words[4];
+    PhiloxBlock(key, block, words);
+    Dtype units[kPerBlock];
+    PhiloxUnits<Dtype>::Map(words, units);
+    // Box-Muller transform of each pair of uniforms, the first of the pair
+    // taken in (0, 1] so that its log is finite.
+    Dtype values[kPerBlock];
+    for (int pair = 0; pair < kPerBlock / 2; ++pair) {
+      const Dtype u1 = 1 - units[2 * pair];
+      const Dtype u2 = units[2 * pair + 1];
+      const Dtype radius = sigma * sqrt(Dtype(-2) * log(u1));
+      const Dtype angle = Dtype(2 * M_PI) * u2;
+      values[2 * pair] = mu + radius * cos(angle);
+      values[2 * pair + 1] = mu + radius * sin(angle);
+    }
+    const int offset = block * kPerBlock;
+    const int size = std::min(kPerBlock, n - offset);
+    for (int i = 0; i < size; ++i) {
+      r[offset + i] = values[i];
+    }
+  }
+}
+
+template
+void caffe_rng_philox_gaussian<float>(const int n, const float mu,
+                                      const float sigma, float* r);
+
+template
+void caffe_rng_philox_gaussian<double>(const int n, const double mu,
+                                       const double sigma, double* r);
+
+template <typename Dtype>
+void caffe_rng_philox_bernoulli_bits(const int n, const Dtype p,
+                                     unsigned int* r) {
+  CHECK_GE(n, 0);
+  CHECK(r);
+  CHECK_GE(p, 0);
+  CHECK_LE(p, 1);
+  unsigned int key[2];
+  NewPhiloxKey(key);
+  // A random word is below the threshold with probability p.
+  const uint64_t threshold =
+      static_cast<uint64_t>(static_cast<double>(p) * 4294967296.);
+  const int num_words = (n + 31) / 32;
+#ifdef _OPENMP
+  #pragma omp parallel for if (n > kPhiloxGrain) schedule(static)
+#endif
+  for (int word = 0; word < num_words; ++word) {
+    // Eight blocks of four random words make the 32 bits of a mask word.
+    uint32_t bits = 0;
+    for (int block = 0; block < 8; ++block) {
+      uint32_t words[4];
+      PhiloxBlock(key, word * 8 + block, words);
+      for (int i = 0; i < 4; ++i) {
+        bits |= static_cast<uint32_t>(words[i] < threshold) << (block * 4 + i);
+      }
+    }
+    const int size = n - word * 32;
+    if (size < 32) {
+      bits &= (1u << size) - 1;
+    }
+    r[word] = bits;
+  }
+}
+
+template
+void caffe_rng_philox_bernoulli_bits<float>(const int n, const float p,
+                                            unsigned int* r);
+
+template
+void caffe_rng_philox_bernoulli_bits<double>(const int n, const double p,
+                                             unsigned int* r);
+
 template <>
 float caffe_cpu_strided_dot<float>(const int n, const float* x, const int incx,
     const float* y, const int incy) {
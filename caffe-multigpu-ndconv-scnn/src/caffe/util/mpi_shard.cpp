@@ -0,0 +1,61 @@
+#ifdef USE_MPI
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/mpi_shard.hpp"
+#include "caffe/util/mpi_templates.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void ShardBlobRows(Blob<Dtype>* blob) {
+  const int mpi_size = Caffe::mpi_size();
+  if (mpi_size == 1) return;
+  CHECK_GE(blob->num_axes(), 1);
+  vector<int> shape = blob->shape();
+  CHECK_EQ(shape[0] % mpi_size, 0)
+      << "The first dimension (" << shape[0] << ") of a sharded blob should "
+      << "be divisible by the number of MPI processes (" << mpi_size << ")";
+  const int shard_count = blob->count() / mpi_size;
+  const int offset = shard_count * Caffe::mpi_rank();
+  Blob<Dtype> shard;
+  shape[0] /= mpi_size;
+  shard.Reshape(shape);
+  caffe_copy(shard_count, blob->cpu_data() + offset,
+      shard.mutable_cpu_data());
+  caffe_copy(shard_count, blob->cpu_diff() + offset,
+      shard.mutable_cpu_diff());
+  blob->Reshape(shape);
+  caffe_copy(shard_count, shard.cpu_data(), blob->mutable_cpu_data());
+  caffe_copy(shard_count, shard.cpu_diff(), blob->mutable_cpu_diff());
+}
+
+template <typename Dtype>
+void GatherBlobRowsToProto(const Blob<Dtype>& blob, BlobProto* proto,
+                           bool write_diff) {
+  const bool is_root = (Caffe::mpi_rank() == 0);
+  vector<int> shape = blob.shape();
+  shape[0] *= Caffe::mpi_size();
+  Blob<Dtype> full;
+  if (is_root) full.Reshape(shape);
+  MPIGather<Dtype>(blob.count(), blob.cpu_data(),
+      is_root ? full.mutable_cpu_data() : NULL);
+  if (write_diff) {
+    MPIGather<Dtype>(blob.count(), blob.cpu_diff(),
+        is_root ? full.mutable_cpu_diff() : NULL);
+  }
+  if (is_root) full.ToProto(proto, write_diff);
+}
+
+template void ShardBlobRows(Blob<float>* blob);
+template void ShardBlobRows(Blob<double>* blob);
+template void GatherBlobRowsToProto(const Blob<float>& blob,
+    BlobProto* proto, bool write_diff);
+template void GatherBlobRowsToProto(const Blob<double>& blob,
+    BlobProto* proto, bool write_diff);
+
+}  // namespace caffe
+
+#endif // USE_MPI
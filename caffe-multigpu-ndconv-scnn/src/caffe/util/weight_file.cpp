@@ -0,0 +1,294 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/weight_file.hpp"
+
+namespace caffe {
+
+namespace {
+
+const char kMagic[8] = {'C', 'A', 'F', 'F', 'E', 'W', 'T', 'S'};
+const uint32_t kVersion = 1;
+// The arrays are aligned for vectorized loads; the mapping itself is
+// page-aligned.
+const uint64_t kAlignment = 64;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_entries;
+  uint64_t index_size;
+};
+
+inline uint64_t Align(uint64_t offset) {
+  return (offset + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+// Index records: uint32 name length, name, uint32 blob id, uint32 is_double,
+// uint32 number of axes, int32 dims, uint64 offset, uint64 count.
+uint64_t IndexEntrySize(const WeightFile::Entry& entry) {
+  return 4 * sizeof(uint32_t) + entry.layer_name.size() +
+      entry.shape.size() * sizeof(int32_t) + 2 * sizeof(uint64_t);
+}
+
+template <typename T>
+void AppendPod(T value, string* buffer) {
+  buffer->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Reads the index with bounds checking, as the file may be truncated.
+class IndexReader {
+ public:
+  IndexReader(const char* data, uint64_t size, const string& filename)
+      : data_(data), size_(size), pos_(0), filename_(filename) {}
+
+  template <typename T>
+  T ReadPod() {
+    T value;
+    memcpy(&value, Advance(sizeof(value)), sizeof(value));
+    return value;
+  }
+  string ReadString(uint64_t length) {
+    return string(Advance(length), length);
+  }
+
+ private:
+  const char* Advance(uint64_t length) {
+    CHECK_LE(pos_ + length, size_) << "Truncated index in " << filename_;
+    const char* p = data_ + pos_;
+    pos_ += length;
+    return p;
+  }
+
+  const char* data_;
+  uint64_t size_;
+  uint64_t pos_;
+  const string& filename_;
+};
+
+// The shape of a BlobProto, which may use the deprecated 4D dimensions.
+vector<int> BlobProtoShape(const BlobProto& proto) {
+  vector<int> shape;
+  if (proto.has_num() || proto.has_channels() ||
+      proto.has_height() || proto.has_width()) {
+    shape.push_back(proto.num());
+    shape.push_back(proto.channels());
+    shape.push_back(proto.height());
+    shape.push_back(proto.width());
+  } else {
+    for (int i = 0; i < proto.shape().dim_size(); ++i) {
+      shape.push_back(proto.shape().dim(i));
+    }
+  }
+  return shape;
+}
+
+}  // namespace
+
+bool IsWeightFilename(const string& filename) {
+  const size_t length = strlen(kWeightFileExtension);
+  return filename.size() >= length &&
+      filename.compare(filename.size() - length, length,
+                       kWeightFileExtension) == 0;
+}
+
+WeightFile::WeightFile(const string& filename)
+    : filename_(filename), map_(NULL), map_size_(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Couldn't open " << filename;
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0) << "Couldn't stat " << filename;
+  map_size_ = file_stat.st_size;
+  CHECK_GE(map_size_, sizeof(Header)) << "Truncated header in " << filename;
+  // A private, writable mapping: blobs backed by it may be written to, which
+  // copies the pages written to and leaves the file untouched.
+  void* map = mmap(NULL, map_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+      0);
+  close(fd);
+  CHECK(map != MAP_FAILED) << "Couldn't map " << filename;
+  map_ = static_cast<char*>(map);
+
+  Header header;
+  memcpy(&header, map_, sizeof(header));
+  CHECK_EQ(memcmp(header.magic, kMagic, sizeof(kMagic)), 0)
+      << filename << " is not a weight file";
+  CHECK_EQ(header.version, kVersion)
+      << "Unsupported weight file version in " << filename;
+  CHECK_LE(sizeof(header) + header.index_size, map_size_)
+      << "Truncated index in " << filename;
+  IndexReader reader(map_ + sizeof(header), header.index_size, filename);
+  entries_.resize(header.num_entries);
+  for (int i = 0; i < entries_.size(); ++i) {
+    Entry& entry = entries_[i];
+    entry.layer_name = reader.ReadString(reader.ReadPod<uint32_t>());
+    entry.blob_id = reader.ReadPod<uint32_t>();
+    entry.is_double = reader.ReadPod<uint32_t>();
+    entry.shape.resize(reader.ReadPod<uint32_t>());
+    for (int j = 0; j < entry.shape.size(); ++j) {
+      entry.shape[j] = reader.ReadPod<int32_t>();
+    }
+    entry.offset = reader.ReadPod<uint64_t>();
+    entry.count = reader.ReadPod<uint64_t>();
+    const uint64_t bytes = entry.count *
+        (entry.is_double ? sizeof(double) : sizeof(float));
+    CHECK_EQ(entry.offset % kAlignment, 0)
+        << "Misaligned param " << entry.blob_id << " of layer "
+        << entry.layer_name << " in " << filename;
+    CHECK_LE(entry.offset + bytes, map_size_)
+        << "Truncated param " << entry.blob_id << " of layer "
+        << entry.layer_name << " in " << filename;
+  }
+}
+
+WeightFile::~WeightFile() {
+  if (map_) {
+    munmap(map_, map_size_);
+  }
+}
+
+template <typename Dtype>
+Dtype* WeightFile::data(const Entry& entry) const {
+  CHECK(IsStoredAs<Dtype>(entry)) << "Param " << entry.blob_id
+      << " of layer " << entry.layer_name << " has another data type";
+  return reinterpret_cast<Dtype*>(map_ + entry.offset);
+}
+
+template <typename Dtype>
+void WeightFile::CopyTo(const Entry& entry, Blob<Dtype>* blob) const {
+  blob->Reshape(entry.shape);
+  CHECK_EQ(blob->count(), entry.count) << "Param " << entry.blob_id
+      << " of layer " << entry.layer_name << " has an invalid shape";
+  Dtype* blob_data = blob->mutable_cpu_data();
+  if (IsStoredAs<Dtype>(entry)) {
+    caffe_copy(blob->count(), data<Dtype>(entry), blob_data);
+  } else if (entry.is_double) {
+    const double* source = data<double>(entry);
+    for (int i = 0; i < blob->count(); ++i) {
+      blob_data[i] = source[i];
+    }
+  } else {
+    const float* source = data<float>(entry);
+    for (int i = 0; i < blob->count(); ++i) {
+      blob_data[i] = source[i];
+    }
+  }
+}
+
+void WeightFile::ToProto(NetParameter* param) const {
+  param->Clear();
+  LayerParameter* layer_param = NULL;
+  for (int i = 0; i < entries_.size(); ++i) {
+    const Entry& entry = entries_[i];
+    if (!layer_param || layer_param->name() != entry.layer_name) {
+      layer_param = param->add_layer();
+      layer_param->set_name(entry.layer_name);
+    }
+    CHECK_EQ(entry.blob_id, layer_param->blobs_size())
+        << "Params of layer " << entry.layer_name << " are out of order";
+    BlobProto* blob_proto = layer_param->add_blobs();
+    for (int j = 0; j < entry.shape.size(); ++j) {
+      blob_proto->mutable_shape()->add_dim(entry.shape[j]);
+    }
+    if (entry.is_double) {
+      blob_proto->mutable_double_data()->Resize(entry.count, 0);
+      memcpy(blob_proto->mutable_double_data()->mutable_data(),
+          data<double>(entry), entry.count * sizeof(double));
+    } else {
+      blob_proto->mutable_data()->Resize(entry.count, 0);
+      memcpy(blob_proto->mutable_data()->mutable_data(), data<float>(entry),
+          entry.count * sizeof(float));
+    }
+  }
+}
+
+void WeightFile::Write(const NetParameter& param, const string& filename) {
+  // Build the index first: its size fixes the offsets of the arrays.
+  vector<Entry> entries;
+  vector<const BlobProto*> blob_protos;
+  uint64_t index_size = 0;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer_param = param.layer(i);
+    for (int j = 0; j < layer_param.blobs_size(); ++j) {
+      const BlobProto& blob_proto = layer_param.blobs(j);
+      Entry entry;
+      entry.layer_name = layer_param.name();
+      entry.blob_id = j;
+      entry.is_double = blob_proto.double_data_size() > 0;
+      entry.shape = BlobProtoShape(blob_proto);
+      entry.count = entry.is_double ? blob_proto.double_data_size() :
+          blob_proto.data_size();
+      uint64_t shape_count = 1;
+      for (int k = 0; k < entry.shape.size(); ++k) {
+        shape_count *= entry.shape[k];
+      }
+      CHECK_EQ(shape_count, entry.count) << "Param " << j << " of layer "
+          << entry.layer_name << " has an invalid shape";
+      index_size += IndexEntrySize(entry);
+      entries.push_back(entry);
+      blob_protos.push_back(&blob_proto);
+    }
+  }
+  uint64_t offset = Align(sizeof(Header) + index_size);
+  string index;
+  index.reserve(index_size);
+  for (int i = 0; i < entries.size(); ++i) {
+    Entry& entry = entries[i];
+    entry.offset = offset;
+    offset = Align(offset +
+        entry.count * (entry.is_double ? sizeof(double) : sizeof(float)));
+    AppendPod<uint32_t>(entry.layer_name.size(), &index);
+    index.append(entry.layer_name);
+    AppendPod<uint32_t>(entry.blob_id, &index);
+    AppendPod<uint32_t>(entry.is_double, &index);
+    AppendPod<uint32_t>(entry.shape.size(), &index);
+    for (int j = 0; j < entry.shape.size(); ++j) {
+      AppendPod<int32_t>(entry.shape[j], &index);
+    }
+    AppendPod<uint64_t>(entry.offset, &index);
+    AppendPod<uint64_t>(entry.count, &index);
+  }
+
+  std::ofstream output(filename.c_str(),
+      std::ios::out | std::ios::trunc | std::ios::binary);
+  CHECK(output) << "Couldn't open " << filename << " to save weights.";
+  Header header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.num_entries = entries.size();
+  header.index_size = index_size;
+  output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  output.write(index.data(), index.size());
+  uint64_t pos = sizeof(header) + index_size;
+  const string padding(kAlignment, '\0');
+  for (int i = 0; i < entries.size(); ++i) {
+    const Entry& entry = entries[i];
+    output.write(padding.data(), entry.offset - pos);
+    const char* source = entry.is_double ?
+        reinterpret_cast<const char*>(blob_protos[i]->double_data().data()) :
+        reinterpret_cast<const char*>(blob_protos[i]->data().data());
+    const uint64_t bytes = entry.count *
+        (entry.is_double ? sizeof(double) : sizeof(float));
+    output.write(source, bytes);
+    pos = entry.offset + bytes;
+  }
+  output.close();
+  CHECK(output) << "Error saving weights to " << filename << ".";
+}
+
+template float* WeightFile::data<float>(const Entry& entry) const;
+template double* WeightFile::data<double>(const Entry& entry) const;
+template void WeightFile::CopyTo<float>(const Entry& entry,
+    Blob<float>* blob) const;
+template void WeightFile::CopyTo<double>(const Entry& entry,
+    Blob<double>* blob) const;
+
+}  // namespace caffe
@@ -14,6 +14,7 @@ namespace bp = boost::python;
 
 #include "boost/algorithm/string.hpp"
 #include "caffe/caffe.hpp"
+#include "caffe/util/host_allocator.hpp"
 #include "caffe/util/mpi_templates.hpp"
 
 using caffe::Blob;
@@ -39,6 +40,9 @@ DEFINE_string(weights, "",
     "Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_bool(huge_pages, false,
+    "Optional; back host allocations of 2MB and more with transparent huge "
+    "pages.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -393,6 +397,11 @@ int time() {
     FLAGS_iterations << " ms.";
 #endif
   LOG(INFO) << "Total Time: " << total_timer.MilliSeconds() << " ms.";
+  const caffe::HostAllocator::Stats host_stats =
+      caffe::HostAllocator::Get().stats();
+  LOG(INFO) << "Host memory: " << host_stats.peak_bytes_in_use
+      << " bytes at peak, " << host_stats.num_cache_hits << " of "
+      << host_stats.num_allocations << " allocations served from the cache.";
   LOG(INFO) << "*** Benchmark ends ***";
   return 0;
 }
@@ -411,6 +420,7 @@ int main(int argc, char** argv) {
       "  time            benchmark model execution time");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  caffe::HostAllocator::Get().set_use_huge_pages(FLAGS_huge_pages);
   if (argc == 2) {
 #ifdef WITH_PYTHON_LAYER
     try {
@@ -0,0 +1,42 @@
+// This program converts trained weights between the .caffemodel binary proto
+// format and the raw, memory-mappable .caffeweights format (see WeightFile).
+// The direction of the conversion is given by the extension of the output.
+// Usage:
+//    convert_weights input_weights output_weights
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+#include "caffe/util/weight_file.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 3) {
+    LOG(ERROR) << "Usage: convert_weights input_weights output_weights\n"
+        << "Converts a .caffemodel to the raw " << kWeightFileExtension
+        << " format when output_weights ends in " << kWeightFileExtension
+        << ", and back otherwise.";
+    return 1;
+  }
+  const string input_filename(argv[1]);
+  const string output_filename(argv[2]);
+
+  if (IsWeightFilename(output_filename)) {
+    NetParameter net_param;
+    ReadNetParamsFromBinaryFileOrDie(input_filename, &net_param);
+    WeightFile::Write(net_param, output_filename);
+  } else {
+    CHECK(IsWeightFilename(input_filename)) << "Either the input or the "
+        << "output must be a " << kWeightFileExtension << " file.";
+    WeightFile weights(input_filename);
+    NetParameter net_param;
+    weights.ToProto(&net_param);
+    WriteProtoToBinaryFile(net_param, output_filename);
+  }
+  LOG(INFO) << "Wrote " << output_filename;
+  return 0;
+}
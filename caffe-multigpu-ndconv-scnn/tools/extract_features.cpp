@@ -11,12 +11,14 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 #include "caffe/vision_layers.hpp"
 
 using caffe::Blob;
 using caffe::Caffe;
 using caffe::Datum;
 using caffe::Net;
+using caffe::NetParameter;
 using boost::shared_ptr;
 using std::string;
 namespace db = caffe::db;
@@ -96,14 +98,22 @@ int feature_extraction_pipeline(int argc, char** argv) {
    }
    */
   std::string feature_extraction_proto(argv[++arg_pos]);
-  shared_ptr<Net<Dtype> > feature_extraction_net(
-      new Net<Dtype>(feature_extraction_proto, caffe::TEST));
-  feature_extraction_net->CopyTrainedLayersFrom(pretrained_binary_proto);
-
   std::string extract_feature_blob_names(argv[++arg_pos]);
   std::vector<std::string> blob_names;
   boost::split(blob_names, extract_feature_blob_names, boost::is_any_of(","));
 
+  NetParameter feature_extraction_param;
+  caffe::ReadNetParamsFromTextFileOrDie(feature_extraction_proto,
+      &feature_extraction_param);
+  feature_extraction_param.mutable_state()->set_phase(caffe::TEST);
+  // Keep the features in their own memory if the net plans its memory.
+  for (size_t i = 0; i < blob_names.size(); i++) {
+    feature_extraction_param.add_pinned_blob(blob_names[i]);
+  }
+  shared_ptr<Net<Dtype> > feature_extraction_net(
+      new Net<Dtype>(feature_extraction_param));
+  feature_extraction_net->CopyTrainedLayersFrom(pretrained_binary_proto);
+
   std::string save_feature_dataset_names(argv[++arg_pos]);
   std::vector<std::string> dataset_names;
   boost::split(dataset_names, save_feature_dataset_names,
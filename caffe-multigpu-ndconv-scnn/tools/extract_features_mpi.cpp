@@ -1,217 +1,278 @@
-#include <stdio.h>  // for snprintf
-#include <string>
-#include <vector>
-
-#include "boost/algorithm/string.hpp"
-#include "google/protobuf/text_format.h"
-
-#include "caffe/blob.hpp"
-#include "caffe/common.hpp"
-#include "caffe/net.hpp"
-#include "caffe/proto/caffe.pb.h"
-#include "caffe/util/db.hpp"
-#include "caffe/util/io.hpp"
-#include "caffe/vision_layers.hpp"
-
-using caffe::Blob;
-using caffe::Caffe;
-using caffe::Datum;
-using caffe::Net;
-using boost::shared_ptr;
-using std::string;
-namespace db = caffe::db;
-
-template<typename Dtype>
-int feature_extraction_pipeline(int argc, char** argv);
-
-int main(int argc, char** argv) {
-  return feature_extraction_pipeline<float>(argc, argv);
-//  return feature_extraction_pipeline<double>(argc, argv);
-}
-
-template<typename Dtype>
-int feature_extraction_pipeline(int argc, char** argv) {
-  caffe::GlobalInit(&argc, &argv);
-  const int num_required_args = 7;
-  if (argc < num_required_args) {
-    LOG(ERROR)<<
-    "This program takes in a trained network and an input data layer, and then"
-    " extract features of the input data produced by the net.\n"
-    "Usage: extract_features_mpi  pretrained_net_param"
-    "  feature_extraction_proto_file  extract_feature_blob_name1[,name2,...]"
-    "  save_feature_dataset_name1[,name2,...]  num_mini_batches  db_type"
-    "  [CPU/GPU] [DEVICE_ID=0]\n"
-    "Note: you can extract multiple features in one pass by specifying"
-    " multiple feature blob names and dataset names seperated by ','."
-    " The names cannot contain white space characters and the number of blobs"
-    " and datasets must be equal.";
-    return 1;
-  }
-  int arg_pos = num_required_args;
-
-  arg_pos = num_required_args;
-  if (argc > arg_pos && strcmp(argv[arg_pos], "GPU") == 0) {
-    LOG(ERROR)<< "Using GPU";
-    std::vector<int> gpus;
-    if (argc > arg_pos + 1) {
-      std::string device_string(argv[arg_pos + 1]);
-      std::vector<std::string> device_id_strings;
-      boost::split(device_id_strings, device_string, boost::is_any_of(","));
-      for (int i = 0; i < device_id_strings.size(); i ++ ){
-        uint device_id = atoi(device_id_strings[i].c_str());
-        CHECK_GE(device_id, 0);
-        gpus.push_back(device_id);
-      }
-    }
-    int gpu_id = gpus.size() == 0 ? -1 : gpus[0];
-#ifdef USE_MPI
-    // Check whether the number of MPI processors matches the number of devices.
-    if (Caffe::mpi_rank() == 0) {
-      CHECK_EQ(Caffe::mpi_size(), gpus.size())
-          << "The number of MPI processors should match"
-             "the number of GPU devices provided";
-    }
-    gpu_id = gpus[Caffe::mpi_rank()];
-#endif
-    Caffe::SetDevice(gpu_id);
-    Caffe::set_mode(Caffe::GPU);
-  } else {
-    LOG(ERROR) << "Using CPU";
-    Caffe::set_mode(Caffe::CPU);
-  }
-
-  arg_pos = 0;  // the name of the executable
-  std::string pretrained_binary_proto(argv[++arg_pos]);
-
-  // Expected prototxt contains at least one data layer such as
-  //  the layer data_layer_name and one feature blob such as the
-  //  fc7 top blob to extract features.
-  /*
-   layers {
-     name: "data_layer_name"
-     type: DATA
-     data_param {
-       source: "/path/to/your/images/to/extract/feature/images_leveldb"
-       mean_file: "/path/to/your/image_mean.binaryproto"
-       batch_size: 128
-       crop_size: 227
-       mirror: false
-     }
-     top: "data_blob_name"
-     top: "label_blob_name"
-   }
-   layers {
-     name: "drop7"
-     type: DROPOUT
-     dropout_param {
-       dropout_ratio: 0.5
-     }
-     bottom: "fc7"
-     top: "fc7"
-   }
-   */
-  std::string feature_extraction_proto(argv[++arg_pos]);
-  shared_ptr<Net<Dtype> > feature_extraction_net(
-      new Net<Dtype>(feature_extraction_proto, caffe::TEST));
-  feature_extraction_net->CopyTrainedLayersFrom(pretrained_binary_proto);
-
-#ifdef USE_MPI
-  feature_extraction_net->SyncLayers();
-#endif
-
-  std::string extract_feature_blob_names(argv[++arg_pos]);
-  std::vector<std::string> blob_names;
-  boost::split(blob_names, extract_feature_blob_names, boost::is_any_of(","));
-
-  std::string save_feature_dataset_names(argv[++arg_pos]);
-  std::vector<std::string> dataset_names;
-  boost::split(dataset_names, save_feature_dataset_names,
-               boost::is_any_of(","));
-  CHECK_EQ(blob_names.size(), dataset_names.size()) <<
-      " the number of blob names and dataset names must be equal";
-  size_t num_features = blob_names.size();
-
-  for (size_t i = 0; i < num_features; i++) {
-    CHECK(feature_extraction_net->has_blob(blob_names[i]))
-        << "Unknown feature blob name " << blob_names[i]
-        << " in the network " << feature_extraction_proto;
-  }
-
-  int num_mini_batches = atoi(argv[++arg_pos]);
-
-  std::vector<shared_ptr<db::DB> > feature_dbs;
-  std::vector<shared_ptr<db::Transaction> > txns;
-  const char* db_type = argv[++arg_pos];
-  for (size_t i = 0; i < num_features; ++i) {
-#ifdef USE_MPI
-    if (Caffe::mpi_rank() != 0) break;
-#endif
-    LOG(INFO)<< "Opening dataset " << dataset_names[i];
-    shared_ptr<db::DB> db(db::GetDB(db_type));
-    db->Open(dataset_names.at(i), db::NEW);
-    feature_dbs.push_back(db);
-    shared_ptr<db::Transaction> txn(db->NewTransaction());
-    txns.push_back(txn);
-  }
-
-  LOG(ERROR)<< "Extacting Features";
-
-  Datum datum;
-  const int kMaxKeyStrLength = 100;
-  char key_str[kMaxKeyStrLength];
-  std::vector<Blob<float>*> input_vec;
-  std::vector<int> image_indices(num_features, 0);
-  for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index) {
-    feature_extraction_net->Forward(input_vec);
-#ifdef USE_MPI
-    if (Caffe::mpi_rank() != 0) continue;
-#endif
-    for (int i = 0; i < num_features; ++i) {
-      const shared_ptr<Blob<Dtype> > feature_blob = feature_extraction_net
-          ->blob_by_name(blob_names[i]);
-      int batch_size = feature_blob->num();
-      int dim_features = feature_blob->count() / batch_size;
-      const Dtype* feature_blob_data;
-      for (int n = 0; n < batch_size; ++n) {
-        datum.set_height(feature_blob->height());
-        datum.set_width(feature_blob->width());
-        datum.set_channels(feature_blob->channels());
-        datum.clear_data();
-        datum.clear_float_data();
-        feature_blob_data = feature_blob->cpu_data() +
-            feature_blob->offset(n);
-        for (int d = 0; d < dim_features; ++d) {
-          datum.add_float_data(feature_blob_data[d]);
-        }
-        int length = snprintf(key_str, kMaxKeyStrLength, "%010d",
-            image_indices[i]);
-        string out;
-        CHECK(datum.SerializeToString(&out));
-        txns.at(i)->Put(std::string(key_str, length), out);
-        ++image_indices[i];
-        if (image_indices[i] % 1000 == 0) {
-          txns.at(i)->Commit();
-          txns.at(i).reset(feature_dbs.at(i)->NewTransaction());
-          LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
-              " query images for feature blob " << blob_names[i];
-        }
-      }  // for (int n = 0; n < batch_size; ++n)
-    }  // for (int i = 0; i < num_features; ++i)
-  }  // for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index)
-  // write the last batch
-  for (int i = 0; i < num_features; ++i) {
-#ifdef USE_MPI
-    if (Caffe::mpi_rank() != 0) continue;
-#endif
-    if (image_indices[i] % 1000 != 0) {
-      txns.at(i)->Commit();
-    }
-    LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
-        " query images for feature blob " << blob_names[i];
-    feature_dbs.at(i)->Close();
-  }
-
-  LOG(ERROR)<< "Successfully extracted the features!";
-  return 0;
-}
-
+#include <stdio.h>  // for snprintf
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "google/protobuf/text_format.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+#include "caffe/vision_layers.hpp"
+
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::Datum;
+using caffe::Net;
+using caffe::NetParameter;
+using boost::shared_ptr;
+using std::string;
+namespace db = caffe::db;
+
+/**
+ * Writes the features of one mini-batch to a DB in a background thread, so
+ * that the Datum serialization and the DB writes overlap with the forward
+ * pass of the next mini-batch. The key of each feature is its global sample
+ * index, which lets the shards written by different MPI processes be merged
+ * (see merge_feature_dbs) back into the order of the input data.
+ */
+template <typename Dtype>
+class FeatureWriter : public caffe::InternalThread {
+ public:
+  FeatureWriter(const string& db_type, const string& db_name)
+      : db_(db::GetDB(db_type)), num_written_(0) {
+    LOG(INFO) << "Opening dataset " << db_name;
+    db_->Open(db_name, db::NEW);
+  }
+
+  /// Wait for the previous batch, then start writing a copy of this one.
+  void Write(const Blob<Dtype>& feature_blob, int first_index) {
+    WaitForInternalThreadToExit();
+    // Copy through host memory here, so the thread never touches the device.
+    buffer_.ReshapeLike(feature_blob);
+    caffe::caffe_copy(feature_blob.count(), feature_blob.cpu_data(),
+        buffer_.mutable_cpu_data());
+    first_index_ = first_index;
+    CHECK(StartInternalThread()) << "Failed to start the writer thread";
+  }
+
+  /// Wait for the last batch and close the DB.
+  void Close() {
+    WaitForInternalThreadToExit();
+    db_->Close();
+  }
+
+  int num_written() const { return num_written_; }
+
+ protected:
+  // Each batch runs on a new thread, and an LMDB write transaction must stay
+  // on the thread that began it, so the batch is written in its own
+  // transaction.
+  virtual void InternalThreadEntry() {
+    shared_ptr<db::Transaction> txn(db_->NewTransaction());
+    const int kMaxKeyStrLength = 100;
+    char key_str[kMaxKeyStrLength];
+    const int batch_size = buffer_.num();
+    const int dim_features = buffer_.count() / batch_size;
+    Datum datum;
+    datum.set_height(buffer_.height());
+    datum.set_width(buffer_.width());
+    datum.set_channels(buffer_.channels());
+    datum.mutable_float_data()->Reserve(dim_features);
+    string out;
+    for (int n = 0; n < batch_size; ++n) {
+      const Dtype* feature_data = buffer_.cpu_data() + buffer_.offset(n);
+      datum.clear_float_data();
+      for (int d = 0; d < dim_features; ++d) {
+        datum.mutable_float_data()->AddAlreadyReserved(feature_data[d]);
+      }
+      int length = snprintf(key_str, kMaxKeyStrLength, "%010d",
+          first_index_ + n);
+      CHECK(datum.SerializeToString(&out));
+      txn->Put(string(key_str, length), out);
+      ++num_written_;
+    }
+    txn->Commit();
+  }
+
+  shared_ptr<db::DB> db_;
+  Blob<Dtype> buffer_;
+  int first_index_;
+  int num_written_;
+};
+
+template<typename Dtype>
+int feature_extraction_pipeline(int argc, char** argv);
+
+int main(int argc, char** argv) {
+  return feature_extraction_pipeline<float>(argc, argv);
+//  return feature_extraction_pipeline<double>(argc, argv);
+}
+
+template<typename Dtype>
+int feature_extraction_pipeline(int argc, char** argv) {
+  caffe::GlobalInit(&argc, &argv);
+  const int num_required_args = 7;
+  if (argc < num_required_args) {
+    LOG(ERROR)<<
+    "This program takes in a trained network and an input data layer, and then"
+    " extract features of the input data produced by the net.\n"
+    "Usage: extract_features_mpi  pretrained_net_param"
+    "  feature_extraction_proto_file  extract_feature_blob_name1[,name2,...]"
+    "  save_feature_dataset_name1[,name2,...]  num_mini_batches  db_type"
+    "  [CPU/GPU] [DEVICE_ID=0]\n"
+    "Note: you can extract multiple features in one pass by specifying"
+    " multiple feature blob names and dataset names seperated by ','."
+    " The names cannot contain white space characters and the number of blobs"
+    " and datasets must be equal.\n"
+    "With more than one MPI process, each process writes its own shard to"
+    " dataset_name_part<rank>; use merge_feature_dbs to combine them.";
+    return 1;
+  }
+  int arg_pos = num_required_args;
+
+  arg_pos = num_required_args;
+  if (argc > arg_pos && strcmp(argv[arg_pos], "GPU") == 0) {
+    LOG(ERROR)<< "Using GPU";
+    std::vector<int> gpus;
+    if (argc > arg_pos + 1) {
+      std::string device_string(argv[arg_pos + 1]);
+      std::vector<std::string> device_id_strings;
+      boost::split(device_id_strings, device_string, boost::is_any_of(","));
+      for (int i = 0; i < device_id_strings.size(); i ++ ){
+        uint device_id = atoi(device_id_strings[i].c_str());
+        CHECK_GE(device_id, 0);
+        gpus.push_back(device_id);
+      }
+    }
+    int gpu_id = gpus.size() == 0 ? -1 : gpus[0];
+#ifdef USE_MPI
+    // Check whether the number of MPI processors matches the number of devices.
+    if (Caffe::mpi_rank() == 0) {
+      CHECK_EQ(Caffe::mpi_size(), gpus.size())
+          << "The number of MPI processors should match"
+             "the number of GPU devices provided";
+    }
+    gpu_id = gpus[Caffe::mpi_rank()];
+#endif
+    Caffe::SetDevice(gpu_id);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(ERROR) << "Using CPU";
+    Caffe::set_mode(Caffe::CPU);
+  }
+
+  arg_pos = 0;  // the name of the executable
+  std::string pretrained_binary_proto(argv[++arg_pos]);
+
+  // Expected prototxt contains at least one data layer such as
+  //  the layer data_layer_name and one feature blob such as the
+  //  fc7 top blob to extract features.
+  /*
+   layers {
+     name: "data_layer_name"
+     type: DATA
+     data_param {
+       source: "/path/to/your/images/to/extract/feature/images_leveldb"
+       mean_file: "/path/to/your/image_mean.binaryproto"
+       batch_size: 128
+       crop_size: 227
+       mirror: false
+     }
+     top: "data_blob_name"
+     top: "label_blob_name"
+   }
+   layers {
+     name: "drop7"
+     type: DROPOUT
+     dropout_param {
+       dropout_ratio: 0.5
+     }
+     bottom: "fc7"
+     top: "fc7"
+   }
+   */
+  std::string feature_extraction_proto(argv[++arg_pos]);
+  NetParameter net_param;
+  caffe::ReadNetParamsFromTextFileOrDie(feature_extraction_proto, &net_param);
+  net_param.mutable_state()->set_phase(caffe::TEST);
+  // Every process extracts the features of its own part of each batch.
+  net_param.set_mpi_data_parallel(true);
+  std::string extract_feature_blob_names(argv[++arg_pos]);
+  std::vector<std::string> blob_names;
+  boost::split(blob_names, extract_feature_blob_names, boost::is_any_of(","));
+  // Keep the features in their own memory if the net plans its memory.
+  for (size_t i = 0; i < blob_names.size(); i++) {
+    net_param.add_pinned_blob(blob_names[i]);
+  }
+  shared_ptr<Net<Dtype> > feature_extraction_net(new Net<Dtype>(net_param));
+  feature_extraction_net->CopyTrainedLayersFrom(pretrained_binary_proto);
+
+#ifdef USE_MPI
+  feature_extraction_net->SyncLayers();
+#endif
+
+  std::string save_feature_dataset_names(argv[++arg_pos]);
+  std::vector<std::string> dataset_names;
+  boost::split(dataset_names, save_feature_dataset_names,
+               boost::is_any_of(","));
+  CHECK_EQ(blob_names.size(), dataset_names.size()) <<
+      " the number of blob names and dataset names must be equal";
+  size_t num_features = blob_names.size();
+
+  for (size_t i = 0; i < num_features; i++) {
+    CHECK(feature_extraction_net->has_blob(blob_names[i]))
+        << "Unknown feature blob name " << blob_names[i]
+        << " in the network " << feature_extraction_proto;
+  }
+
+  int num_mini_batches = atoi(argv[++arg_pos]);
+
+  const char* db_type = argv[++arg_pos];
+  int mpi_rank = 0;
+  int mpi_size = 1;
+#ifdef USE_MPI
+  mpi_rank = Caffe::mpi_rank();
+  mpi_size = Caffe::mpi_size();
+#endif
+  std::vector<shared_ptr<FeatureWriter<Dtype> > > writers;
+  for (size_t i = 0; i < num_features; ++i) {
+    string dataset_name = dataset_names[i];
+    if (mpi_size > 1) {
+      std::ostringstream oss;
+      oss << dataset_name << "_part" << mpi_rank;
+      dataset_name = oss.str();
+    }
+    writers.push_back(shared_ptr<FeatureWriter<Dtype> >(
+        new FeatureWriter<Dtype>(db_type, dataset_name)));
+  }
+
+  LOG(ERROR)<< "Extacting Features";
+
+  std::vector<Blob<float>*> input_vec;
+  for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index) {
+    feature_extraction_net->Forward(input_vec);
+    for (int i = 0; i < num_features; ++i) {
+      const shared_ptr<Blob<Dtype> > feature_blob = feature_extraction_net
+          ->blob_by_name(blob_names[i]);
+      // The data layers hand out consecutive slices of each global batch to
+      // the processes in rank order.
+      const int batch_size = feature_blob->num();
+      const int first_index = (batch_index * mpi_size + mpi_rank) * batch_size;
+      writers[i]->Write(*feature_blob, first_index);
+      if ((batch_index + 1) * batch_size * mpi_size / 1000 >
+          batch_index * batch_size * mpi_size / 1000) {
+        LOG(ERROR)<< "Extracted features of "
+            << (batch_index + 1) * batch_size * mpi_size
+            << " query images for feature blob " << blob_names[i];
+      }
+    }
+  }  // for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index)
+  // write the last batch
+  for (int i = 0; i < num_features; ++i) {
+    writers[i]->Close();
+    LOG(ERROR)<< "Extracted features of " << writers[i]->num_written() <<
+        " query images for feature blob " << blob_names[i] << " on process "
+        << mpi_rank;
+  }
+
+  LOG(ERROR)<< "Successfully extracted the features!";
+  return 0;
+}
+
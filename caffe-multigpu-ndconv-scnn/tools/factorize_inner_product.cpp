@@ -0,0 +1,353 @@
+// This program factors the weights of trained InnerProduct layers by a
+// truncated SVD, W ~= U V with U of shape num_output x rank and V of shape
+// rank x input size, and writes the net and the weights using the factored
+// form of the layer (inner_product_param { rank }) so they can be fine-tuned
+// or tested directly. For each layer it reports the reconstruction error and
+// the cost of the factored layer over a range of ranks.
+// Usage:
+//    factorize_inner_product [FLAGS] NET_PROTO WEIGHTS OUT_NET_PROTO
+//        OUT_WEIGHTS
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_string(layers, "",
+    "Comma-separated names of the InnerProduct layers to factor.");
+DEFINE_int32(rank, 0,
+    "The rank of the factored weights. Exclusive with --energy.");
+DEFINE_double(energy, 0,
+    "Use the smallest rank keeping this fraction of the squared Frobenius "
+    "norm of the weights, e.g. 0.9. Exclusive with --rank.");
+DEFINE_int32(max_rank, 1024,
+    "The largest rank considered by --energy.");
+DEFINE_int32(power_iterations, 2,
+    "The number of power iterations of the randomized SVD.");
+DEFINE_string(report_ranks, "32,64,128,256,512",
+    "Comma-separated ranks to report the error and cost of.");
+DEFINE_int32(report_batch, 64,
+    "The batch size to time the dense and factored products with.");
+
+namespace {
+
+// The number of extra vectors sampled by the randomized SVD.
+const int kOversampling = 10;
+
+// Orthonormalizes the rows of the rows x cols matrix a by modified
+// Gram-Schmidt, applied twice for accuracy. Dependent rows are zeroed.
+void OrthonormalizeRows(int rows, int cols, float* a) {
+  for (int i = 0; i < rows; ++i) {
+    float* row = a + i * cols;
+    for (int pass = 0; pass < 2; ++pass) {
+      for (int j = 0; j < i; ++j) {
+        const float* other = a + j * cols;
+        double dot = 0;
+        for (int k = 0; k < cols; ++k) { dot += row[k] * other[k]; }
+        caffe_axpy<float>(cols, -dot, other, row);
+      }
+    }
+    double norm = 0;
+    for (int k = 0; k < cols; ++k) { norm += row[k] * row[k]; }
+    norm = sqrt(norm);
+    caffe_scal<float>(cols, norm > 1e-12 ? 1. / norm : 0., row);
+  }
+}
+
+// Diagonalizes the symmetric n x n matrix a by cyclic Jacobi rotations,
+// leaving the eigenvalues on its diagonal and the eigenvectors in the
+// columns of v.
+void SymmetricEigen(int n, vector<double>* a, vector<double>* v) {
+  vector<double>& A = *a;
+  v->assign(n * n, 0);
+  for (int i = 0; i < n; ++i) { (*v)[i * n + i] = 1; }
+  double norm = 0;
+  for (int i = 0; i < n * n; ++i) { norm += A[i] * A[i]; }
+  for (int sweep = 0; sweep < 100; ++sweep) {
+    double off_diagonal = 0;
+    for (int p = 0; p < n; ++p) {
+      for (int q = p + 1; q < n; ++q) {
+        off_diagonal += A[p * n + q] * A[p * n + q];
+      }
+    }
+    if (off_diagonal <= 1e-24 * norm) { break; }
+    for (int p = 0; p < n; ++p) {
+      for (int q = p + 1; q < n; ++q) {
+        const double apq = A[p * n + q];
+        if (apq == 0) { continue; }
+        const double theta = (A[q * n + q] - A[p * n + p]) / (2 * apq);
+        const double t = (theta >= 0 ? 1. : -1.) /
+            (fabs(theta) + sqrt(theta * theta + 1));
+        const double c = 1 / sqrt(t * t + 1);
+        const double s = t * c;
+        for (int k = 0; k < n; ++k) {
+          const double akp = A[k * n + p], akq = A[k * n + q];
+          A[k * n + p] = c * akp - s * akq;
+          A[k * n + q] = s * akp + c * akq;
+        }
+        for (int k = 0; k < n; ++k) {
+          const double apk = A[p * n + k], aqk = A[q * n + k];
+          A[p * n + k] = c * apk - s * aqk;
+          A[q * n + k] = s * apk + c * aqk;
+        }
+        for (int k = 0; k < n; ++k) {
+          double* vk = &(*v)[k * n];
+          const double vkp = vk[p], vkq = vk[q];
+          vk[p] = c * vkp - s * vkq;
+          vk[q] = s * vkp + c * vkq;
+        }
+      }
+    }
+  }
+}
+
+// Computes the leading l singular triplets of the rows x cols matrix w by
+// randomized subspace iteration (Halko, Martinsson and Tropp, 2011): s gets
+// the singular values in decreasing order, ut the left singular vectors as
+// rows (l x rows) and vt the right ones (l x cols).
+void TruncatedSVD(const float* w, int rows, int cols, int l,
+    vector<double>* s, vector<float>* ut, vector<float>* vt) {
+  // Sample the range of w with a gaussian test matrix.
+  vector<float> omega(cols * l);
+  caffe_rng_gaussian<float>(omega.size(), 0, 1, &omega[0]);
+  vector<float> qt(l * rows), zt(l * cols);
+  caffe_cpu_gemm<float>(CblasTrans, CblasTrans, l, rows, cols, 1.,
+      &omega[0], w, 0., &qt[0]);
+  OrthonormalizeRows(l, rows, &qt[0]);
+  for (int i = 0; i < FLAGS_power_iterations; ++i) {
+    caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, l, cols, rows, 1.,
+        &qt[0], w, 0., &zt[0]);
+    OrthonormalizeRows(l, cols, &zt[0]);
+    caffe_cpu_gemm<float>(CblasNoTrans, CblasTrans, l, rows, cols, 1.,
+        &zt[0], w, 0., &qt[0]);
+    OrthonormalizeRows(l, rows, &qt[0]);
+  }
+  // Project w on the sampled basis, b = q' w, and take the SVD of the small
+  // l x cols matrix b through the eigendecomposition of b b'.
+  vector<float>& b = zt;
+  caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, l, cols, rows, 1.,
+      &qt[0], w, 0., &b[0]);
+  vector<double> gram(l * l), e;
+  for (int i = 0; i < l; ++i) {
+    for (int j = i; j < l; ++j) {
+      double dot = 0;
+      for (int k = 0; k < cols; ++k) {
+        dot += b[i * cols + k] * b[j * cols + k];
+      }
+      gram[i * l + j] = gram[j * l + i] = dot;
+    }
+  }
+  SymmetricEigen(l, &gram, &e);
+  vector<std::pair<double, int> > order(l);
+  for (int i = 0; i < l; ++i) {
+    order[i] = std::make_pair(-gram[i * l + i], i);
+  }
+  std::sort(order.begin(), order.end());
+  // Sorted eigenvectors as rows, scaled by 1 / s for the right vectors.
+  vector<float> et(l * l), et_scaled(l * l);
+  s->resize(l);
+  for (int i = 0; i < l; ++i) {
+    const int index = order[i].second;
+    (*s)[i] = sqrt(std::max(-order[i].first, 0.));
+    const double inverse = (*s)[i] > 1e-12 ? 1. / (*s)[i] : 0.;
+    for (int j = 0; j < l; ++j) {
+      et[i * l + j] = e[j * l + index];
+      et_scaled[i * l + j] = e[j * l + index] * inverse;
+    }
+  }
+  ut->resize(l * rows);
+  vt->resize(l * cols);
+  caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, l, rows, l, 1.,
+      &et[0], &qt[0], 0., &(*ut)[0]);
+  caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, l, cols, l, 1.,
+      &et_scaled[0], &b[0], 0., &(*vt)[0]);
+}
+
+// Returns the milliseconds per product of a batch with the dense weights
+// (rank 0) or with factored weights of the given rank.
+float TimeProduct(int rows, int cols, int rank) {
+  const int batch = FLAGS_report_batch;
+  vector<float> x(batch * cols, 1), y(batch * rows), h(batch * rank + 1);
+  vector<float> u(rows * std::max(rank, 1), 1), v(rank * cols + 1, 1);
+  vector<float> w(rank ? 1 : rows * cols, 1);
+  const int kIterations = 10;
+  CPUTimer timer;
+  timer.Start();
+  for (int i = 0; i < kIterations; ++i) {
+    if (rank) {
+      caffe_cpu_gemm<float>(CblasNoTrans, CblasTrans, batch, rank, cols, 1.,
+          &x[0], &v[0], 0., &h[0]);
+      caffe_cpu_gemm<float>(CblasNoTrans, CblasTrans, batch, rows, rank, 1.,
+          &h[0], &u[0], 0., &y[0]);
+    } else {
+      caffe_cpu_gemm<float>(CblasNoTrans, CblasTrans, batch, rows, cols, 1.,
+          &x[0], &w[0], 0., &y[0]);
+    }
+  }
+  timer.Stop();
+  return timer.MilliSeconds() / kIterations;
+}
+
+// Factors the weights of one layer, rewriting its definition and blobs.
+void FactorLayer(LayerParameter* layer, LayerParameter* weights) {
+  CHECK_EQ(layer->type(), "InnerProduct")
+      << layer->name() << " is not an InnerProduct layer.";
+  InnerProductParameter* param = layer->mutable_inner_product_param();
+  CHECK_EQ(param->rank(), 0) << layer->name() << " is already factored.";
+  CHECK(!param->model_parallel())
+      << "Cannot factor the model-parallel layer " << layer->name();
+  Blob<float> weight;
+  weight.FromProto(weights->blobs(0), true);
+  const int rows = param->num_output();
+  const int cols = weight.count() / rows;
+  CHECK_EQ(rows * cols, weight.count());
+  const int max_rank = std::min(rows, cols);
+
+  vector<string> report_ranks;
+  boost::split(report_ranks, FLAGS_report_ranks, boost::is_any_of(","));
+  std::set<int> ranks;
+  for (int i = 0; i < report_ranks.size(); ++i) {
+    const int rank = atoi(report_ranks[i].c_str());
+    if (rank > 0 && rank < max_rank) { ranks.insert(rank); }
+  }
+  int needed_rank = FLAGS_rank ? FLAGS_rank : FLAGS_max_rank;
+  if (!ranks.empty()) { needed_rank = std::max(needed_rank, *ranks.rbegin()); }
+  const int l = std::min(needed_rank + kOversampling, max_rank);
+
+  vector<double> s;
+  vector<float> ut, vt;
+  TruncatedSVD(weight.cpu_data(), rows, cols, l, &s, &ut, &vt);
+  double total_energy = 0;
+  for (int i = 0; i < weight.count(); ++i) {
+    total_energy += weight.cpu_data()[i] * weight.cpu_data()[i];
+  }
+  vector<double> energy(l + 1, 0);
+  for (int i = 0; i < l; ++i) { energy[i + 1] = energy[i] + s[i] * s[i]; }
+
+  int rank = std::min(FLAGS_rank, l);
+  if (!FLAGS_rank) {
+    for (rank = 1; rank < std::min(l, FLAGS_max_rank) &&
+         energy[rank] < FLAGS_energy * total_energy; ++rank) {}
+  }
+  ranks.insert(rank);
+
+  const float dense_ms = TimeProduct(rows, cols, 0);
+  LOG(INFO) << layer->name() << ": " << rows << " x " << cols
+      << " weights, " << dense_ms << " ms per batch of "
+      << FLAGS_report_batch;
+  for (std::set<int>::const_iterator it = ranks.begin(); it != ranks.end();
+       ++it) {
+    if (*it > l) { continue; }
+    const double error = sqrt(std::max(total_energy - energy[*it], 0.) /
+        total_energy);
+    const double cost = static_cast<double>(*it) * (rows + cols) /
+        (static_cast<double>(rows) * cols);
+    LOG(INFO) << "  rank " << *it << (*it == rank ? " (chosen)" : "")
+        << ": relative error " << error
+        << ", params and FLOPs x" << cost
+        << ", " << TimeProduct(rows, cols, *it) << " ms";
+  }
+  if (static_cast<double>(rank) * (rows + cols) >=
+      static_cast<double>(rows) * cols) {
+    LOG(WARNING) << layer->name() << ": rank " << rank
+        << " does not reduce the cost of the layer.";
+  }
+
+  // Split the singular values evenly between the two factors.
+  vector<int> u_shape(2), v_shape(2);
+  u_shape[0] = rows;
+  u_shape[1] = rank;
+  v_shape[0] = rank;
+  v_shape[1] = cols;
+  Blob<float> u(u_shape), v(v_shape);
+  for (int i = 0; i < rank; ++i) {
+    const float scale = sqrt(s[i]);
+    for (int n = 0; n < rows; ++n) {
+      u.mutable_cpu_data()[n * rank + i] = ut[i * rows + n] * scale;
+    }
+    caffe_cpu_scale<float>(cols, scale, &vt[i * cols],
+        v.mutable_cpu_data() + i * cols);
+  }
+  u.ToProto(weights->mutable_blobs(0));
+  v.ToProto(weights->add_blobs());
+
+  param->set_rank(rank);
+  if (layer->param_size() > 0) {
+    // The second factor learns like the weights it replaces.
+    ParamSpec spec = layer->param(0);
+    if (spec.has_name()) { spec.set_name(spec.name() + "_factor"); }
+    while (layer->param_size() < weights->blobs_size() - 1) {
+      layer->add_param();
+    }
+    *layer->add_param() = spec;
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Factor the weights of trained InnerProduct layers "
+        "by truncated SVD\n"
+        "Usage:\n"
+        "    factorize_inner_product [FLAGS] NET_PROTO WEIGHTS "
+        "OUT_NET_PROTO OUT_WEIGHTS\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 5 || FLAGS_layers.empty() ||
+      (FLAGS_rank > 0) == (FLAGS_energy > 0)) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0],
+        "tools/factorize_inner_product");
+    return 1;
+  }
+  CHECK_LE(FLAGS_energy, 1) << "energy is a fraction of the weight norm.";
+
+  NetParameter net_param, weights_param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  ReadNetParamsFromBinaryFileOrDie(argv[2], &weights_param);
+  vector<string> names;
+  boost::split(names, FLAGS_layers, boost::is_any_of(","));
+  for (int i = 0; i < names.size(); ++i) {
+    LayerParameter* layer = NULL;
+    for (int j = 0; j < net_param.layer_size(); ++j) {
+      if (net_param.layer(j).name() == names[i]) {
+        layer = net_param.mutable_layer(j);
+      }
+    }
+    LayerParameter* weights = NULL;
+    for (int j = 0; j < weights_param.layer_size(); ++j) {
+      if (weights_param.layer(j).name() == names[i]) {
+        weights = weights_param.mutable_layer(j);
+      }
+    }
+    CHECK(layer) << "Unknown layer " << names[i];
+    CHECK(weights && weights->blobs_size() > 0)
+        << "No weights for layer " << names[i];
+    FactorLayer(layer, weights);
+  }
+  WriteProtoToTextFile(net_param, argv[3]);
+  WriteProtoToBinaryFile(weights_param, argv[4]);
+  LOG(INFO) << "Wrote " << argv[3] << " and " << argv[4];
+  return 0;
+}
@@ -0,0 +1,72 @@
+// Merge the feature DB shards written by the MPI processes of
+// extract_features_mpi into a single DB.
+// Usage:
+//    merge_feature_dbs [FLAGS] OUTPUT_DB INPUT_DB1 [INPUT_DB2 ...]
+// The keys of the shards are the global sample indices, so the merged DB
+// lists the features in the order of the input data.
+
+#include <string>
+#include <vector>
+
+#include "boost/scoped_ptr.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/util/db.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+using boost::scoped_ptr;
+using std::string;
+
+DEFINE_string(backend, "lmdb",
+        "The backend {leveldb, lmdb} of the input and output DBs");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  // Print output to stderr (while still logging)
+  FLAGS_alsologtostderr = 1;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Merge the feature DBs written by the processes of"
+        " extract_features_mpi\n"
+        "Usage:\n"
+        "    merge_feature_dbs [FLAGS] OUTPUT_DB INPUT_DB1 [INPUT_DB2 ...]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc < 3) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/merge_feature_dbs");
+    return 1;
+  }
+
+  scoped_ptr<db::DB> out_db(db::GetDB(FLAGS_backend));
+  out_db->Open(argv[1], db::NEW);
+  scoped_ptr<db::Transaction> txn(out_db->NewTransaction());
+  int count = 0;
+  for (int i = 2; i < argc; ++i) {
+    LOG(INFO) << "Merging " << argv[i];
+    scoped_ptr<db::DB> in_db(db::GetDB(FLAGS_backend));
+    in_db->Open(argv[i], db::READ);
+    scoped_ptr<db::Cursor> cursor(in_db->NewCursor());
+    for (cursor->SeekToFirst(); cursor->valid(); cursor->Next()) {
+      // Both backends keep the keys sorted, so the shards interleave back
+      // into the global order no matter in which order they are merged.
+      txn->Put(cursor->key(), cursor->value());
+      if (++count % 1000 == 0) {
+        txn->Commit();
+        txn.reset(out_db->NewTransaction());
+        LOG(INFO) << "Merged " << count << " features.";
+      }
+    }
+    in_db->Close();
+  }
+  if (count % 1000 != 0) {
+    txn->Commit();
+  }
+  out_db->Close();
+  LOG(INFO) << "Merged " << count << " features into " << argv[1];
+  return 0;
+}